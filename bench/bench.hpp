@@ -0,0 +1,235 @@
+#ifndef NUL_BENCH_H_
+#define NUL_BENCH_H_
+#include "util/alloc_tracker.hpp"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+
+namespace nul {
+namespace bench {
+
+  /**
+   * what a benchmark loops on:
+   *
+   *   BENCH(uri_parse) {
+   *     URI uri;
+   *     while (state.next()) {
+   *       bench::doNotOptimize(uri.parse(input));
+   *     }
+   *   }
+   *
+   * only the loop is measured, not the setup before it or the teardown
+   * after it, bytesPerOp turns into bytes/sec
+   */
+  class State final {
+    public:
+      explicit State(uint64_t iterations) : remaining_(iterations) {
+      }
+
+      // the clock and the allocation counters start on the first call and
+      // stop on the one that returns false
+      bool next() {
+        if (__builtin_expect(started_ && remaining_ > 0, 1)) {
+          --remaining_;
+          return true;
+        }
+        return nextSlow();
+      }
+
+      void setBytesPerOp(uint64_t bytes) {
+        bytesPerOp_ = bytes;
+      }
+
+      uint64_t bytesPerOp() const {
+        return bytesPerOp_;
+      }
+
+    private:
+      friend class Registry;
+
+      using Clock = std::chrono::steady_clock;
+
+      bool nextSlow() {
+        if (!started_) {
+          started_ = true;
+          AllocTracker::read(allocsBegin_);
+          begin_ = Clock::now();
+        }
+        if (remaining_ > 0) {
+          --remaining_;
+          return true;
+        }
+        stop();
+        return false;
+      }
+
+      // also called after the benchmark returns, in case it left early
+      void stop() {
+        if (started_ && !stopped_) {
+          end_ = Clock::now();
+          AllocTracker::read(allocsEnd_);
+          stopped_ = true;
+        }
+      }
+
+      std::chrono::nanoseconds elapsed() const {
+        return stopped_ ? end_ - begin_ : std::chrono::nanoseconds{0};
+      }
+
+      uint64_t allocs(int i) const {
+        return stopped_ ? allocsEnd_.values[i] - allocsBegin_.values[i] : 0;
+      }
+
+      uint64_t remaining_;
+      uint64_t bytesPerOp_{0};
+      bool started_{false};
+      bool stopped_{false};
+      Clock::time_point begin_;
+      Clock::time_point end_;
+      AllocTracker::Sample allocsBegin_;
+      AllocTracker::Sample allocsEnd_;
+  };
+
+  // keeps 'value' from being optimized away
+  template <typename T>
+  inline void doNotOptimize(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+  }
+
+  struct Result {
+    std::string name;
+    uint64_t iterations{0};
+    double nsPerOp{0};
+    double opsPerSec{0};
+    double bytesPerSec{0};
+    double allocsPerOp{0};
+    double allocBytesPerOp{0};
+  };
+
+  class Registry final {
+    public:
+      using Fn = std::function<void(State &)>;
+
+      static Registry &instance() {
+        static Registry registry;
+        return registry;
+      }
+
+      bool add(const char *name, Fn fn) {
+        benches_.emplace_back(name, std::move(fn));
+        return true;
+      }
+
+      /**
+       * runs the benchmarks whose name contains 'filter', each is run once
+       * to warm up, then with growing iteration counts until the loop of
+       * one run takes at least 'minTime'
+       */
+      std::vector<Result> run(
+          const std::string &filter, std::chrono::nanoseconds minTime) {
+        std::vector<Result> results;
+        for (auto &b : benches_) {
+          if (b.first.find(filter) == std::string::npos) {
+            continue;
+          }
+          // warm-up, first-use work (lazy statics, clock calibration,
+          // cold caches) is not measured
+          State warmup(1);
+          b.second(warmup);
+
+          uint64_t iterations = 1;
+          while (true) {
+            State state(iterations);
+            b.second(state);
+            state.stop();
+            auto elapsed = state.elapsed();
+            if (elapsed >= minTime || iterations >= (1ull << 40)) {
+              results.push_back(result(b.first, iterations, state));
+              break;
+            }
+            // aim 20% over minTime, growing at most 10x per round
+            auto ns = std::max<double>(elapsed.count(), 1.0);
+            auto next = iterations * std::min(10.0, 1.2 * minTime.count() / ns);
+            iterations = std::max(iterations + 1, static_cast<uint64_t>(next));
+          }
+        }
+        return results;
+      }
+
+    private:
+      static Result result(
+          const std::string &name, uint64_t iterations, const State &state) {
+        Result r;
+        r.name = name;
+        r.iterations = iterations;
+        r.nsPerOp = static_cast<double>(state.elapsed().count()) / iterations;
+        r.opsPerSec = r.nsPerOp > 0 ? 1e9 / r.nsPerOp : 0;
+        r.bytesPerSec = r.opsPerSec * state.bytesPerOp();
+        r.allocsPerOp =
+          static_cast<double>(state.allocs(AllocTracker::ALLOCS)) / iterations;
+        r.allocBytesPerOp =
+          static_cast<double>(state.allocs(AllocTracker::ALLOC_BYTES)) /
+          iterations;
+        return r;
+      }
+
+      std::vector<std::pair<std::string, Fn>> benches_;
+  };
+
+  inline void printText(FILE *out, const std::vector<Result> &results) {
+    fprintf(out, "%-36s %12s %12s %14s %12s %10s\n", "benchmark",
+        "iterations", "ns/op", "ops/sec", "MB/sec", "allocs/op");
+    for (auto &r : results) {
+      char mb[32] = "-";
+      if (r.bytesPerSec > 0) {
+        snprintf(mb, sizeof(mb), "%.1f", r.bytesPerSec / 1e6);
+      }
+      fprintf(out, "%-36s %12llu %12.1f %14.0f %12s %10.2f\n", r.name.c_str(),
+          static_cast<unsigned long long>(r.iterations), r.nsPerOp,
+          r.opsPerSec, mb, r.allocsPerOp);
+    }
+  }
+
+  // one object per run, to diff runs of different versions
+  inline void printJson(FILE *out, const std::vector<Result> &results) {
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+    char date[32];
+    auto now = time(nullptr);
+    struct tm tm;
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&now, &tm));
+    fprintf(out, "{\n  \"context\": {\"date\": \"%s\", \"host\": \"%s\", "
+        "\"compiler\": \"%s\", \"allocs_tracked\": %s},\n  \"benchmarks\": [",
+        date, host, __VERSION__, AllocTracker::installed() ? "true" : "false");
+    for (std::size_t i = 0; i < results.size(); ++i) {
+      auto &r = results[i];
+      fprintf(out, "%s\n    {\"name\": \"%s\", \"iterations\": %llu, "
+          "\"ns_per_op\": %.3f, \"ops_per_sec\": %.1f, \"bytes_per_sec\": %.1f, "
+          "\"allocs_per_op\": %.3f, \"alloc_bytes_per_op\": %.1f}",
+          i ? "," : "", r.name.c_str(),
+          static_cast<unsigned long long>(r.iterations), r.nsPerOp,
+          r.opsPerSec, r.bytesPerSec, r.allocsPerOp, r.allocBytesPerOp);
+    }
+    fprintf(out, "\n  ]\n}\n");
+  }
+} /* end of namespace: bench */
+} /* end of namespace: nul */
+
+#define BENCH_COMBINE_(a, b) a ## b
+#define BENCH_NAME_(prefix, name) BENCH_COMBINE_(prefix, name)
+
+// defines and registers a benchmark, the body sees 'state'
+#define BENCH(name) \
+  static void BENCH_NAME_(bench_, name)(nul::bench::State &state); \
+  static const bool BENCH_NAME_(registered_, name) = \
+    nul::bench::Registry::instance().add(#name, BENCH_NAME_(bench_, name)); \
+  static void BENCH_NAME_(bench_, name)(nul::bench::State &state)
+
+#endif /* end of include guard: NUL_BENCH_H_ */
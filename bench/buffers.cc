@@ -0,0 +1,86 @@
+#include "bench.hpp"
+#include "corpus.hpp"
+#include "util/buffer_pool.hpp"
+#include "util/circular_buffer.hpp"
+#include "util/shm_ring_buffer.hpp"
+#include "util/xbuffer.hpp"
+#include <thread>
+
+using namespace nul;
+
+BENCH(buffer_pool_request_return) {
+  BufferPool pool(2048, 64);
+  while (state.next()) {
+    auto b = pool.requestBuffer(1500);
+    bench::doNotOptimize(b.get());
+    pool.returnBuffer(std::move(b));
+  }
+}
+
+BENCH(buffer_pool_assemble) {
+  BufferPool pool(2048, 64);
+  std::string payload(512, 'x');
+  state.setBytesPerOp(payload.size());
+  while (state.next()) {
+    auto b = pool.assembleDataBuffer(payload.data(), payload.size());
+    pool.returnBuffer(std::move(b));
+  }
+}
+
+// one op is one frame, fed in 1400-byte chunks like TCP segments
+BENCH(xbuffer_offer_take) {
+  auto &stream = bench::Corpus::frames();
+  XBuffer<2> xbuf;
+  state.setBytesPerOp(stream.size() / bench::Corpus::FRAME_COUNT);
+  std::size_t pos = 0;
+  while (state.next()) {
+    while (xbuf.empty()) {
+      auto n = std::min<std::size_t>(1400, stream.size() - pos);
+      xbuf.offer(stream.data() + pos, n);
+      pos = (pos + n) % stream.size();
+    }
+    bench::doNotOptimize(xbuf.take());
+  }
+}
+
+BENCH(circular_buffer_put_take) {
+  CircularBuffer<int, 1024> q;
+  int v = 0;
+  while (state.next()) {
+    q.put(v++);
+    bench::doNotOptimize(q.take());
+  }
+}
+
+// one op is one element through a producer and a consumer thread
+BENCH(circular_buffer_spsc) {
+  CircularBuffer<int, 1024> q;
+  // the iteration count is not known up front, the producer runs until
+  // interrupted and the consumer counts
+  std::thread producer([&q]() {
+    int v = 0;
+    while (q.put(++v)) { }
+  });
+  while (state.next()) {
+    bench::doNotOptimize(q.take());
+  }
+  q.interrupt();
+  producer.join();
+}
+
+BENCH(shm_ring_buffer_put_take) {
+  auto name = "/nul_bench_" + std::to_string(getpid());
+  auto ring = ShmRingBuffer::create(name, 1 << 20);
+  if (!ring) {
+    return;
+  }
+  std::string payload(256, 'x');
+  state.setBytesPerOp(payload.size());
+  while (state.next()) {
+    ring->put(payload.data(), payload.size());
+    ring->takeWith([](const char *data, std::size_t len) {
+      bench::doNotOptimize(data[len - 1]);
+    });
+  }
+  ShmRingBuffer::unlink(name);
+}
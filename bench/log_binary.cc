@@ -0,0 +1,26 @@
+// in a translation unit of its own, LOG_BINARY changes the LOG_* macros
+#define LOG_BINARY
+#define LOG_BINARY_FILE_PATH "/dev/null"
+// wait for the writer rather than time the drop path once a ring fills up
+#define LOG_BINARY_BLOCK
+#include "bench.hpp"
+#include "util/log.hpp"
+#include <cstdlib>
+
+using namespace nul;
+
+BENCH(log_binary) {
+  auto &logger = BinaryLogger::instance();
+  auto dropped = logger.dropped();
+  int i = 0;
+  while (state.next()) {
+    LOG_I("request %s status=%d n=%d", "/api/v1/resources/12345", 200, i++);
+  }
+  logger.flush();
+  // a dropped record costs a fraction of a written one, the numbers would lie
+  if (logger.dropped() != dropped) {
+    fprintf(stderr, "log_binary: %llu of %d records dropped\n",
+        static_cast<unsigned long long>(logger.dropped() - dropped), i);
+    exit(1);
+  }
+}
@@ -0,0 +1,55 @@
+// the file sink, so the formatting and the buffered write are measured
+#define LOG_TO_FILE
+#define LOG_FILE_PATH "/dev/null"
+#include "bench.hpp"
+#include "util/log.hpp"
+#include "util/log_kv.hpp"
+
+using namespace nul;
+
+static const char *PATH = "/api/v1/resources/12345";
+
+BENCH(log_strtime) {
+  char buf[TIME_BUFFER_SIZE];
+  while (state.next()) {
+    bench::doNotOptimize(log_strtime(buf));
+  }
+}
+
+BENCH(log_filtered_at_runtime) {
+  LogLevels::setLevel(LOG_LEVEL_ERROR);
+  int i = 0;
+  while (state.next()) {
+    LOG_I("request %s status=%d n=%d", PATH, 200, i++);
+  }
+  LogLevels::setLevel(LOG_DEFAULT_LEVEL);
+}
+
+BENCH(log_info_to_file) {
+  int i = 0;
+  while (state.next()) {
+    LOG_I("request %s status=%d n=%d", PATH, 200, i++);
+  }
+}
+
+BENCH(log_info_every_1000) {
+  int i = 0;
+  while (state.next()) {
+    LOG_I_EVERY_N(1000, "request %s status=%d n=%d", PATH, 200, i++);
+  }
+}
+
+BENCH(log_info_rate_limited) {
+  int i = 0;
+  while (state.next()) {
+    LOG_I_RATE_LIMITED(1000, "request %s status=%d n=%d", PATH, 200, i++);
+  }
+}
+
+BENCH(log_kv_to_file) {
+  int i = 0;
+  while (state.next()) {
+    LOG_KV_I("request", kv("path", PATH), kv("status", 200), kv("n", i++),
+        kv("ratio", 0.25));
+  }
+}
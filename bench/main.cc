@@ -0,0 +1,48 @@
+// the allocation counters behind allocs/op
+#define NUL_ALLOC_TRACKER_IMPLEMENTATION
+#include "bench.hpp"
+#include <string>
+
+using namespace nul;
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+      "usage: %s [--filter=SUBSTR] [--min-time-ms=N] [--json[=FILE]]\n", prog);
+}
+
+int main(int argc, char **argv) {
+  std::string filter;
+  long minTimeMs = 200;
+  bool json = false;
+  const char *jsonPath = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg.compare(0, 9, "--filter=") == 0) {
+      filter = arg.substr(9);
+    } else if (arg.compare(0, 14, "--min-time-ms=") == 0) {
+      minTimeMs = atol(arg.c_str() + 14);
+    } else if (arg == "--json") {
+      json = true;
+    } else if (arg.compare(0, 7, "--json=") == 0) {
+      json = true;
+      jsonPath = argv[i] + 7;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  auto results = bench::Registry::instance().run(
+      filter, std::chrono::milliseconds(minTimeMs));
+  if (!json) {
+    bench::printText(stdout, results);
+    return 0;
+  }
+  auto out = jsonPath ? fopen(jsonPath, "w") : stdout;
+  if (!out) {
+    perror(jsonPath);
+    return 1;
+  }
+  bench::printJson(out, results);
+  return out == stdout || fclose(out) == 0 ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+#include "bench.hpp"
+#include "util/histogram.hpp"
+#include "util/log_flight_recorder.hpp"
+#include "util/metrics.hpp"
+#include "util/perf_counters.hpp"
+#include "util/profiler.hpp"
+#include "util/thread_pool.hpp"
+#include "util/trace.hpp"
+#include "util/tsc_clock.hpp"
+
+using namespace nul;
+
+BENCH(steady_clock_now) {
+  while (state.next()) {
+    bench::doNotOptimize(std::chrono::steady_clock::now());
+  }
+}
+
+BENCH(tsc_clock_now) {
+  TscClock::now();
+  while (state.next()) {
+    bench::doNotOptimize(TscClock::now());
+  }
+}
+
+BENCH(histogram_record) {
+  Histogram h;
+  uint64_t v = 0;
+  while (state.next()) {
+    h.record(v += 977);
+  }
+}
+
+BENCH(sharded_histogram_record) {
+  ShardedHistogram<> h;
+  uint64_t v = 0;
+  while (state.next()) {
+    h.record(v += 977);
+  }
+}
+
+BENCH(metrics_counter_inc) {
+  metrics::Registry r;
+  auto c = r.counter("bench_total", "");
+  while (state.next()) {
+    c->inc();
+  }
+}
+
+BENCH(metrics_histogram_observe) {
+  metrics::Registry r;
+  auto h = r.histogram("bench_seconds", "",
+      { .0001, .0005, .001, .005, .01, .05, .1, .5, 1 });
+  double v = 0;
+  while (state.next()) {
+    h->observe(v += 0.0001);
+    if (v > 2) {
+      v = 0;
+    }
+  }
+}
+
+BENCH(profile_aggregate_scope) {
+  auto &site = ProfileRegistry::instance().site<std::chrono::nanoseconds>(
+      "profiling.cc", "bench", __LINE__, "bench");
+  while (state.next()) {
+    AggregatingProfiler<TscClock> p(site);
+  }
+}
+
+BENCH(trace_scope_disabled) {
+  while (state.next()) {
+    TraceScope scope("bench", "bench");
+  }
+}
+
+BENCH(trace_scope_enabled) {
+  Tracer::instance().start();
+  int i = 0;
+  while (state.next()) {
+    TraceScope scope("bench", "bench", kv("i", i++));
+  }
+  Tracer::instance().stop();
+  Tracer::instance().clear();
+}
+
+BENCH(perf_counters_read) {
+  PerfCounters::Sample sample;
+  while (state.next()) {
+    PerfCounters::read(sample);
+    bench::doNotOptimize(sample);
+  }
+}
+
+BENCH(flight_recorder_record) {
+  static const FlightRecorder::Site site = {
+    LOG_LEVEL_VERBOSE, __LINE__, "bench", "profiling.cc", "bench", "n=%d s=%s"
+  };
+  int i = 0;
+  while (state.next()) {
+    FlightRecorder::record(&site, i++, "value");
+  }
+}
+
+// one op is one task submitted and waited for
+BENCH(thread_pool_submit_get) {
+  ThreadPool pool(2);
+  int i = 0;
+  while (state.next()) {
+    bench::doNotOptimize(pool.submit([&i]() { return ++i; }).get());
+  }
+}
+
+// one op is one index of a parallel_for over 4096 indices
+BENCH(thread_pool_parallel_for) {
+  ThreadPool pool;
+  std::vector<uint64_t> v(4096);
+  uint64_t n = 0;
+  while (state.next()) {
+    if (n++ % v.size() == 0) {
+      pool.parallel_for(0, v.size(), [&v](std::size_t i) { v[i] += i; });
+    }
+  }
+  bench::doNotOptimize(v[0]);
+}
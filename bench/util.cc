@@ -0,0 +1,193 @@
+#include "bench.hpp"
+#include "corpus.hpp"
+#include "util/util.hpp"
+#include "util/uri.hpp"
+#include "util/scan.hpp"
+
+using namespace nul;
+
+// one op is one input of the corpus, all corpora have 64 entries
+static const std::size_t MASK = 63;
+
+BENCH(uri_parse) {
+  auto &uris = bench::Corpus::uris();
+  state.setBytesPerOp(bench::Corpus::totalSize(uris) / uris.size());
+  std::size_t i = 0;
+  while (state.next()) {
+    URI uri;
+    bench::doNotOptimize(uri.parse(uris[i++ & MASK]));
+  }
+}
+
+BENCH(uri_parse_and_get) {
+  auto &uris = bench::Corpus::uris();
+  state.setBytesPerOp(bench::Corpus::totalSize(uris) / uris.size());
+  std::size_t i = 0;
+  while (state.next()) {
+    URI uri;
+    uri.parse(uris[i++ & MASK]);
+    bench::doNotOptimize(uri.getHost());
+    bench::doNotOptimize(uri.getPath());
+    bench::doNotOptimize(uri.getQueryStr());
+  }
+}
+
+BENCH(uri_view_parse) {
+  auto &uris = bench::Corpus::uris();
+  state.setBytesPerOp(bench::Corpus::totalSize(uris) / uris.size());
+  std::size_t i = 0;
+  while (state.next()) {
+    UriView uri;
+    bench::doNotOptimize(uri.parse(uris[i++ & MASK]));
+  }
+}
+
+BENCH(uri_view_parse_and_get) {
+  auto &uris = bench::Corpus::uris();
+  state.setBytesPerOp(bench::Corpus::totalSize(uris) / uris.size());
+  std::size_t i = 0;
+  while (state.next()) {
+    UriView uri;
+    uri.parse(uris[i++ & MASK]);
+    bench::doNotOptimize(uri.getHost());
+    bench::doNotOptimize(uri.getPath());
+    bench::doNotOptimize(uri.getQueryStr());
+  }
+}
+
+// a long query string without delimiters, the worst case of URI::parse
+static const std::string &longQuery() {
+  static const std::string s = std::string(4096, 'q') + "#";
+  return s;
+}
+
+BENCH(scan_scalar) {
+  static constexpr ByteSet set{":/?#"};
+  auto &s = longQuery();
+  state.setBytesPerOp(s.size());
+  while (state.next()) {
+    bench::doNotOptimize(Scan::findFirstOf(Scan::Impl::SCALAR, s, set, 0));
+  }
+}
+
+BENCH(scan_best) {
+  static constexpr ByteSet set{":/?#"};
+  auto &s = longQuery();
+  state.setBytesPerOp(s.size());
+  while (state.next()) {
+    bench::doNotOptimize(Scan::findFirstOf(s, set));
+  }
+}
+
+static const std::string QUERY =
+  "q=hello+world&lang=en-US&page=12&sort=date%3Adesc&filter=a%26b&"
+  "session=8f14e45fceea167a5a36dedd4bea2543&utm_source=newsletter";
+
+BENCH(query_split_and_decode) {
+  state.setBytesPerOp(QUERY.size());
+  char buf[256];
+  while (state.next()) {
+    for (const auto &param : QueryString{QUERY}) {
+      std::string_view value;
+      QueryString::decode(param.value, buf, sizeof(buf), value);
+      bench::doNotOptimize(value);
+    }
+  }
+}
+
+BENCH(query_map_lookup) {
+  state.setBytesPerOp(QUERY.size());
+  char buf[256];
+  while (state.next()) {
+    QueryMap<> params;
+    params.parse(QUERY, buf, sizeof(buf));
+    bench::doNotOptimize(params.get("page"));
+    bench::doNotOptimize(params.get("session"));
+  }
+}
+
+BENCH(string_split) {
+  auto &lines = bench::Corpus::lines();
+  state.setBytesPerOp(bench::Corpus::totalSize(lines) / lines.size());
+  std::size_t i = 0;
+  while (state.next()) {
+    bench::doNotOptimize(StringUtil::split(lines[i++ & MASK], "; "));
+  }
+}
+
+BENCH(string_split_visitor) {
+  auto &lines = bench::Corpus::lines();
+  state.setBytesPerOp(bench::Corpus::totalSize(lines) / lines.size());
+  std::size_t i = 0;
+  while (state.next()) {
+    std::size_t n = 0;
+    StringUtil::split(lines[i++ & MASK], "; ", [&n](auto, const auto &part) {
+      n += part.size();
+      return true;
+    });
+    bench::doNotOptimize(n);
+  }
+}
+
+BENCH(string_trim) {
+  std::vector<std::string> padded;
+  for (auto &l : bench::Corpus::lines()) {
+    padded.push_back("  \t" + l + " \r\n");
+  }
+  state.setBytesPerOp(bench::Corpus::totalSize(padded) / padded.size());
+  std::size_t i = 0;
+  while (state.next()) {
+    bench::doNotOptimize(StringUtil::trim(padded[i++ & MASK]));
+  }
+}
+
+BENCH(net_is_ipv4) {
+  auto &ips = bench::Corpus::ipv4s();
+  std::size_t i = 0;
+  while (state.next()) {
+    bench::doNotOptimize(NetUtil::isIPv4(ips[i++ & MASK]));
+  }
+}
+
+BENCH(net_is_ipv6) {
+  auto &ips = bench::Corpus::ipv6s();
+  std::size_t i = 0;
+  while (state.next()) {
+    bench::doNotOptimize(NetUtil::isIPv6(ips[i++ & MASK]));
+  }
+}
+
+BENCH(net_ipv4_to_binary) {
+  auto &ips = bench::Corpus::ipv4s();
+  uint8_t bin[4];
+  std::size_t i = 0;
+  while (state.next()) {
+    bench::doNotOptimize(NetUtil::ipv4ToBinary(ips[i++ & MASK], bin));
+  }
+}
+
+BENCH(net_ipv6_to_binary) {
+  auto &ips = bench::Corpus::ipv6s();
+  uint8_t bin[16];
+  std::size_t i = 0;
+  while (state.next()) {
+    bench::doNotOptimize(NetUtil::ipv6ToBinary(ips[i++ & MASK], bin));
+  }
+}
+
+BENCH(net_expand_ipv6) {
+  auto &ips = bench::Corpus::ipv6s();
+  std::size_t i = 0;
+  while (state.next()) {
+    bench::doNotOptimize(NetUtil::expandIPv6(ips[i++ & MASK]));
+  }
+}
+
+BENCH(net_ipv4_in_subnet) {
+  auto &ips = bench::Corpus::ipv4s();
+  std::size_t i = 0;
+  while (state.next()) {
+    bench::doNotOptimize(
+        NetUtil::ipv4IsInSubnet(ips[i++ & MASK], "10.0.0.0/8"));
+  }
+}
@@ -0,0 +1,350 @@
+#ifndef NUL_ALLOC_TRACKER_H_
+#define NUL_ALLOC_TRACKER_H_
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <malloc.h>
+
+namespace nul {
+
+  /**
+   * counts the heap allocations of each thread: allocations, frees and
+   * their bytes (malloc_usable_size(), so freed bytes match allocated ones).
+   *
+   * the counting replacements of operator new/delete are defined in the
+   * one translation unit that defines NUL_ALLOC_TRACKER_IMPLEMENTATION
+   * before including this header, with NUL_ALLOC_TRACKER_MALLOC malloc,
+   * calloc, realloc, free and the aligned variants are replaced as well
+   * (glibc only). counting is a few thread-local adds per call.
+   *
+   * it is also a counters policy of Profiler, see PROFILE_ALLOCS, and
+   * AllocScope checks that a path does not allocate.
+   */
+  class AllocTracker final {
+    public:
+      static constexpr int MAX_EVENTS = 4;
+
+      enum {
+        ALLOCS,
+        FREES,
+        ALLOC_BYTES,
+        FREED_BYTES,
+      };
+
+      struct Sample {
+        uint32_t valid{0}; // all or nothing, see installed()
+        uint64_t values[MAX_EVENTS];
+      };
+
+      static void read(Sample &sample) {
+        auto c = counters();
+        for (int i = 0; i < MAX_EVENTS; ++i) {
+          sample.values[i] = c[i];
+        }
+        sample.valid = installed() ? (1u << MAX_EVENTS) - 1 : 0;
+      }
+
+      static const char *name(int i) {
+        static const char *names[MAX_EVENTS] = {
+          "allocs", "frees", "alloc_bytes", "freed_bytes"
+        };
+        return names[i];
+      }
+
+      // whether the replacements are linked in, nothing is counted otherwise
+      static bool installed() {
+        return installedFlag().load(std::memory_order_relaxed);
+      }
+
+      static void onAlloc(void *p) {
+        if (p) {
+          auto c = counters();
+          ++c[ALLOCS];
+          c[ALLOC_BYTES] += malloc_usable_size(p);
+        }
+      }
+
+      // before 'p' is freed
+      static void onFree(void *p) {
+        if (p) {
+          onFreed(malloc_usable_size(p));
+        }
+      }
+
+      static void onFreed(std::size_t usableSize) {
+        auto c = counters();
+        ++c[FREES];
+        c[FREED_BYTES] += usableSize;
+      }
+
+      static std::atomic<bool> &installedFlag() {
+        static std::atomic<bool> flag{false};
+        return flag;
+      }
+
+    private:
+      // plain zero-initialized TLS, so no guard runs inside operator new
+      static uint64_t *counters() {
+        static thread_local uint64_t c[MAX_EVENTS];
+        return c;
+      }
+  };
+
+  /**
+   * the allocations of the calling thread since construction, e.g.
+   *
+   *   AllocScope allocs;
+   *   parser.parse(input);
+   *   ASSERT_EQ(0u, allocs.allocs());
+   */
+  class AllocScope final {
+    public:
+      AllocScope() {
+        AllocTracker::read(begin_);
+      }
+
+      uint64_t allocs() const {
+        return delta(AllocTracker::ALLOCS);
+      }
+
+      uint64_t frees() const {
+        return delta(AllocTracker::FREES);
+      }
+
+      uint64_t allocBytes() const {
+        return delta(AllocTracker::ALLOC_BYTES);
+      }
+
+      uint64_t freedBytes() const {
+        return delta(AllocTracker::FREED_BYTES);
+      }
+
+    private:
+      uint64_t delta(int i) const {
+        AllocTracker::Sample now;
+        AllocTracker::read(now);
+        return now.values[i] - begin_.values[i];
+      }
+
+      AllocTracker::Sample begin_;
+  };
+} /* end of namespace: nul */
+
+#ifdef NUL_ALLOC_TRACKER_IMPLEMENTATION
+
+namespace nul {
+namespace detail {
+  static const bool allocTrackerInstalled = []() {
+    AllocTracker::installedFlag().store(true, std::memory_order_relaxed);
+    return true;
+  }();
+
+  // operator new on top of the counted malloc is counted there
+  inline void *trackedAlloc(std::size_t size) {
+    auto p = malloc(size ? size : 1);
+#ifndef NUL_ALLOC_TRACKER_MALLOC
+    AllocTracker::onAlloc(p);
+#endif
+    return p;
+  }
+
+  inline void *trackedAlignedAlloc(std::size_t size, std::size_t align) {
+    void *p = nullptr;
+    if (posix_memalign(&p, align < sizeof(void *) ? sizeof(void *) : align,
+          size ? size : 1) != 0) {
+      return nullptr;
+    }
+#ifndef NUL_ALLOC_TRACKER_MALLOC
+    AllocTracker::onAlloc(p);
+#endif
+    return p;
+  }
+
+  inline void trackedFree(void *p) {
+#ifndef NUL_ALLOC_TRACKER_MALLOC
+    AllocTracker::onFree(p);
+#endif
+    free(p);
+  }
+
+  inline void *newOrThrow(std::size_t size) {
+    while (true) {
+      auto p = trackedAlloc(size);
+      if (p) {
+        return p;
+      }
+      auto handler = std::get_new_handler();
+      if (!handler) {
+        throw std::bad_alloc();
+      }
+      handler();
+    }
+  }
+
+  inline void *alignedNewOrThrow(std::size_t size, std::size_t align) {
+    while (true) {
+      auto p = trackedAlignedAlloc(size, align);
+      if (p) {
+        return p;
+      }
+      auto handler = std::get_new_handler();
+      if (!handler) {
+        throw std::bad_alloc();
+      }
+      handler();
+    }
+  }
+} /* end of namespace: detail */
+} /* end of namespace: nul */
+
+void *operator new(std::size_t size) {
+  return nul::detail::newOrThrow(size);
+}
+
+void *operator new[](std::size_t size) {
+  return nul::detail::newOrThrow(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  return nul::detail::trackedAlloc(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return nul::detail::trackedAlloc(size);
+}
+
+void *operator new(std::size_t size, std::align_val_t align) {
+  return nul::detail::alignedNewOrThrow(size, static_cast<std::size_t>(align));
+}
+
+void *operator new[](std::size_t size, std::align_val_t align) {
+  return nul::detail::alignedNewOrThrow(size, static_cast<std::size_t>(align));
+}
+
+void *operator new(std::size_t size, std::align_val_t align,
+    const std::nothrow_t &) noexcept {
+  return nul::detail::trackedAlignedAlloc(size, static_cast<std::size_t>(align));
+}
+
+void *operator new[](std::size_t size, std::align_val_t align,
+    const std::nothrow_t &) noexcept {
+  return nul::detail::trackedAlignedAlloc(size, static_cast<std::size_t>(align));
+}
+
+void operator delete(void *p) noexcept {
+  nul::detail::trackedFree(p);
+}
+
+void operator delete[](void *p) noexcept {
+  nul::detail::trackedFree(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+  nul::detail::trackedFree(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept {
+  nul::detail::trackedFree(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+  nul::detail::trackedFree(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+  nul::detail::trackedFree(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept {
+  nul::detail::trackedFree(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept {
+  nul::detail::trackedFree(p);
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+  nul::detail::trackedFree(p);
+}
+
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept {
+  nul::detail::trackedFree(p);
+}
+
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept {
+  nul::detail::trackedFree(p);
+}
+
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept {
+  nul::detail::trackedFree(p);
+}
+
+#ifdef NUL_ALLOC_TRACKER_MALLOC
+extern "C" {
+  void *__libc_malloc(std::size_t) noexcept;
+  void *__libc_calloc(std::size_t, std::size_t) noexcept;
+  void *__libc_realloc(void *, std::size_t) noexcept;
+  void *__libc_memalign(std::size_t, std::size_t) noexcept;
+  void __libc_free(void *) noexcept;
+
+  void *malloc(std::size_t size) noexcept {
+    auto p = __libc_malloc(size);
+    nul::AllocTracker::onAlloc(p);
+    return p;
+  }
+
+  void *calloc(std::size_t n, std::size_t size) noexcept {
+    auto p = __libc_calloc(n, size);
+    nul::AllocTracker::onAlloc(p);
+    return p;
+  }
+
+  // counted as a free and an allocation
+  void *realloc(void *old, std::size_t size) noexcept {
+    auto oldSize = old ? malloc_usable_size(old) : 0;
+    auto p = __libc_realloc(old, size);
+    if (!p && size) {
+      // 'old' is still allocated
+      return nullptr;
+    }
+    if (old) {
+      nul::AllocTracker::onFreed(oldSize);
+    }
+    nul::AllocTracker::onAlloc(p);
+    return p;
+  }
+
+  void *memalign(std::size_t align, std::size_t size) noexcept {
+    auto p = __libc_memalign(align, size);
+    nul::AllocTracker::onAlloc(p);
+    return p;
+  }
+
+  void *aligned_alloc(std::size_t align, std::size_t size) noexcept {
+    return memalign(align, size);
+  }
+
+  int posix_memalign(void **out, std::size_t align, std::size_t size) noexcept {
+    if (align % sizeof(void *) != 0 || (align & (align - 1)) != 0) {
+      return EINVAL;
+    }
+    auto p = memalign(align, size);
+    if (!p) {
+      return ENOMEM;
+    }
+    *out = p;
+    return 0;
+  }
+
+  void free(void *p) noexcept {
+    nul::AllocTracker::onFree(p);
+    __libc_free(p);
+  }
+}
+#endif
+
+#endif /* NUL_ALLOC_TRACKER_IMPLEMENTATION */
+
+#endif /* end of include guard: NUL_ALLOC_TRACKER_H_ */
@@ -1,6 +1,7 @@
 #ifndef NUL_BUFFER_POOL_H_
 #define NUL_BUFFER_POOL_H_
 #include "buffer.hpp"
+#include <atomic>
 #include <deque>
 #include <memory>
 #include <algorithm>
@@ -9,16 +10,30 @@
 namespace nul {
   class BufferPool {
     public:
+      struct Stats {
+        uint64_t requests{0};
+        // no free buffer was large enough, one was allocated
+        uint64_t misses{0};
+        // returned buffers that were too large or found the pool full
+        uint64_t dropped{0};
+        uint64_t freeBuffers{0};
+        uint64_t freeBytes{0};
+      };
+
       BufferPool(std::size_t maxBufferSize, std::size_t maxBufferCount) :
         maxBufferSize_(maxBufferSize), maxBufferCount_(maxBufferCount) {
         assert(maxBufferCount > 0);
         for (std::size_t i = 0; i < maxBufferCount; ++i) {
           freeBuffers_.push_back(std::make_unique<Buffer>(maxBufferSize));
         }
+        freeCount_.store(maxBufferCount, std::memory_order_relaxed);
+        freeBytes_.store(
+          maxBufferSize * maxBufferCount, std::memory_order_relaxed);
       }
       virtual ~BufferPool() = default;
 
       std::unique_ptr<Buffer> requestBuffer(std::size_t size) {
+        increment(requests_);
         if (!freeBuffers_.empty()) {
           auto freeBufIt = std::find_if(
             freeBuffers_.begin(), freeBuffers_.end(), [size](auto &buf) {
@@ -27,16 +42,22 @@ namespace nul {
           if (freeBufIt != freeBuffers_.end()) {
             auto freeBuf = std::move(*freeBufIt);
             freeBuffers_.erase(freeBufIt);
+            updateFree(-static_cast<int64_t>(freeBuf->getCapacity()));
             return freeBuf;
           }
         }
+        increment(misses_);
         return std::make_unique<Buffer>(size);
       }
 
       void returnBuffer(std::unique_ptr<Buffer> &&data) {
         if (data->getCapacity() <= maxBufferSize_ &&
             freeBuffers_.size() < maxBufferCount_) {
+          auto capacity = static_cast<int64_t>(data->getCapacity());
           freeBuffers_.push_back(std::move(data));
+          updateFree(capacity);
+        } else {
+          increment(dropped_);
         }
       }
 
@@ -52,17 +73,45 @@ namespace nul {
       }
 
       uint64_t getTotalBufferSize() const {
-        uint64_t size = 0;
-        for (auto &b : freeBuffers_) {
-          size += b->getCapacity();
-        }
-        return size;
+        return freeBytes_.load(std::memory_order_relaxed);
+      }
+
+      /**
+       * the pool is used from one thread at a time, but its stats can be
+       * read from any thread, e.g. by metrics::addBufferPool()
+       */
+      Stats stats() const {
+        Stats s;
+        s.requests = requests_.load(std::memory_order_relaxed);
+        s.misses = misses_.load(std::memory_order_relaxed);
+        s.dropped = dropped_.load(std::memory_order_relaxed);
+        s.freeBuffers = freeCount_.load(std::memory_order_relaxed);
+        s.freeBytes = freeBytes_.load(std::memory_order_relaxed);
+        return s;
       }
 
     private:
+      // a single writer, so no locked read-modify-write
+      static void increment(std::atomic<uint64_t> &counter) {
+        counter.store(counter.load(std::memory_order_relaxed) + 1,
+            std::memory_order_relaxed);
+      }
+
+      // 'bytes' is the capacity of the buffer that entered or left the pool
+      void updateFree(int64_t bytes) {
+        freeCount_.store(freeBuffers_.size(), std::memory_order_relaxed);
+        freeBytes_.store(freeBytes_.load(std::memory_order_relaxed) + bytes,
+            std::memory_order_relaxed);
+      }
+
       std::deque<std::unique_ptr<Buffer>> freeBuffers_;
       std::size_t maxBufferSize_;
       std::size_t maxBufferCount_;
+      std::atomic<uint64_t> requests_{0};
+      std::atomic<uint64_t> misses_{0};
+      std::atomic<uint64_t> dropped_{0};
+      std::atomic<uint64_t> freeCount_{0};
+      std::atomic<uint64_t> freeBytes_{0};
   };
 } /* end of namspace: nul */
 
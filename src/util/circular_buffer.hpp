@@ -4,26 +4,78 @@
 #include <mutex>
 #include <condition_variable>
 #include <chrono>
+#include <cstdint>
+#include "queue_stats.hpp"
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define NUL_HAS_COROUTINES 1
+#endif
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
 
 namespace nul {
-  template <typename T, std::size_t MAX_SIZE>
+  /**
+   * 'Stats' is NoQueueStats by default, pass QueueStats to record
+   * occupancy and blocked/waited time histograms, see queue_stats.hpp
+   */
+  template <typename T, std::size_t MAX_SIZE, typename Stats = NoQueueStats>
   class CircularBuffer final {
     public:
+      CircularBuffer() = default;
+
+      ~CircularBuffer() {
+#ifdef __linux__
+        if (readableFd_ != -1) {
+          close(readableFd_);
+        }
+        if (writableFd_ != -1) {
+          close(writableFd_);
+        }
+#endif
+      }
+
       bool put(T data) {
         auto lock = std::unique_lock<std::mutex>(mutex_);
         if (interrupted_) {
           return false;
         }
         if (size_ == MAX_SIZE) {
+          stats_.onFull();
+          auto begin = now();
           cond_.wait(lock, [&](){ return interrupted_ || size_ < MAX_SIZE; });
+          stats_.onPutBlocked(elapsedNanos(begin));
           if (interrupted_) {
             return false;
           }
         }
-        arr_[head_] = std::move(data);
-        head_ = ++head_ % MAX_SIZE;
-        ++size_;
+        pushBack(std::move(data));
+        auto ready = settleAsyncWaiters();
+        updateEventFds();
+        cond_.notify_one();
+        lock.unlock();
+        resumeAsyncWaiters(ready);
+        return true;
+      }
+
+      // never blocks, 'data' is left untouched if the queue is full or
+      // interrupted
+      bool tryPut(T &&data) {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        if (interrupted_) {
+          return false;
+        }
+        if (size_ == MAX_SIZE) {
+          stats_.onFull();
+          return false;
+        }
+        pushBack(std::move(data));
+        auto ready = settleAsyncWaiters();
+        updateEventFds();
         cond_.notify_one();
+        lock.unlock();
+        resumeAsyncWaiters(ready);
         return true;
       }
 
@@ -33,11 +85,14 @@ namespace nul {
           if (interrupted_) {
             return T{};
           }
+          stats_.onEmpty();
+          auto begin = now();
           if (waitTimeMillis <= 0) {
             cond_.wait(lock);
           } else {
             cond_.wait_for(lock, std::chrono::milliseconds(waitTimeMillis));
           }
+          stats_.onTakeWaited(elapsedNanos(begin));
           if (interrupted_) {
             return T{};
           }
@@ -48,9 +103,17 @@ namespace nul {
 
       T takeOrDefault() {
         auto lock = std::unique_lock<std::mutex>(mutex_);
+        if (size_ == 0) {
+          stats_.onEmpty();
+        }
         return internalTakeOrDefault(lock);
       }
 
+      // lock-free, e.g. stats().snapshot() or stats().occupancy()
+      const Stats &stats() const {
+        return stats_;
+      }
+
       std::size_t size() { 
         auto lock = std::unique_lock<std::mutex>(mutex_);
         return size_;
@@ -78,23 +141,337 @@ namespace nul {
       void interrupt() {
         auto lock = std::unique_lock<std::mutex>(mutex_);
         interrupted_ = true;
+        auto ready = settleAsyncWaiters();
+        updateEventFds();
         cond_.notify_all();
+        lock.unlock();
+        resumeAsyncWaiters(ready);
+      }
+
+#ifdef NUL_HAS_COROUTINES
+      /**
+       * co_await q.asyncTake(executor) suspends the coroutine instead of the
+       * thread until an item is available, the coroutine is then resumed
+       * through executor.execute(fn) (e.g. ThreadPool::execute), or inline
+       * if execute() returns false. it yields T{} if the queue is
+       * interrupted, pending awaiters are completed by interrupt().
+       *
+       * a suspended coroutine must not be destroyed before it is resumed.
+       */
+      template <typename Executor>
+      auto asyncTake(Executor &executor) {
+        struct Awaiter : AsyncWaiter {
+          CircularBuffer &q;
+          Executor &executor;
+          std::coroutine_handle<> handle;
+
+          Awaiter(CircularBuffer &q, Executor &executor) :
+            q(q), executor(executor) {
+            this->resume = &Awaiter::schedule;
+          }
+
+          bool await_ready() const noexcept {
+            return false;
+          }
+
+          bool await_suspend(std::coroutine_handle<> h) {
+            handle = h;
+            return q.suspendTake(this);
+          }
+
+          T await_resume() {
+            return std::move(this->value);
+          }
+
+          static void schedule(AsyncWaiter *w) {
+            auto self = static_cast<Awaiter *>(w);
+            auto h = self->handle;
+            if (!self->executor.execute([h]() { h.resume(); })) {
+              h.resume();
+            }
+          }
+        };
+        return Awaiter{*this, executor};
+      }
+
+      /**
+       * co_await q.asyncPut(data, executor) suspends the coroutine while the
+       * queue is full, yields false if the queue is interrupted, see
+       * asyncTake() for how the coroutine is resumed
+       */
+      template <typename Executor>
+      auto asyncPut(T data, Executor &executor) {
+        struct Awaiter : AsyncWaiter {
+          CircularBuffer &q;
+          Executor &executor;
+          std::coroutine_handle<> handle;
+
+          Awaiter(CircularBuffer &q, T data, Executor &executor) :
+            q(q), executor(executor) {
+            this->value = std::move(data);
+            this->resume = &Awaiter::schedule;
+          }
+
+          bool await_ready() const noexcept {
+            return false;
+          }
+
+          bool await_suspend(std::coroutine_handle<> h) {
+            handle = h;
+            return q.suspendPut(this);
+          }
+
+          bool await_resume() const {
+            return this->ok;
+          }
+
+          static void schedule(AsyncWaiter *w) {
+            auto self = static_cast<Awaiter *>(w);
+            auto h = self->handle;
+            if (!self->executor.execute([h]() { h.resume(); })) {
+              h.resume();
+            }
+          }
+        };
+        return Awaiter{*this, std::move(data), executor};
       }
+#endif
+
+#ifdef __linux__
+      /**
+       * create eventfds so the queue can be registered to an epoll loop,
+       * readableFd() stays readable while the queue is non-empty, and if
+       * 'notifyWritable' is true, writableFd() stays readable while the
+       * queue is non-full, both become readable once interrupted.
+       *
+       * the fds are level-triggered and only touched when the state flips,
+       * so a burst of puts costs one write(2) and draining the queue costs
+       * one read(2). consumers should drain with takeOrDefault() until
+       * empty() before waiting on the fd again.
+       */
+      bool enableEventFd(bool notifyWritable = false) {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        if (readableFd_ == -1) {
+          readableFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+          if (readableFd_ == -1) {
+            return false;
+          }
+        }
+        if (notifyWritable && writableFd_ == -1) {
+          writableFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+          if (writableFd_ == -1) {
+            return false;
+          }
+        }
+        updateEventFds();
+        return true;
+      }
+
+      // -1 if enableEventFd() is not called
+      int readableFd() const {
+        return readableFd_;
+      }
+
+      // -1 if enableEventFd(true) is not called
+      int writableFd() const {
+        return writableFd_;
+      }
+#endif
 
     private:
+      // a suspended asyncTake()/asyncPut(), linked into takeWaiters_ or
+      // putWaiters_, 'value' receives (take) or holds (put) the item
+      struct AsyncWaiter {
+        AsyncWaiter *next{nullptr};
+        void (*resume)(AsyncWaiter *){nullptr};
+        T value{};
+        bool ok{false};
+      };
+
+      struct AsyncWaiterList {
+        AsyncWaiter *head{nullptr};
+        AsyncWaiter *tail{nullptr};
+
+        void push(AsyncWaiter *w) {
+          w->next = nullptr;
+          if (tail) {
+            tail->next = w;
+          } else {
+            head = w;
+          }
+          tail = w;
+        }
+
+        AsyncWaiter *pop() {
+          auto w = head;
+          head = w->next;
+          if (!head) {
+            tail = nullptr;
+          }
+          return w;
+        }
+      };
+
       T internalTakeOrDefault(std::unique_lock<std::mutex> &lock) {
         if (size_ > 0) {
-          T data = std::move(arr_[tail_]);
-          tail_ = ++tail_ % MAX_SIZE;
-          --size_;
+          T data = popFront();
+          auto ready = settleAsyncWaiters();
+          updateEventFds();
 
           lock.unlock();
-          cond_.notify_one();
+          if (ready) {
+            cond_.notify_all();
+          } else {
+            cond_.notify_one();
+          }
+          resumeAsyncWaiters(ready);
           return data;
         }
 
         return T{};
       }
+
+      void pushBack(T &&data) {
+        arr_[head_] = std::move(data);
+        head_ = (head_ + 1) % MAX_SIZE;
+        ++size_;
+        stats_.onPut(size_);
+      }
+
+      T popFront() {
+        T data = std::move(arr_[tail_]);
+        tail_ = (tail_ + 1) % MAX_SIZE;
+        --size_;
+        stats_.onTake(size_);
+        return data;
+      }
+
+      /**
+       * must be called with mutex_ held after every state change, hands
+       * items to (or takes items from) suspended coroutines, returns the
+       * completed waiters which must be resumed after mutex_ is released
+       */
+      AsyncWaiter *settleAsyncWaiters() {
+        AsyncWaiterList ready;
+        while (true) {
+          if (size_ > 0 && takeWaiters_.head) {
+            auto w = takeWaiters_.pop();
+            w->value = popFront();
+            w->ok = true;
+            ready.push(w);
+          } else if (size_ < MAX_SIZE && putWaiters_.head && !interrupted_) {
+            auto w = putWaiters_.pop();
+            pushBack(std::move(w->value));
+            w->ok = true;
+            ready.push(w);
+          } else {
+            break;
+          }
+        }
+
+        if (interrupted_) {
+          while (takeWaiters_.head) {
+            ready.push(takeWaiters_.pop());
+          }
+          while (putWaiters_.head) {
+            ready.push(putWaiters_.pop());
+          }
+        }
+        return ready.head;
+      }
+
+      static void resumeAsyncWaiters(AsyncWaiter *w) {
+        while (w) {
+          // the awaiter is gone once its coroutine is resumed
+          auto next = w->next;
+          w->resume(w);
+          w = next;
+        }
+      }
+
+      // returns false if the coroutine should not be suspended
+      bool suspendTake(AsyncWaiter *w) {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        if (size_ > 0) {
+          w->value = popFront();
+          w->ok = true;
+          auto ready = settleAsyncWaiters();
+          updateEventFds();
+          lock.unlock();
+          cond_.notify_all();
+          resumeAsyncWaiters(ready);
+          return false;
+        }
+        stats_.onEmpty();
+        if (interrupted_) {
+          return false;
+        }
+        takeWaiters_.push(w);
+        return true;
+      }
+
+      bool suspendPut(AsyncWaiter *w) {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        if (interrupted_) {
+          return false;
+        }
+        if (size_ < MAX_SIZE) {
+          pushBack(std::move(w->value));
+          w->ok = true;
+          auto ready = settleAsyncWaiters();
+          updateEventFds();
+          lock.unlock();
+          cond_.notify_one();
+          resumeAsyncWaiters(ready);
+          return false;
+        }
+        stats_.onFull();
+        putWaiters_.push(w);
+        return true;
+      }
+
+      static std::chrono::steady_clock::time_point now() {
+        if constexpr (Stats::ENABLED) {
+          return std::chrono::steady_clock::now();
+        }
+        return {};
+      }
+
+      static uint64_t elapsedNanos(std::chrono::steady_clock::time_point begin) {
+        if constexpr (Stats::ENABLED) {
+          return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - begin).count();
+        }
+        return 0;
+      }
+
+      // must be called with mutex_ held
+      void updateEventFds() {
+#ifdef __linux__
+        if (readableFd_ != -1) {
+          signalEventFd(readableFd_, readableSignaled_, interrupted_ || size_ > 0);
+        }
+        if (writableFd_ != -1) {
+          signalEventFd(
+            writableFd_, writableSignaled_, interrupted_ || size_ < MAX_SIZE);
+        }
+#endif
+      }
+
+#ifdef __linux__
+      static void signalEventFd(int fd, bool &signaled, bool ready) {
+        if (ready == signaled) {
+          return;
+        }
+        eventfd_t value = 1;
+        if (ready) {
+          eventfd_write(fd, value);
+        } else {
+          eventfd_read(fd, &value);
+        }
+        signaled = ready;
+      }
+#endif
     
     private:
       std::array<T, MAX_SIZE> arr_;
@@ -105,6 +482,177 @@ namespace nul {
       std::condition_variable cond_;
       std::mutex mutex_;
 
+      bool interrupted_{false};
+      Stats stats_;
+
+      AsyncWaiterList takeWaiters_;
+      AsyncWaiterList putWaiters_;
+
+      int readableFd_{-1};
+      int writableFd_{-1};
+      bool readableSignaled_{false};
+      bool writableSignaled_{false};
+  };
+
+  /**
+   * a CircularBuffer with LANE_SIZES.size() priority lanes, each lane has
+   * its own capacity, lane 0 has the highest priority. take() always drains
+   * higher lanes first, all lanes share one mutex and one wakeup, so put and
+   * take stay O(1), interrupt() works the same as in CircularBuffer.
+   *
+   * e.g. MultiLaneCircularBuffer<Msg, 16, 1024> for control vs. data traffic
+   */
+  template <typename T, std::size_t... LANE_SIZES>
+  class MultiLaneCircularBuffer final {
+    static_assert(
+      sizeof...(LANE_SIZES) > 0 && sizeof...(LANE_SIZES) <= 32,
+      "lane count must be in [1, 32]");
+    static_assert(((LANE_SIZES > 0) && ...), "lane sizes must be > 0");
+
+    public:
+      static constexpr std::size_t LANE_COUNT = sizeof...(LANE_SIZES);
+
+      // blocks while 'lane' is full, returns false if interrupted
+      bool put(std::size_t lane, T data) {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        if (interrupted_ || lane >= LANE_COUNT) {
+          return false;
+        }
+        auto &l = lanes_[lane];
+        if (l.size == CAPACITIES[lane]) {
+          notFull_[lane].wait(lock, [&](){
+            return interrupted_ || l.size < CAPACITIES[lane];
+          });
+          if (interrupted_) {
+            return false;
+          }
+        }
+        arr_[OFFSETS[lane] + l.head] = std::move(data);
+        l.head = (l.head + 1) % CAPACITIES[lane];
+        ++l.size;
+        ++size_;
+        nonEmptyLanes_ |= (1u << lane);
+        notEmpty_.notify_one();
+        return true;
+      }
+
+      T take(int waitTimeMillis = 0) {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        if (size_ == 0) {
+          if (interrupted_) {
+            return T{};
+          }
+          auto ready = [&](){ return interrupted_ || size_ > 0; };
+          if (waitTimeMillis <= 0) {
+            notEmpty_.wait(lock, ready);
+          } else {
+            notEmpty_.wait_for(
+              lock, std::chrono::milliseconds(waitTimeMillis), ready);
+          }
+        }
+
+        return internalTakeOrDefault(lock);
+      }
+
+      T takeOrDefault() {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        return internalTakeOrDefault(lock);
+      }
+
+      std::size_t size() {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        return size_;
+      }
+
+      std::size_t size(std::size_t lane) {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        return lane < LANE_COUNT ? lanes_[lane].size : 0;
+      }
+
+      bool empty() {
+        return size() == 0;
+      }
+
+      static constexpr std::size_t capacity() {
+        return TOTAL_CAPACITY;
+      }
+
+      static constexpr std::size_t capacity(std::size_t lane) {
+        return lane < LANE_COUNT ? CAPACITIES[lane] : 0;
+      }
+
+      bool interrupted() {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        return interrupted_;
+      }
+
+      bool interruptedAndEmpty() {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        return interrupted_ && size_ == 0;
+      }
+
+      // once interrupted, no lane will accept put
+      void interrupt() {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        interrupted_ = true;
+        notEmpty_.notify_all();
+        for (auto &c : notFull_) {
+          c.notify_all();
+        }
+      }
+
+    private:
+      struct Lane {
+        std::size_t head{0};
+        std::size_t tail{0};
+        std::size_t size{0};
+      };
+
+      static constexpr std::size_t CAPACITIES[LANE_COUNT] = { LANE_SIZES... };
+      static constexpr std::size_t TOTAL_CAPACITY = (LANE_SIZES + ...);
+
+      static constexpr std::array<std::size_t, LANE_COUNT> laneOffsets() {
+        std::array<std::size_t, LANE_COUNT> offsets{};
+        std::size_t offset = 0;
+        for (std::size_t i = 0; i < LANE_COUNT; ++i) {
+          offsets[i] = offset;
+          offset += CAPACITIES[i];
+        }
+        return offsets;
+      }
+      static constexpr std::array<std::size_t, LANE_COUNT> OFFSETS =
+        laneOffsets();
+
+      T internalTakeOrDefault(std::unique_lock<std::mutex> &lock) {
+        if (size_ > 0) {
+          auto lane = static_cast<std::size_t>(__builtin_ctz(nonEmptyLanes_));
+          auto &l = lanes_[lane];
+          T data = std::move(arr_[OFFSETS[lane] + l.tail]);
+          l.tail = (l.tail + 1) % CAPACITIES[lane];
+          --size_;
+          if (--l.size == 0) {
+            nonEmptyLanes_ &= ~(1u << lane);
+          }
+
+          lock.unlock();
+          notFull_[lane].notify_one();
+          return data;
+        }
+
+        return T{};
+      }
+
+    private:
+      std::array<T, TOTAL_CAPACITY> arr_;
+      std::array<Lane, LANE_COUNT> lanes_;
+      std::size_t size_{0};
+      // bit i is set if lane i is non-empty
+      uint32_t nonEmptyLanes_{0};
+
+      std::condition_variable notEmpty_;
+      std::array<std::condition_variable, LANE_COUNT> notFull_;
+      std::mutex mutex_;
+
       bool interrupted_{false};
   };
 } /* end of namespace: nul */
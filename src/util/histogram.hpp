@@ -0,0 +1,199 @@
+#ifndef NUL_HISTOGRAM_H_
+#define NUL_HISTOGRAM_H_
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+
+namespace nul {
+
+  /**
+   * HDR-style log-linear histogram of uint64_t values, every power of 2 is
+   * split into 2^SUB_BUCKET_BITS linear sub-buckets, so the relative error
+   * of a reported percentile is below 1 / 2^SUB_BUCKET_BITS (6.25%) for the
+   * whole uint64_t range.
+   *
+   * record() is lock-free (a few relaxed atomic ops), safe to call from
+   * any thread, snapshot() can be taken concurrently with writers.
+   */
+  class Histogram final {
+    public:
+      static constexpr unsigned SUB_BUCKET_BITS = 4;
+      static constexpr std::size_t SUB_BUCKET_COUNT = 1u << SUB_BUCKET_BITS;
+      static constexpr std::size_t BUCKET_COUNT =
+        (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+      struct Snapshot {
+        uint64_t count{0};
+        uint64_t sum{0};
+        uint64_t min{0};
+        uint64_t max{0};
+        std::array<uint64_t, BUCKET_COUNT> buckets{};
+
+        double mean() const {
+          return count ? static_cast<double>(sum) / count : 0.0;
+        }
+
+        // p in [0, 100], e.g. 99.9
+        uint64_t percentile(double p) const {
+          if (count == 0) {
+            return 0;
+          }
+          auto rank = static_cast<uint64_t>(p / 100.0 * count + 0.5);
+          if (rank < 1) {
+            rank = 1;
+          } else if (rank > count) {
+            rank = count;
+          }
+
+          uint64_t seen = 0;
+          for (std::size_t i = 0; i < BUCKET_COUNT; ++i) {
+            seen += buckets[i];
+            if (seen >= rank) {
+              auto v = bucketUpperBound(i);
+              return v < min ? min : (v > max ? max : v);
+            }
+          }
+          return max;
+        }
+
+        void merge(const Snapshot &other) {
+          if (other.count == 0) {
+            return;
+          }
+          min = count ? (other.min < min ? other.min : min) : other.min;
+          max = other.max > max ? other.max : max;
+          count += other.count;
+          sum += other.sum;
+          for (std::size_t i = 0; i < BUCKET_COUNT; ++i) {
+            buckets[i] += other.buckets[i];
+          }
+        }
+      };
+
+      Histogram() {
+        reset();
+      }
+
+      void record(uint64_t value) {
+        buckets_[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+
+        auto curMin = min_.load(std::memory_order_relaxed);
+        while (value < curMin && !min_.compare_exchange_weak(
+            curMin, value, std::memory_order_relaxed)) { }
+        auto curMax = max_.load(std::memory_order_relaxed);
+        while (value > curMax && !max_.compare_exchange_weak(
+            curMax, value, std::memory_order_relaxed)) { }
+      }
+
+      uint64_t count() const {
+        return count_.load(std::memory_order_relaxed);
+      }
+
+      Snapshot snapshot() const {
+        Snapshot s;
+        for (std::size_t i = 0; i < BUCKET_COUNT; ++i) {
+          s.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+          s.count += s.buckets[i];
+        }
+        s.sum = sum_.load(std::memory_order_relaxed);
+        s.min = s.count ? min_.load(std::memory_order_relaxed) : 0;
+        s.max = max_.load(std::memory_order_relaxed);
+        return s;
+      }
+
+      // not atomic with respect to concurrent record()
+      void reset() {
+        for (auto &b : buckets_) {
+          b.store(0, std::memory_order_relaxed);
+        }
+        count_.store(0, std::memory_order_relaxed);
+        sum_.store(0, std::memory_order_relaxed);
+        min_.store(
+          std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+      }
+
+      static std::size_t bucketIndex(uint64_t value) {
+        if (value < SUB_BUCKET_COUNT) {
+          return static_cast<std::size_t>(value);
+        }
+        unsigned msb = 63 - __builtin_clzll(value);
+        unsigned exponent = msb - SUB_BUCKET_BITS + 1;
+        auto mantissa = value >> (exponent - 1);   // [SUB, 2 * SUB)
+        return exponent * SUB_BUCKET_COUNT + (mantissa - SUB_BUCKET_COUNT);
+      }
+
+      // the largest value that falls into bucket 'index'
+      static uint64_t bucketUpperBound(std::size_t index) {
+        if (index < SUB_BUCKET_COUNT) {
+          return index;
+        }
+        auto exponent = index / SUB_BUCKET_COUNT;
+        uint64_t mantissa = SUB_BUCKET_COUNT + index % SUB_BUCKET_COUNT;
+        auto lower = mantissa << (exponent - 1);
+        return lower + ((uint64_t{1} << (exponent - 1)) - 1);
+      }
+
+    private:
+      std::array<std::atomic<uint64_t>, BUCKET_COUNT> buckets_;
+      std::atomic<uint64_t> count_;
+      std::atomic<uint64_t> sum_;
+      std::atomic<uint64_t> min_;
+      std::atomic<uint64_t> max_;
+  };
+
+  /**
+   * SHARDS Histograms, each thread records into its own shard (threads are
+   * spread round-robin), so hot paths recorded from many threads do not
+   * bounce the same cache lines, snapshot() merges the shards
+   */
+  template <std::size_t SHARDS = 8>
+  class ShardedHistogram final {
+    public:
+      void record(uint64_t value) {
+        shards_[shardIndex()].histogram.record(value);
+      }
+
+      uint64_t count() const {
+        uint64_t n = 0;
+        for (auto &s : shards_) {
+          n += s.histogram.count();
+        }
+        return n;
+      }
+
+      Histogram::Snapshot snapshot() const {
+        Histogram::Snapshot merged;
+        for (auto &s : shards_) {
+          merged.merge(s.histogram.snapshot());
+        }
+        return merged;
+      }
+
+      // not atomic with respect to concurrent record()
+      void reset() {
+        for (auto &s : shards_) {
+          s.histogram.reset();
+        }
+      }
+
+    private:
+      struct alignas(64) Shard {
+        Histogram histogram;
+      };
+
+      static std::size_t shardIndex() {
+        static std::atomic<std::size_t> nextThread{0};
+        thread_local std::size_t index =
+          nextThread.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+        return index;
+      }
+
+      std::array<Shard, SHARDS> shards_;
+  };
+} /* end of namespace: nul */
+
+#endif /* end of include guard: NUL_HISTOGRAM_H_ */
@@ -7,19 +7,6 @@
 #include <sys/time.h>
 #include <inttypes.h>
 
-#ifdef __cplusplus
-extern "C" {
-#endif
-
-#if !defined(__FILENAME__)
-#define __FILENAME__\
-  (strrchr(__FILE__, '/') ?\
-   strrchr(__FILE__, '/') + 1 : __FILE__)
-#endif
-
-#define MAX_FMT_SIZE 0xFF
-#define TIME_BUFFER_SIZE 24
-
 #ifdef __ANDROID__
 #include <android/log.h>
 #define LOG_LEVEL_VERBOSE ANDROID_LOG_VERBOSE 
@@ -35,14 +22,74 @@ extern "C" {
 #define LOG_LEVEL_ERROR 6
 #endif
 
+// initial runtime level, see nul::LogLevels
+#ifndef LOG_DEFAULT_LEVEL
+#define LOG_DEFAULT_LEVEL LOG_LEVEL_VERBOSE
+#endif
+
+#ifdef __cplusplus
+#include "log_level.hpp"
+#include "log_rate_limit.hpp"
+#endif
+#if defined(LOG_TO_FILE) && defined(LOG_FILE_PATH) && defined(__cplusplus)
+#include "log_file_sink.hpp"
+#endif
+#if defined(LOG_ASYNC) && defined(__cplusplus)
+#include "log_async.hpp"
+#endif
+#if defined(LOG_BINARY) && defined(__cplusplus)
+#include "log_binary.hpp"
+#endif
+#if defined(LOG_FLIGHT_RECORDER) && defined(__cplusplus)
+#include "log_flight_recorder.hpp"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if !defined(__FILENAME__)
+#define __FILENAME__\
+  (strrchr(__FILE__, '/') ?\
+   strrchr(__FILE__, '/') + 1 : __FILE__)
+#endif
+
+#define MAX_FMT_SIZE 0xFF
+#define TIME_BUFFER_SIZE 24
+
+/**
+ * "%Y-%m-%d %H:%M:%S.mmm", the part before the milliseconds only changes
+ * once per second, so it is cached per thread and only rebuilt (with the
+ * reentrant localtime_r) when the second changes.
+ *
+ * define LOG_CLOCK_COARSE to read CLOCK_REALTIME_COARSE, which costs a few
+ * nanoseconds but only advances once per scheduler tick (1-4ms)
+ */
 inline char *log_strtime(char *buffer) {
-  struct timeval now;
-  gettimeofday(&now, NULL);
+  struct timespec now;
+#if defined(LOG_CLOCK_COARSE) && defined(CLOCK_REALTIME_COARSE)
+  clock_gettime(CLOCK_REALTIME_COARSE, &now);
+#else
+  clock_gettime(CLOCK_REALTIME, &now);
+#endif
+
+  static __thread time_t cachedSec = -1;
+  static __thread size_t cachedLen = 0;
+  static __thread char cachedPrefix[TIME_BUFFER_SIZE];
+  if (now.tv_sec != cachedSec) {
+    struct tm tm;
+    localtime_r(&now.tv_sec, &tm);
+    cachedLen = strftime(cachedPrefix, TIME_BUFFER_SIZE, "%Y-%m-%d %H:%M:%S.",
+        &tm);
+    cachedSec = now.tv_sec;
+  }
 
-  size_t len = strftime(buffer, TIME_BUFFER_SIZE, "%Y-%m-%d %H:%M:%S.",
-      localtime(&now.tv_sec));
-  int milli = now.tv_usec / 1000;
-  sprintf(buffer + len, "%03d", milli);
+  int milli = now.tv_nsec / 1000000;
+  memcpy(buffer, cachedPrefix, cachedLen);
+  buffer[cachedLen] = '0' + milli / 100;
+  buffer[cachedLen + 1] = '0' + milli / 10 % 10;
+  buffer[cachedLen + 2] = '0' + milli % 10;
+  buffer[cachedLen + 3] = '\0';
 
   return buffer;
 }
@@ -58,26 +105,15 @@ inline static const char *log_prio_str_(int prio) {
   return "";
 }
 
-// log to file
-#if defined(LOG_TO_FILE) && defined(LOG_FILE_PATH)
-#define DO_LOG_(prio, color, fmt, ...) do { \
-  FILE *f = fopen(LOG_FILE_PATH, "a+"); \
-  char _LogTimeBuf_[TIME_BUFFER_SIZE];  \
-  fprintf(f, "%s %s [%s] [%s:%d] %s - " fmt "\n", \
-      log_strtime(_LogTimeBuf_), LOG_TAG_NAME, log_prio_str_(prio), \
-      __FILENAME__, __LINE__, __FUNCTION__, ##__VA_ARGS__); \
-  fclose(f); \
-} while (0)
-
-// log to Android logcat
-#elif __ANDROID__
-#define DO_LOG_(prio, color, fmt, ...) do { \
-  __android_log_print(prio, LOG_TAG_NAME, "[%s:%d] %s - " fmt "\n", \
-      __FILENAME__, __LINE__, __FUNCTION__, ##__VA_ARGS__); \
-} while (0)
-
-#else
-#ifndef NO_TERM_COLOR
+#if defined(LOG_TO_FILE) && !defined(NO_TERM_COLOR)
+#define NO_TERM_COLOR
+#define KNRM
+#define KBLU
+#define KRED
+#define KGRN
+#define KYEL
+#define KEND
+#elif !defined(NO_TERM_COLOR)
 #define NO_TERM_COLOR
 #define KNRM  "\x1B[0m"
 #define KBLU  "\x1b[34m"
@@ -94,17 +130,157 @@ inline static const char *log_prio_str_(int prio) {
 #define KEND
 #endif
 
+// log raw arguments to LOG_BINARY_FILE_PATH, formatted offline by the decoder
+#if defined(LOG_BINARY) && defined(__cplusplus)
+#define DO_LOG_OUTPUT_(prio, color, func, fmt, ...) do { \
+  if (false) nul::BinaryLogger::checkFormat(fmt, ##__VA_ARGS__); \
+  static const uint32_t _LogSiteId_ = nul::BinaryLogger::instance().registerSite( \
+      prio, LOG_TAG_NAME, __FILENAME__, __LINE__, func, fmt); \
+  nul::BinaryLogger::instance().log(_LogSiteId_, ##__VA_ARGS__); \
+} while (0)
+
+// log asynchronously, to LOG_FILE_PATH if LOG_TO_FILE is defined, or stderr
+#elif defined(LOG_ASYNC) && defined(__cplusplus)
+#define DO_LOG_OUTPUT_(prio, color, func, fmt, ...) do { \
+  char _LogTimeBuf_[TIME_BUFFER_SIZE];  \
+  nul::AsyncLogger::instance().printf( \
+      color "%s %s [%s] [%s:%d] %s - " fmt KEND "\n", \
+      log_strtime(_LogTimeBuf_), LOG_TAG_NAME, log_prio_str_(prio), __FILENAME__, \
+      __LINE__, func, ##__VA_ARGS__); \
+} while (0)
+
+// log to file, through a buffered sink that keeps the file open
+#elif defined(LOG_TO_FILE) && defined(LOG_FILE_PATH) && defined(__cplusplus)
+#define DO_LOG_OUTPUT_(prio, color, func, fmt, ...) do { \
+  char _LogTimeBuf_[TIME_BUFFER_SIZE];  \
+  nul::LogFileSink::instance().printf("%s %s [%s] [%s:%d] %s - " fmt "\n", \
+      log_strtime(_LogTimeBuf_), LOG_TAG_NAME, log_prio_str_(prio), \
+      __FILENAME__, __LINE__, func, ##__VA_ARGS__); \
+} while (0)
+
+// log to file from C
+#elif defined(LOG_TO_FILE) && defined(LOG_FILE_PATH)
+#define DO_LOG_OUTPUT_(prio, color, func, fmt, ...) do { \
+  FILE *f = fopen(LOG_FILE_PATH, "a+"); \
+  char _LogTimeBuf_[TIME_BUFFER_SIZE];  \
+  fprintf(f ? f : stderr, "%s %s [%s] [%s:%d] %s - " fmt "\n", \
+      log_strtime(_LogTimeBuf_), LOG_TAG_NAME, log_prio_str_(prio), \
+      __FILENAME__, __LINE__, func, ##__VA_ARGS__); \
+  if (f) fclose(f); \
+} while (0)
+
+// log to Android logcat
+#elif __ANDROID__
+#define DO_LOG_OUTPUT_(prio, color, func, fmt, ...) do { \
+  __android_log_print(prio, LOG_TAG_NAME, "[%s:%d] %s - " fmt "\n", \
+      __FILENAME__, __LINE__, func, ##__VA_ARGS__); \
+} while (0)
+
+#else
 // log to stderr
-#define DO_LOG_(prio, color, fmt, ...) do { \
+#define DO_LOG_OUTPUT_(prio, color, func, fmt, ...) do { \
   char _LogTimeBuf_[TIME_BUFFER_SIZE];  \
   fprintf(stderr, color "%s %s [%s] [%s:%d] %s - " fmt KEND "\n", \
       log_strtime(_LogTimeBuf_), LOG_TAG_NAME, log_prio_str_(prio), __FILENAME__, \
-      __LINE__, __FUNCTION__, ##__VA_ARGS__); \
+      __LINE__, func, ##__VA_ARGS__); \
+} while (0)
+#endif
+
+/**
+ * records below the runtime level (nul::LogLevels) are skipped before their
+ * arguments are evaluated, C code only has the compile-time levels.
+ *
+ * with LOG_FLIGHT_RECORDER, every record also goes to nul::FlightRecorder,
+ * whatever the runtime level, the arguments are evaluated once, as the
+ * parameters of a lambda
+ */
+#if defined(LOG_FLIGHT_RECORDER) && defined(__cplusplus)
+#define DO_LOG_(prio, color, fmt, ...) do { \
+  static const nul::FlightRecorder::Site _LogRecorderSite_ = { \
+      prio, __LINE__, LOG_TAG_NAME, __FILENAME__, __FUNCTION__, fmt}; \
+  const char *_LogFunction_ = __FUNCTION__; \
+  [&](auto... _LogArgs_) { \
+    nul::FlightRecorder::record(&_LogRecorderSite_, _LogArgs_...); \
+    if (__builtin_expect( \
+          nul::LogLevels::enabled(prio, LOG_TAG_NAME, __FILENAME__), 0)) { \
+      DO_LOG_OUTPUT_(prio, color, _LogFunction_, fmt, _LogArgs_...); \
+    } \
+  }(__VA_ARGS__); \
 } while (0)
+#elif defined(__cplusplus)
+#define DO_LOG_(prio, color, fmt, ...) do { \
+  if (__builtin_expect( \
+        nul::LogLevels::enabled(prio, LOG_TAG_NAME, __FILENAME__), 0)) { \
+    DO_LOG_OUTPUT_(prio, color, __FUNCTION__, fmt, ##__VA_ARGS__); \
+  } \
+} while (0)
+#endif
+
+#ifdef __cplusplus
+
+/**
+ * LOG_*_EVERY_N(n, ...), LOG_*_EVERY_MS(ms, ...) and
+ * LOG_*_RATE_LIMITED(perSecond, ...), with one static nul::LogEveryN,
+ * nul::LogEveryMs or nul::LogRateLimiter per call site, the first record
+ * let through after others were dropped ends with "(suppressed N messages)".
+ * with LOG_FLIGHT_RECORDER every call is recorded, limited or not
+ */
+#if defined(LOG_FLIGHT_RECORDER)
+// recorded before the limiter, as DO_LOG_ records whatever the level
+#define DO_LOG_LIMITED_(prio, color, limiter, limit, fmt, ...) do { \
+  static const nul::FlightRecorder::Site _LogRecorderSite_ = { \
+      prio, __LINE__, LOG_TAG_NAME, __FILENAME__, __FUNCTION__, fmt}; \
+  const char *_LogFunction_ = __FUNCTION__; \
+  [&](auto... _LogArgs_) { \
+    nul::FlightRecorder::record(&_LogRecorderSite_, _LogArgs_...); \
+    if (__builtin_expect( \
+          nul::LogLevels::enabled(prio, LOG_TAG_NAME, __FILENAME__), 0)) { \
+      static limiter _LogLimiter_; \
+      uint64_t _LogSuppressed_ = 0; \
+      if (_LogLimiter_.allow(limit, _LogSuppressed_)) { \
+        if (_LogSuppressed_ == 0) { \
+          DO_LOG_OUTPUT_(prio, color, _LogFunction_, fmt, _LogArgs_...); \
+        } else { \
+          DO_LOG_OUTPUT_(prio, color, _LogFunction_, fmt " (suppressed %" PRIu64 " messages)", \
+              _LogArgs_..., _LogSuppressed_); \
+        } \
+      } \
+    } \
+  }(__VA_ARGS__); \
+} while (0)
+#else
+#define DO_LOG_LIMITED_(prio, color, limiter, limit, fmt, ...) do { \
+  if (__builtin_expect( \
+        nul::LogLevels::enabled(prio, LOG_TAG_NAME, __FILENAME__), 0)) { \
+    static limiter _LogLimiter_; \
+    uint64_t _LogSuppressed_ = 0; \
+    if (_LogLimiter_.allow(limit, _LogSuppressed_)) { \
+      if (_LogSuppressed_ == 0) { \
+        DO_LOG_OUTPUT_(prio, color, __FUNCTION__, fmt, ##__VA_ARGS__); \
+      } else { \
+        DO_LOG_OUTPUT_(prio, color, __FUNCTION__, fmt " (suppressed %" PRIu64 " messages)", \
+            ##__VA_ARGS__, _LogSuppressed_); \
+      } \
+    } \
+  } \
+} while (0)
+#endif
+#else
+#define DO_LOG_(prio, color, fmt, ...) \
+  DO_LOG_OUTPUT_(prio, color, __FUNCTION__, fmt, ##__VA_ARGS__)
+// no per-site state in C, every record is written
+#define DO_LOG_LIMITED_(prio, color, limiter, limit, fmt, ...) \
+  DO_LOG_(prio, color, fmt, ##__VA_ARGS__)
 #endif
 
 #if defined(LOG_VERBOSE)
 #define LOG_V(fmt, ...) DO_LOG_(LOG_LEVEL_VERBOSE, KNRM, fmt, ##__VA_ARGS__)
+#define LOG_V_EVERY_N(n, fmt, ...) \
+  DO_LOG_LIMITED_(LOG_LEVEL_VERBOSE, KNRM, nul::LogEveryN, n, fmt, ##__VA_ARGS__)
+#define LOG_V_EVERY_MS(ms, fmt, ...) \
+  DO_LOG_LIMITED_(LOG_LEVEL_VERBOSE, KNRM, nul::LogEveryMs, ms, fmt, ##__VA_ARGS__)
+#define LOG_V_RATE_LIMITED(perSecond, fmt, ...) \
+  DO_LOG_LIMITED_(LOG_LEVEL_VERBOSE, KNRM, nul::LogRateLimiter, perSecond, fmt, ##__VA_ARGS__)
 #define LOG_DEBUG
 #define LOG_INFO
 #define LOG_WARN
@@ -113,10 +289,19 @@ inline static const char *log_prio_str_(int prio) {
 #define LOG_LEVEL LOG_LEVEL_VERBOSE 
 #else
 #define LOG_V(fmt, ...)
+#define LOG_V_EVERY_N(n, fmt, ...)
+#define LOG_V_EVERY_MS(ms, fmt, ...)
+#define LOG_V_RATE_LIMITED(perSecond, fmt, ...)
 #endif
 
 #if defined(LOG_DEBUG)
 #define LOG_D(fmt, ...) DO_LOG_(LOG_LEVEL_DEBUG, KGRN, fmt, ##__VA_ARGS__)
+#define LOG_D_EVERY_N(n, fmt, ...) \
+  DO_LOG_LIMITED_(LOG_LEVEL_DEBUG, KGRN, nul::LogEveryN, n, fmt, ##__VA_ARGS__)
+#define LOG_D_EVERY_MS(ms, fmt, ...) \
+  DO_LOG_LIMITED_(LOG_LEVEL_DEBUG, KGRN, nul::LogEveryMs, ms, fmt, ##__VA_ARGS__)
+#define LOG_D_RATE_LIMITED(perSecond, fmt, ...) \
+  DO_LOG_LIMITED_(LOG_LEVEL_DEBUG, KGRN, nul::LogRateLimiter, perSecond, fmt, ##__VA_ARGS__)
 #define LOG_INFO
 #define LOG_WARN
 #define LOG_ERROR
@@ -125,10 +310,19 @@ inline static const char *log_prio_str_(int prio) {
 #define LOG_LEVEL LOG_LEVEL_VERBOSE 
 #else
 #define LOG_D(fmt, ...)
+#define LOG_D_EVERY_N(n, fmt, ...)
+#define LOG_D_EVERY_MS(ms, fmt, ...)
+#define LOG_D_RATE_LIMITED(perSecond, fmt, ...)
 #endif
 
 #if defined(LOG_INFO)
 #define LOG_I(fmt, ...) DO_LOG_(LOG_LEVEL_INFO, KBLU, fmt, ##__VA_ARGS__)
+#define LOG_I_EVERY_N(n, fmt, ...) \
+  DO_LOG_LIMITED_(LOG_LEVEL_INFO, KBLU, nul::LogEveryN, n, fmt, ##__VA_ARGS__)
+#define LOG_I_EVERY_MS(ms, fmt, ...) \
+  DO_LOG_LIMITED_(LOG_LEVEL_INFO, KBLU, nul::LogEveryMs, ms, fmt, ##__VA_ARGS__)
+#define LOG_I_RATE_LIMITED(perSecond, fmt, ...) \
+  DO_LOG_LIMITED_(LOG_LEVEL_INFO, KBLU, nul::LogRateLimiter, perSecond, fmt, ##__VA_ARGS__)
 #define LOG_WARN
 #define LOG_ERROR
 
@@ -136,25 +330,46 @@ inline static const char *log_prio_str_(int prio) {
 #define LOG_LEVEL LOG_LEVEL_INFO
 #else
 #define LOG_I(fmt, ...)
+#define LOG_I_EVERY_N(n, fmt, ...)
+#define LOG_I_EVERY_MS(ms, fmt, ...)
+#define LOG_I_RATE_LIMITED(perSecond, fmt, ...)
 #endif
 
 #if defined(LOG_WARN)
 #define LOG_W(fmt, ...) DO_LOG_(LOG_LEVEL_WARN, KYEL, fmt, ##__VA_ARGS__)
+#define LOG_W_EVERY_N(n, fmt, ...) \
+  DO_LOG_LIMITED_(LOG_LEVEL_WARN, KYEL, nul::LogEveryN, n, fmt, ##__VA_ARGS__)
+#define LOG_W_EVERY_MS(ms, fmt, ...) \
+  DO_LOG_LIMITED_(LOG_LEVEL_WARN, KYEL, nul::LogEveryMs, ms, fmt, ##__VA_ARGS__)
+#define LOG_W_RATE_LIMITED(perSecond, fmt, ...) \
+  DO_LOG_LIMITED_(LOG_LEVEL_WARN, KYEL, nul::LogRateLimiter, perSecond, fmt, ##__VA_ARGS__)
 #define LOG_ERROR
 
 #undef LOG_LEVEL
 #define LOG_LEVEL LOG_LEVEL_WARN
 #else
 #define LOG_W(fmt, ...)
+#define LOG_W_EVERY_N(n, fmt, ...)
+#define LOG_W_EVERY_MS(ms, fmt, ...)
+#define LOG_W_RATE_LIMITED(perSecond, fmt, ...)
 #endif
 
 #if defined(LOG_ERROR)
 #define LOG_E(fmt, ...) DO_LOG_(LOG_LEVEL_ERROR, KRED, fmt, ##__VA_ARGS__)
+#define LOG_E_EVERY_N(n, fmt, ...) \
+  DO_LOG_LIMITED_(LOG_LEVEL_ERROR, KRED, nul::LogEveryN, n, fmt, ##__VA_ARGS__)
+#define LOG_E_EVERY_MS(ms, fmt, ...) \
+  DO_LOG_LIMITED_(LOG_LEVEL_ERROR, KRED, nul::LogEveryMs, ms, fmt, ##__VA_ARGS__)
+#define LOG_E_RATE_LIMITED(perSecond, fmt, ...) \
+  DO_LOG_LIMITED_(LOG_LEVEL_ERROR, KRED, nul::LogRateLimiter, perSecond, fmt, ##__VA_ARGS__)
 
 #undef LOG_LEVEL
 #define LOG_LEVEL LOG_LEVEL_ERROR
 #else
 #define LOG_E(fmt, ...)
+#define LOG_E_EVERY_N(n, fmt, ...)
+#define LOG_E_EVERY_MS(ms, fmt, ...)
+#define LOG_E_RATE_LIMITED(perSecond, fmt, ...)
 #endif
 
 #ifndef LOG_LEVEL
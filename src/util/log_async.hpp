@@ -0,0 +1,375 @@
+#ifndef NUL_LOG_ASYNC_H_
+#define NUL_LOG_ASYNC_H_
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cinttypes>
+#include <cerrno>
+#include <csignal>
+#include <memory>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(LOG_TO_FILE) && defined(LOG_FILE_PATH)
+#include "log_file_sink.hpp"
+#endif
+
+// number of records the queue can hold, must be a power of 2
+#ifndef LOG_ASYNC_QUEUE_SIZE
+#define LOG_ASYNC_QUEUE_SIZE 4096
+#endif
+
+// longer records are truncated
+#ifndef LOG_ASYNC_RECORD_SIZE
+#define LOG_ASYNC_RECORD_SIZE 512
+#endif
+
+// the writer thread issues one write(2) per batch of up to this many bytes
+#ifndef LOG_ASYNC_BATCH_SIZE
+#define LOG_ASYNC_BATCH_SIZE (64 * 1024)
+#endif
+
+namespace nul {
+
+  /**
+   * backend of the LOG_* macros when LOG_ASYNC is defined: the calling
+   * thread formats the record into a thread-local buffer and pushes it to a
+   * bounded lock-free queue (LOG_ASYNC_QUEUE_SIZE * LOG_ASYNC_RECORD_SIZE
+   * bytes, allocated once), a writer thread batches records into large
+   * write(2) calls to stderr, or to LogFileSink::instance() if LOG_TO_FILE
+   * is defined.
+   *
+   * when the queue is full, records are dropped and counted, a
+   * "dropped N log records" line is written once the writer catches up,
+   * define LOG_ASYNC_BLOCK to make producers wait instead.
+   *
+   * pending records are flushed at exit, installSignalHandlers() also
+   * drains the queue when the process dies of a fatal signal.
+   */
+  class AsyncLogger final {
+    static_assert(
+      (LOG_ASYNC_QUEUE_SIZE & (LOG_ASYNC_QUEUE_SIZE - 1)) == 0,
+      "LOG_ASYNC_QUEUE_SIZE must be a power of 2");
+
+    public:
+      static AsyncLogger &instance() {
+        // leaked on purpose, so records logged from static destructors
+        // after shutdown() are still written, synchronously
+        static AsyncLogger *logger = []() {
+          auto l = new AsyncLogger();
+          atexit([]() { instance().shutdown(); });
+          return l;
+        }();
+        return *logger;
+      }
+
+      void printf(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+        thread_local char buf[LOG_ASYNC_RECORD_SIZE];
+        va_list args;
+        va_start(args, fmt);
+        auto n = vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+        if (n < 0) {
+          return;
+        }
+        if (static_cast<std::size_t>(n) >= sizeof(buf)) {
+          // truncated, keep the line break
+          n = sizeof(buf) - 1;
+          buf[n - 1] = '\n';
+        }
+        write(buf, n);
+      }
+
+      void write(const char *data, std::size_t len) {
+        if (len > LOG_ASYNC_RECORD_SIZE) {
+          len = LOG_ASYNC_RECORD_SIZE;
+        }
+        if (!running_.load(std::memory_order_acquire)) {
+          output(data, len);
+          flushOutput();
+          return;
+        }
+
+        while (!enqueue(data, len)) {
+#ifdef LOG_ASYNC_BLOCK
+          wakeWriter();
+          std::this_thread::yield();
+#else
+          dropped_.fetch_add(1, std::memory_order_relaxed);
+          return;
+#endif
+        }
+        // pairs with the writer setting writerSleeping_ before its last peek
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (writerSleeping_.load(std::memory_order_relaxed)) {
+          wakeWriter();
+        }
+      }
+
+      // blocks until every record enqueued before the call is written
+      void flush() {
+        auto target = enqueuePos_.load(std::memory_order_acquire);
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        flushRequested_.store(true, std::memory_order_relaxed);
+        if (target > flushTarget_) {
+          flushTarget_ = target;
+        }
+        cond_.notify_all();
+        flushedCond_.wait(lock, [&]() {
+          return !running_.load() ||
+            writtenPos_.load(std::memory_order_acquire) >= target;
+        });
+      }
+
+      // flushes and stops the writer thread, later records are written
+      // synchronously
+      void shutdown() {
+        {
+          auto lock = std::unique_lock<std::mutex>(mutex_);
+          if (!running_.load()) {
+            return;
+          }
+          stopping_ = true;
+          cond_.notify_all();
+        }
+        writer_.join();
+        running_.store(false, std::memory_order_release);
+        flushedCond_.notify_all();
+      }
+
+      uint64_t dropped() const {
+        return dropped_.load(std::memory_order_relaxed);
+      }
+
+      // output goes to stderr unless LOG_TO_FILE and LOG_FILE_PATH are set
+      int fd() const {
+#if defined(LOG_TO_FILE) && defined(LOG_FILE_PATH)
+        return LogFileSink::instance().fd();
+#else
+        return STDERR_FILENO;
+#endif
+      }
+
+      /**
+       * on SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT and SIGTERM, write
+       * whatever is queued with async-signal-safe calls only, then re-raise
+       * the signal with the default action
+       */
+      void installSignalHandlers() {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = &AsyncLogger::onFatalSignal;
+        sa.sa_flags = SA_RESETHAND;
+        sigemptyset(&sa.sa_mask);
+        for (auto sig : { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT, SIGTERM }) {
+          sigaction(sig, &sa, nullptr);
+        }
+      }
+
+    private:
+      struct Slot {
+        std::atomic<std::size_t> seq;
+        uint32_t len;
+        char data[LOG_ASYNC_RECORD_SIZE];
+      };
+
+      static constexpr std::size_t MASK = LOG_ASYNC_QUEUE_SIZE - 1;
+
+      AsyncLogger() : slots_(new Slot[LOG_ASYNC_QUEUE_SIZE]) {
+        for (std::size_t i = 0; i < LOG_ASYNC_QUEUE_SIZE; ++i) {
+          slots_[i].seq.store(i, std::memory_order_relaxed);
+        }
+        running_.store(true, std::memory_order_release);
+        writer_ = std::thread([this]() { writerLoop(); });
+      }
+
+      // bounded MPMC queue, ref: Dmitry Vyukov's bounded MPMC queue
+      bool enqueue(const char *data, std::size_t len) {
+        auto pos = enqueuePos_.load(std::memory_order_relaxed);
+        Slot *slot;
+        while (true) {
+          slot = &slots_[pos & MASK];
+          auto seq = slot->seq.load(std::memory_order_acquire);
+          auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+          if (diff == 0) {
+            if (enqueuePos_.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) {
+              break;
+            }
+          } else if (diff < 0) {
+            return false;
+          } else {
+            pos = enqueuePos_.load(std::memory_order_relaxed);
+          }
+        }
+        memcpy(slot->data, data, len);
+        slot->len = static_cast<uint32_t>(len);
+        slot->seq.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+
+      // consumer side, the caller must own consuming_
+      const Slot *peek() {
+        auto pos = dequeuePos_.load(std::memory_order_relaxed);
+        auto slot = &slots_[pos & MASK];
+        if (slot->seq.load(std::memory_order_acquire) != pos + 1) {
+          return nullptr;
+        }
+        return slot;
+      }
+
+      void release(const Slot *slot) {
+        auto pos = dequeuePos_.load(std::memory_order_relaxed);
+        const_cast<Slot *>(slot)->seq.store(
+          pos + LOG_ASYNC_QUEUE_SIZE, std::memory_order_release);
+        dequeuePos_.store(pos + 1, std::memory_order_relaxed);
+      }
+
+      void writerLoop() {
+        auto batch = std::unique_ptr<char[]>(new char[LOG_ASYNC_BATCH_SIZE]);
+        uint64_t reportedDropped = 0;
+
+        while (true) {
+          std::size_t len = 0;
+          if (!consuming_.exchange(true, std::memory_order_acquire)) {
+            const Slot *slot;
+            while ((slot = peek()) &&
+                   len + slot->len <= LOG_ASYNC_BATCH_SIZE) {
+              memcpy(batch.get() + len, slot->data, slot->len);
+              len += slot->len;
+              release(slot);
+            }
+            consuming_.store(false, std::memory_order_release);
+          }
+
+          if (len > 0) {
+            output(batch.get(), len);
+            writtenPos_.store(
+              dequeuePos_.load(std::memory_order_relaxed),
+              std::memory_order_release);
+            // producers that never let the queue drain must not starve
+            // a flush()
+            if (flushRequested_.load(std::memory_order_relaxed)) {
+              auto lock = std::unique_lock<std::mutex>(mutex_);
+              if (flushRequested_.load(std::memory_order_relaxed) &&
+                  writtenPos_.load(std::memory_order_relaxed) >= flushTarget_) {
+                flushOutput();
+                flushRequested_.store(false, std::memory_order_relaxed);
+                flushedCond_.notify_all();
+              }
+            }
+            continue;
+          }
+
+          auto dropped = dropped_.load(std::memory_order_relaxed);
+          if (dropped != reportedDropped) {
+            char msg[64];
+            auto n = snprintf(msg, sizeof(msg), "dropped %" PRIu64 " log records\n",
+                dropped - reportedDropped);
+            output(msg, n);
+            reportedDropped = dropped;
+          }
+          // the queue is drained, push buffered records to the file
+          flushOutput();
+
+          auto lock = std::unique_lock<std::mutex>(mutex_);
+          if (flushRequested_.load(std::memory_order_relaxed)) {
+            if (writtenPos_.load(std::memory_order_relaxed) < flushTarget_) {
+              // a producer has claimed a slot but not published it yet,
+              // keep the request and peek again instead of sleeping
+              lock.unlock();
+              std::this_thread::yield();
+              continue;
+            }
+            flushRequested_.store(false, std::memory_order_relaxed);
+            flushedCond_.notify_all();
+          }
+          if (stopping_) {
+            break;
+          }
+          writerSleeping_.store(true, std::memory_order_relaxed);
+          std::atomic_thread_fence(std::memory_order_seq_cst);
+          if (!peek()) {
+            cond_.wait_for(lock, std::chrono::milliseconds(100));
+          }
+          writerSleeping_.store(false, std::memory_order_relaxed);
+        }
+      }
+
+      void wakeWriter() {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        cond_.notify_one();
+      }
+
+      static void output(const char *data, std::size_t len) {
+#if defined(LOG_TO_FILE) && defined(LOG_FILE_PATH)
+        LogFileSink::instance().write(data, len);
+#else
+        writeFully(STDERR_FILENO, data, len);
+#endif
+      }
+
+      static void flushOutput() {
+#if defined(LOG_TO_FILE) && defined(LOG_FILE_PATH)
+        LogFileSink::instance().flush();
+#endif
+      }
+
+      static void writeFully(int fd, const char *data, std::size_t len) {
+        while (len > 0) {
+          auto n = ::write(fd, data, len);
+          if (n < 0) {
+            if (errno == EINTR) {
+              continue;
+            }
+            return;
+          }
+          data += n;
+          len -= n;
+        }
+      }
+
+      static void onFatalSignal(int sig) {
+        auto &logger = instance();
+        // the writer may be the interrupted thread, so do not wait forever
+        for (int i = 0; i < 1000; ++i) {
+          if (!logger.consuming_.exchange(true, std::memory_order_acquire)) {
+            const Slot *slot;
+            while ((slot = logger.peek())) {
+              writeFully(logger.fd(), slot->data, slot->len);
+              logger.release(slot);
+            }
+            break;
+          }
+        }
+        raise(sig);
+      }
+
+    private:
+      std::unique_ptr<Slot[]> slots_;
+      alignas(64) std::atomic<std::size_t> enqueuePos_{0};
+      alignas(64) std::atomic<std::size_t> dequeuePos_{0};
+      std::atomic<std::size_t> writtenPos_{0};
+      std::atomic<bool> consuming_{false};
+      std::atomic<uint64_t> dropped_{0};
+
+      std::atomic<bool> running_{false};
+      std::atomic<bool> writerSleeping_{false};
+      bool stopping_{false};
+      // written under mutex_, read without it to skip the lock per batch
+      std::atomic<bool> flushRequested_{false};
+      std::size_t flushTarget_{0};  // the largest enqueuePos_ of a flush()
+      std::mutex mutex_;
+      std::condition_variable cond_;
+      std::condition_variable flushedCond_;
+      std::thread writer_;
+  };
+} /* end of namespace: nul */
+
+#endif /* end of include guard: NUL_LOG_ASYNC_H_ */
@@ -0,0 +1,785 @@
+#ifndef NUL_LOG_BINARY_H_
+#define NUL_LOG_BINARY_H_
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <type_traits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <ctime>
+
+#ifndef LOG_BINARY_FILE_PATH
+#define LOG_BINARY_FILE_PATH "nul.binlog"
+#endif
+
+// per-thread ring size in bytes, must be a power of 2
+#ifndef LOG_BINARY_THREAD_BUFFER_SIZE
+#define LOG_BINARY_THREAD_BUFFER_SIZE (256 * 1024)
+#endif
+
+// longer string arguments are truncated
+#ifndef LOG_BINARY_MAX_STRING
+#define LOG_BINARY_MAX_STRING 1024
+#endif
+
+#ifndef LOG_BINARY_FLUSH_INTERVAL_MS
+#define LOG_BINARY_FLUSH_INTERVAL_MS 50
+#endif
+
+// a thread wakes the writer once its ring is this full, in percent
+#ifndef LOG_BINARY_WAKE_PERCENT
+#define LOG_BINARY_WAKE_PERCENT 50
+#endif
+
+namespace nul {
+
+  /**
+   * how arguments of a deferred log record are stored: a one byte tag
+   * followed by the raw value, integers are widened to 64 bits, strings
+   * are copied (up to LOG_BINARY_MAX_STRING bytes) since the caller's
+   * pointer may be gone by the time the record is formatted
+   */
+  class BinaryLogArgs final {
+    public:
+      static constexpr char TAG_INT = 'i';
+      static constexpr char TAG_UINT = 'u';
+      static constexpr char TAG_DOUBLE = 'f';
+      static constexpr char TAG_STRING = 's';
+      static constexpr char TAG_POINTER = 'p';
+
+      template <typename... Args>
+      static std::size_t size(const Args &... args) {
+        return (std::size_t{0} + ... + argSize(args));
+      }
+
+      // 'p' must have room for size(args...) bytes
+      template <typename... Args>
+      static char *encode(char *p, const Args &... args) {
+        ((p = encodeArg(p, args)), ...);
+        return p;
+      }
+
+      /**
+       * formats 'fmt' with the encoded arguments, conversions are replayed
+       * one at a time through snprintf, so any printf format the compiler
+       * accepted is supported
+       */
+      static std::string format(
+        const char *fmt, const char *args, std::size_t len) {
+        std::string out;
+        auto end = args + len;
+        char spec[64];
+        char buf[512];
+
+        while (*fmt) {
+          if (*fmt != '%') {
+            auto next = strchr(fmt, '%');
+            auto n = next ? static_cast<std::size_t>(next - fmt) : strlen(fmt);
+            out.append(fmt, n);
+            fmt += n;
+            continue;
+          }
+          if (fmt[1] == '%') {
+            out.push_back('%');
+            fmt += 2;
+            continue;
+          }
+
+          // rebuild "%[flags][width][.precision]" with '*' resolved
+          std::size_t specLen = 0;
+          spec[specLen++] = *fmt++;
+          while (*fmt && strchr("-+ #0'", *fmt) && specLen < 32) {
+            spec[specLen++] = *fmt++;
+          }
+          for (int part = 0; part < 2; ++part) {
+            if (part == 1) {
+              if (*fmt != '.') {
+                break;
+              }
+              spec[specLen++] = *fmt++;
+            }
+            if (*fmt == '*') {
+              ++fmt;
+              int64_t v = 0;
+              readInt(args, end, v);
+              specLen += snprintf(spec + specLen, 16, "%d", static_cast<int>(v));
+            } else {
+              while (*fmt >= '0' && *fmt <= '9' && specLen < 48) {
+                spec[specLen++] = *fmt++;
+              }
+            }
+          }
+          // length modifiers are replaced, values are stored as 64 bits
+          while (*fmt && strchr("hlLqjzt", *fmt)) {
+            ++fmt;
+          }
+          auto conv = *fmt;
+          if (!conv) {
+            break;
+          }
+          ++fmt;
+
+          int n = 0;
+          switch (conv) {
+            case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': {
+              int64_t v = 0;
+              readInt(args, end, v);
+              spec[specLen++] = 'l';
+              spec[specLen++] = 'l';
+              spec[specLen++] = conv;
+              spec[specLen] = '\0';
+              n = snprintf(buf, sizeof(buf), spec, static_cast<long long>(v));
+              break;
+            }
+            case 'c': {
+              int64_t v = 0;
+              readInt(args, end, v);
+              spec[specLen++] = 'c';
+              spec[specLen] = '\0';
+              n = snprintf(buf, sizeof(buf), spec, static_cast<int>(v));
+              break;
+            }
+            case 'e': case 'E': case 'f': case 'F':
+            case 'g': case 'G': case 'a': case 'A': {
+              double v = 0;
+              if (args < end && *args == TAG_DOUBLE) {
+                memcpy(&v, args + 1, sizeof(v));
+                args += 1 + sizeof(v);
+              }
+              spec[specLen++] = conv;
+              spec[specLen] = '\0';
+              n = snprintf(buf, sizeof(buf), spec, v);
+              break;
+            }
+            case 's': {
+              std::string s = "(null)";
+              if (args < end && *args == TAG_STRING) {
+                uint32_t slen;
+                memcpy(&slen, args + 1, sizeof(slen));
+                s.assign(args + 1 + sizeof(slen), slen);
+                args += 1 + sizeof(slen) + slen;
+              } else if (args < end) {
+                args += 1 + sizeof(uint64_t);
+              }
+              spec[specLen++] = 's';
+              spec[specLen] = '\0';
+              // use the string directly, it may be longer than 'buf'
+              if (specLen == 2) {
+                out.append(s);
+                continue;
+              }
+              n = snprintf(buf, sizeof(buf), spec, s.c_str());
+              break;
+            }
+            case 'p': {
+              int64_t v = 0;
+              readInt(args, end, v);
+              spec[specLen++] = 'p';
+              spec[specLen] = '\0';
+              n = snprintf(buf, sizeof(buf), spec,
+                  reinterpret_cast<void *>(static_cast<uintptr_t>(v)));
+              break;
+            }
+            default:
+              // %n or unknown, drop the argument, if any
+              break;
+          }
+          if (n > 0) {
+            out.append(buf, std::min<std::size_t>(n, sizeof(buf) - 1));
+          }
+        }
+        return out;
+      }
+
+    private:
+      static std::size_t stringLength(const char *s) {
+        if (!s) {
+          return 0;
+        }
+        auto end = static_cast<const char *>(memchr(s, '\0', LOG_BINARY_MAX_STRING));
+        return end ? end - s : LOG_BINARY_MAX_STRING;
+      }
+
+      static std::size_t argSize(const char *s) {
+        return 1 + sizeof(uint32_t) + stringLength(s);
+      }
+
+      static std::size_t argSize(char *s) {
+        return argSize(static_cast<const char *>(s));
+      }
+
+      template <typename T>
+      static std::size_t argSize(const T &) {
+        static_assert(
+          std::is_arithmetic<T>::value || std::is_enum<T>::value ||
+          std::is_pointer<T>::value || std::is_null_pointer<T>::value,
+          "unsupported log argument type");
+        return 1 + 8;
+      }
+
+      static char *encodeArg(char *p, const char *s) {
+        if (!s) {
+          *p = TAG_POINTER;
+          memset(p + 1, 0, 8);
+          return p + 1 + 8;
+        }
+        uint32_t len = stringLength(s);
+        *p++ = TAG_STRING;
+        memcpy(p, &len, sizeof(len));
+        memcpy(p + sizeof(len), s, len);
+        return p + sizeof(len) + len;
+      }
+
+      static char *encodeArg(char *p, char *s) {
+        return encodeArg(p, static_cast<const char *>(s));
+      }
+
+      template <typename T>
+      static char *encodeArg(char *p, const T &v) {
+        if constexpr (std::is_floating_point<T>::value) {
+          double d = v;
+          *p = TAG_DOUBLE;
+          memcpy(p + 1, &d, 8);
+        } else if constexpr (std::is_enum<T>::value) {
+          int64_t i = static_cast<int64_t>(v);
+          *p = TAG_INT;
+          memcpy(p + 1, &i, 8);
+        } else if constexpr (
+            std::is_pointer<T>::value || std::is_null_pointer<T>::value) {
+          uint64_t u = reinterpret_cast<uintptr_t>(v);
+          *p = TAG_POINTER;
+          memcpy(p + 1, &u, 8);
+        } else if constexpr (std::is_signed<T>::value) {
+          int64_t i = v;
+          *p = TAG_INT;
+          memcpy(p + 1, &i, 8);
+        } else {
+          uint64_t u = v;
+          *p = TAG_UINT;
+          memcpy(p + 1, &u, 8);
+        }
+        return p + 1 + 8;
+      }
+
+      // any non-string value, as its 64 bits
+      static void readInt(const char *&args, const char *end, int64_t &v) {
+        if (args >= end) {
+          return;
+        }
+        if (*args == TAG_STRING) {
+          uint32_t slen;
+          memcpy(&slen, args + 1, sizeof(slen));
+          args += 1 + sizeof(slen) + slen;
+          return;
+        }
+        memcpy(&v, args + 1, sizeof(v));
+        args += 1 + sizeof(v);
+      }
+  };
+
+  /**
+   * backend of the LOG_* macros when LOG_BINARY is defined (NanoLog-style):
+   * every call site registers its static information (level, tag, file,
+   * line, function and format string) once, at runtime only the site id, a
+   * timestamp and the raw arguments are copied into a per-thread ring, no
+   * formatting happens on the calling thread.
+   *
+   * a writer thread merges the rings by timestamp into LOG_BINARY_FILE_PATH,
+   * use BinaryLogDecoder (or the bundled tools/binlog_decode) to turn it
+   * back into the usual text format. the writer drains every
+   * LOG_BINARY_FLUSH_INTERVAL_MS, or as soon as a ring is
+   * LOG_BINARY_WAKE_PERCENT full. records are dropped and counted when a
+   * thread's ring is full, define LOG_BINARY_BLOCK to make the thread wait
+   * for room instead.
+   *
+   * file format (native endianness):
+   *   "NULBLOG1"
+   *   'S' u32 id, i32 prio, i32 line, str tag, str file, str func, str fmt
+   *   'R' u32 siteId, u64 timestampNanos, u32 argsLen, args
+   * where str is u32 length + bytes
+   */
+  class BinaryLogger final {
+    static_assert(
+      (LOG_BINARY_THREAD_BUFFER_SIZE & (LOG_BINARY_THREAD_BUFFER_SIZE - 1)) == 0,
+      "LOG_BINARY_THREAD_BUFFER_SIZE must be a power of 2");
+
+    public:
+      static constexpr const char *MAGIC = "NULBLOG1";
+
+      struct Site {
+        int prio;
+        int line;
+        const char *tag;
+        const char *file;
+        const char *function;
+        const char *fmt;
+      };
+
+      static BinaryLogger &instance() {
+        // leaked on purpose, see AsyncLogger::instance()
+        static BinaryLogger *logger = []() {
+          auto l = new BinaryLogger(LOG_BINARY_FILE_PATH);
+          atexit([]() { instance().shutdown(); });
+          return l;
+        }();
+        return *logger;
+      }
+
+      // all strings must have static storage duration
+      uint32_t registerSite(
+        int prio, const char *tag, const char *file, int line,
+        const char *function, const char *fmt) {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        sites_.push_back(Site{prio, line, tag, file, function, fmt});
+        return static_cast<uint32_t>(sites_.size() - 1);
+      }
+
+      template <typename... Args>
+      void log(uint32_t siteId, const Args &... args) {
+        auto buf = threadBuffer();
+        auto argsLen = BinaryLogArgs::size(args...);
+        auto len = RECORD_HEADER_SIZE + argsLen;
+        auto p = buf->reserve(len);
+        while (!p) {
+#ifdef LOG_BINARY_BLOCK
+          if (accepting_.load(std::memory_order_acquire)) {
+            requestWake();
+            std::this_thread::yield();
+            p = buf->reserve(len);
+            continue;
+          }
+#endif
+          dropped_.fetch_add(1, std::memory_order_relaxed);
+          requestWake();
+          return;
+        }
+        uint32_t payloadLen = static_cast<uint32_t>(len - sizeof(uint32_t));
+        uint64_t ts = nowNanos();
+        memcpy(p, &payloadLen, sizeof(payloadLen));
+        memcpy(p + 4, &siteId, sizeof(siteId));
+        memcpy(p + 8, &ts, sizeof(ts));
+        BinaryLogArgs::encode(p + RECORD_HEADER_SIZE, args...);
+        buf->commit(len);
+        if (buf->used() >= WAKE_THRESHOLD) {
+          requestWake();
+        }
+      }
+
+      // blocks until every record logged before the call is written
+      void flush() {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        if (!running_) {
+          return;
+        }
+        auto target = ++flushRequested_;
+        cond_.notify_all();
+        flushedCond_.wait(lock, [&]() {
+          return !running_ || flushed_ >= target;
+        });
+      }
+
+      void shutdown() {
+        {
+          auto lock = std::unique_lock<std::mutex>(mutex_);
+          if (!running_) {
+            return;
+          }
+          stopping_ = true;
+          cond_.notify_all();
+        }
+        writer_.join();
+        accepting_.store(false, std::memory_order_release);
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        running_ = false;
+        if (file_) {
+          fclose(file_);
+          file_ = nullptr;
+        }
+        flushedCond_.notify_all();
+      }
+
+      uint64_t dropped() const {
+        return dropped_.load(std::memory_order_relaxed);
+      }
+
+      // never called, lets the compiler check the format at every call site
+      static void checkFormat(const char *, ...)
+        __attribute__((format(printf, 1, 2))) { }
+
+      static uint64_t nowNanos() {
+        struct timespec now;
+#if defined(LOG_CLOCK_COARSE) && defined(CLOCK_REALTIME_COARSE)
+        clock_gettime(CLOCK_REALTIME_COARSE, &now);
+#else
+        clock_gettime(CLOCK_REALTIME, &now);
+#endif
+        return static_cast<uint64_t>(now.tv_sec) * 1000000000ull + now.tv_nsec;
+      }
+
+    private:
+      // u32 length, u32 site id, u64 timestamp
+      static constexpr std::size_t RECORD_HEADER_SIZE = 16;
+      static constexpr uint32_t WRAP_MARKER = 0xffffffff;
+      static constexpr std::size_t WAKE_THRESHOLD =
+        LOG_BINARY_THREAD_BUFFER_SIZE / 100 * LOG_BINARY_WAKE_PERCENT;
+
+      // single-producer/single-consumer ring of records
+      struct ThreadBuffer {
+        static constexpr std::size_t CAPACITY = LOG_BINARY_THREAD_BUFFER_SIZE;
+        static constexpr std::size_t MASK = CAPACITY - 1;
+
+        std::unique_ptr<char[]> data{new char[CAPACITY]};
+        alignas(64) std::atomic<uint64_t> head{0};
+        alignas(64) std::atomic<uint64_t> tail{0};
+        std::atomic<bool> retired{false};
+
+        static std::size_t align(std::size_t len) {
+          return (len + 7) & ~std::size_t{7};
+        }
+
+        // producer, nullptr if there is no room
+        char *reserve(std::size_t len) {
+          auto need = align(len);
+          auto h = head.load(std::memory_order_relaxed);
+          auto pos = h & MASK;
+          auto skip = CAPACITY - pos < need ? CAPACITY - pos : 0;
+          if (need > CAPACITY / 2 ||
+              CAPACITY - (h - tail.load(std::memory_order_acquire)) < skip + need) {
+            return nullptr;
+          }
+          if (skip > 0) {
+            memcpy(data.get() + pos, &WRAP_MARKER, sizeof(WRAP_MARKER));
+            // the consumer may see the new head before commit(), the
+            // marker must be visible by then
+            head.store(h + skip, std::memory_order_release);
+            pos = 0;
+          }
+          return data.get() + pos;
+        }
+
+        // bytes not consumed yet, producer side
+        std::size_t used() const {
+          return head.load(std::memory_order_relaxed) -
+            tail.load(std::memory_order_relaxed);
+        }
+
+        void commit(std::size_t len) {
+          head.store(
+            head.load(std::memory_order_relaxed) + align(len),
+            std::memory_order_release);
+        }
+
+        // consumer, the record at the tail or nullptr
+        const char *front() {
+          auto t = tail.load(std::memory_order_relaxed);
+          if (head.load(std::memory_order_acquire) == t) {
+            return nullptr;
+          }
+          auto pos = t & MASK;
+          uint32_t len;
+          memcpy(&len, data.get() + pos, sizeof(len));
+          if (len == WRAP_MARKER) {
+            tail.store(t + CAPACITY - pos, std::memory_order_relaxed);
+            return front();
+          }
+          return data.get() + pos;
+        }
+
+        void pop(const char *record) {
+          uint32_t len;
+          memcpy(&len, record, sizeof(len));
+          tail.store(
+            tail.load(std::memory_order_relaxed) + align(len + sizeof(len)),
+            std::memory_order_release);
+        }
+      };
+
+      struct ThreadBufferHolder {
+        ThreadBuffer *buf{nullptr};
+
+        ~ThreadBufferHolder() {
+          if (buf) {
+            // the writer drains and frees it
+            buf->retired.store(true, std::memory_order_release);
+          }
+        }
+      };
+
+      explicit BinaryLogger(const char *path) {
+        file_ = fopen(path, "wb");
+        if (!file_) {
+          fprintf(stderr, "failed to open %s, binary logs are discarded\n", path);
+        } else {
+          fwrite(MAGIC, 1, strlen(MAGIC), file_);
+        }
+        running_ = true;
+        writer_ = std::thread([this]() { writerLoop(); });
+      }
+
+      ThreadBuffer *threadBuffer() {
+        thread_local ThreadBufferHolder holder;
+        if (!holder.buf) {
+          holder.buf = new ThreadBuffer();
+          auto lock = std::unique_lock<std::mutex>(mutex_);
+          buffers_.push_back(holder.buf);
+        }
+        return holder.buf;
+      }
+
+      void writerLoop() {
+        std::size_t writtenSites = 0;
+        std::vector<ThreadBuffer *> buffers;
+
+        while (true) {
+          uint64_t flushTarget;
+          bool stopping;
+          {
+            auto lock = std::unique_lock<std::mutex>(mutex_);
+            cond_.wait_for(
+              lock, std::chrono::milliseconds(LOG_BINARY_FLUSH_INTERVAL_MS),
+              [&]() {
+                return stopping_ || flushRequested_ != flushed_ ||
+                  wakeRequested_.load(std::memory_order_relaxed);
+              });
+            // a ring filling up while this pass runs asks for the next one
+            wakeRequested_.store(false, std::memory_order_relaxed);
+            flushTarget = flushRequested_;
+            stopping = stopping_;
+
+            // new sites first, records only reference registered sites
+            writeNewSites(writtenSites);
+            buffers = buffers_;
+          }
+
+          writeRecords(buffers, writtenSites);
+          if (file_) {
+            fflush(file_);
+          }
+
+          auto lock = std::unique_lock<std::mutex>(mutex_);
+          // free buffers of exited threads once they are drained
+          for (auto it = buffers_.begin(); it != buffers_.end();) {
+            auto b = *it;
+            if (b->retired.load(std::memory_order_acquire) && !b->front()) {
+              delete b;
+              it = buffers_.erase(it);
+            } else {
+              ++it;
+            }
+          }
+          flushed_ = flushTarget;
+          flushedCond_.notify_all();
+          if (stopping) {
+            break;
+          }
+        }
+      }
+
+      // with mutex_ held
+      void writeNewSites(std::size_t &writtenSites) {
+        for (; writtenSites < sites_.size(); ++writtenSites) {
+          writeSite(writtenSites, sites_[writtenSites]);
+        }
+      }
+
+      // merges the rings by timestamp
+      void writeRecords(
+        const std::vector<ThreadBuffer *> &buffers, std::size_t &writtenSites) {
+        while (true) {
+          ThreadBuffer *oldest = nullptr;
+          const char *oldestRecord = nullptr;
+          uint64_t oldestTs = 0;
+          for (auto b : buffers) {
+            auto record = b->front();
+            if (!record) {
+              continue;
+            }
+            uint64_t ts;
+            memcpy(&ts, record + 8, sizeof(ts));
+            if (!oldest || ts < oldestTs) {
+              oldest = b;
+              oldestRecord = record;
+              oldestTs = ts;
+            }
+          }
+          if (!oldest) {
+            return;
+          }
+
+          uint32_t siteId;
+          memcpy(&siteId, oldestRecord + 4, sizeof(siteId));
+          if (siteId >= writtenSites) {
+            // registered after this batch started, its 'S' goes first
+            auto lock = std::unique_lock<std::mutex>(mutex_);
+            writeNewSites(writtenSites);
+          }
+
+          if (file_) {
+            uint32_t len;
+            memcpy(&len, oldestRecord, sizeof(len));
+            uint32_t argsLen = len + sizeof(len) - RECORD_HEADER_SIZE;
+            fputc('R', file_);
+            fwrite(oldestRecord + 4, 1, 12, file_);
+            fwrite(&argsLen, sizeof(argsLen), 1, file_);
+            fwrite(oldestRecord + RECORD_HEADER_SIZE, 1, argsLen, file_);
+          }
+          oldest->pop(oldestRecord);
+        }
+      }
+
+      // one notify until the writer wakes up, no lock on every record
+      void requestWake() {
+        if (!wakeRequested_.load(std::memory_order_relaxed) &&
+            !wakeRequested_.exchange(true, std::memory_order_acq_rel)) {
+          auto lock = std::unique_lock<std::mutex>(mutex_);
+          cond_.notify_one();
+        }
+      }
+
+      void writeSite(std::size_t id, const Site &site) {
+        if (!file_) {
+          return;
+        }
+        uint32_t id32 = static_cast<uint32_t>(id);
+        int32_t prio = site.prio;
+        int32_t line = site.line;
+        fputc('S', file_);
+        fwrite(&id32, sizeof(id32), 1, file_);
+        fwrite(&prio, sizeof(prio), 1, file_);
+        fwrite(&line, sizeof(line), 1, file_);
+        for (auto s : { site.tag, site.file, site.function, site.fmt }) {
+          uint32_t len = strlen(s);
+          fwrite(&len, sizeof(len), 1, file_);
+          fwrite(s, 1, len, file_);
+        }
+      }
+
+    private:
+      std::vector<Site> sites_;
+      std::vector<ThreadBuffer *> buffers_;
+      std::atomic<uint64_t> dropped_{0};
+      std::atomic<bool> wakeRequested_{false};
+      std::atomic<bool> accepting_{true};  // false once the writer is gone
+
+      FILE *file_{nullptr};
+      bool running_{false};
+      bool stopping_{false};
+      uint64_t flushRequested_{0};
+      uint64_t flushed_{0};
+      std::mutex mutex_;
+      std::condition_variable cond_;
+      std::condition_variable flushedCond_;
+      std::thread writer_;
+  };
+
+  /**
+   * turns a file written by BinaryLogger back into the text format of the
+   * LOG_* macros, "%s %s [%s] [%s:%d] %s - " fmt
+   */
+  class BinaryLogDecoder final {
+    public:
+      // returns false if 'in' is not a binary log or is truncated
+      static bool decode(FILE *in, FILE *out) {
+        char magic[8];
+        if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+            memcmp(magic, BinaryLogger::MAGIC, sizeof(magic)) != 0) {
+          return false;
+        }
+
+        std::vector<DecodedSite> sites;
+        std::vector<char> args;
+        int type;
+        while ((type = fgetc(in)) != EOF) {
+          if (type == 'S') {
+            uint32_t id;
+            int32_t prio, line;
+            DecodedSite site;
+            if (!read(in, id) || !read(in, prio) || !read(in, line) ||
+                !readString(in, site.tag) || !readString(in, site.file) ||
+                !readString(in, site.function) || !readString(in, site.fmt)) {
+              return false;
+            }
+            site.prio = prio;
+            site.line = line;
+            if (sites.size() <= id) {
+              sites.resize(id + 1);
+            }
+            sites[id] = std::move(site);
+
+          } else if (type == 'R') {
+            uint32_t siteId, argsLen;
+            uint64_t ts;
+            if (!read(in, siteId) || !read(in, ts) || !read(in, argsLen)) {
+              return false;
+            }
+            args.resize(argsLen);
+            if (fread(args.data(), 1, argsLen, in) != argsLen ||
+                siteId >= sites.size()) {
+              return false;
+            }
+            auto &site = sites[siteId];
+            auto msg = BinaryLogArgs::format(
+              site.fmt.c_str(), args.data(), args.size());
+            char timeBuf[32];
+            fprintf(out, "%s %s [%s] [%s:%d] %s - %s\n",
+                formatTime(ts, timeBuf), site.tag.c_str(),
+                prioStr(site.prio), site.file.c_str(), site.line,
+                site.function.c_str(), msg.c_str());
+
+          } else {
+            return false;
+          }
+        }
+        return true;
+      }
+
+    private:
+      struct DecodedSite {
+        int prio{0};
+        int line{0};
+        std::string tag;
+        std::string file;
+        std::string function;
+        std::string fmt;
+      };
+
+      template <typename T>
+      static bool read(FILE *in, T &v) {
+        return fread(&v, sizeof(v), 1, in) == 1;
+      }
+
+      static bool readString(FILE *in, std::string &s) {
+        uint32_t len;
+        if (!read(in, len)) {
+          return false;
+        }
+        s.resize(len);
+        return fread(&s[0], 1, len, in) == len;
+      }
+
+      static const char *formatTime(uint64_t nanos, char *buf) {
+        time_t sec = nanos / 1000000000ull;
+        int milli = (nanos / 1000000ull) % 1000;
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        auto len = strftime(buf, 24, "%Y-%m-%d %H:%M:%S.", &tm);
+        snprintf(buf + len, 8, "%03d", milli);
+        return buf;
+      }
+
+      // same as log_prio_str_() in log.hpp, which is not included here
+      static const char *prioStr(int prio) {
+        static const char *names[] = { "", "", "V", "D", "I", "W", "E" };
+        return prio >= 0 && prio <= 6 ? names[prio] : "";
+      }
+  };
+} /* end of namespace: nul */
+
+#endif /* end of include guard: NUL_LOG_BINARY_H_ */
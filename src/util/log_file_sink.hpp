@@ -0,0 +1,315 @@
+#ifndef NUL_LOG_FILE_SINK_H_
+#define NUL_LOG_FILE_SINK_H_
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// records are buffered until the buffer is full or it is this old
+#ifndef LOG_FILE_BUFFER_SIZE
+#define LOG_FILE_BUFFER_SIZE (64 * 1024)
+#endif
+
+#ifndef LOG_FILE_FLUSH_INTERVAL_MS
+#define LOG_FILE_FLUSH_INTERVAL_MS 1000
+#endif
+
+// rotate once the file grows beyond this many bytes, 0 to disable
+#ifndef LOG_FILE_MAX_SIZE
+#define LOG_FILE_MAX_SIZE 0
+#endif
+
+// rotate every this many seconds, 0 to disable
+#ifndef LOG_FILE_ROTATE_INTERVAL_SEC
+#define LOG_FILE_ROTATE_INTERVAL_SEC 0
+#endif
+
+// keep path.1 ... path.N when rotating
+#ifndef LOG_FILE_MAX_BACKUPS
+#define LOG_FILE_MAX_BACKUPS 5
+#endif
+
+namespace nul {
+
+  /**
+   * an append-only log file that stays open, records are buffered and
+   * written with one write(2) per flush, a record is never split across
+   * two writes, so concurrent appends stay atomic per record.
+   *
+   * the file is rotated by size and/or time (path -> path.1 -> path.2 ...),
+   * and reopened on request, e.g. after an external logrotate, see
+   * installReopenSignalHandler(). if the file cannot be opened, records go
+   * to stderr until a later reopen succeeds.
+   */
+  class LogFileSink final {
+    public:
+      struct Options {
+        std::size_t bufferSize{LOG_FILE_BUFFER_SIZE};
+        int flushIntervalMillis{LOG_FILE_FLUSH_INTERVAL_MS};
+        uint64_t maxFileSize{LOG_FILE_MAX_SIZE};
+        int rotateIntervalSec{LOG_FILE_ROTATE_INTERVAL_SEC};
+        int maxBackups{LOG_FILE_MAX_BACKUPS};
+      };
+
+#ifdef LOG_FILE_PATH
+      // the sink used by the LOG_* macros when LOG_TO_FILE is defined
+      static LogFileSink &instance() {
+        // leaked on purpose so it outlives static destructors that log
+        static LogFileSink *sink = []() {
+          auto s = new LogFileSink(LOG_FILE_PATH);
+          atexit([]() { instance().flush(); });
+          return s;
+        }();
+        return *sink;
+      }
+#endif
+
+      explicit LogFileSink(std::string path) :
+        LogFileSink(std::move(path), Options{}) { }
+
+      LogFileSink(std::string path, Options options) :
+        path_(std::move(path)), options_(options),
+        reopenSeen_(reopenGeneration().load(std::memory_order_relaxed)),
+        buffer_(new char[options.bufferSize]) {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        openFile();
+        if (options_.flushIntervalMillis > 0) {
+          flusher_ = std::thread([this]() { flushLoop(); });
+        }
+      }
+
+      ~LogFileSink() {
+        {
+          auto lock = std::unique_lock<std::mutex>(mutex_);
+          stopping_ = true;
+          cond_.notify_all();
+        }
+        if (flusher_.joinable()) {
+          flusher_.join();
+        }
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        flushLocked();
+        closeFile();
+      }
+
+      LogFileSink(const LogFileSink &) = delete;
+      LogFileSink &operator=(const LogFileSink &) = delete;
+
+      void printf(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+        char buf[1024];
+        va_list args;
+        va_start(args, fmt);
+        auto n = vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+        if (n < 0) {
+          return;
+        }
+        if (static_cast<std::size_t>(n) < sizeof(buf)) {
+          write(buf, n);
+          return;
+        }
+
+        auto big = std::unique_ptr<char[]>(new char[n + 1]);
+        va_start(args, fmt);
+        vsnprintf(big.get(), n + 1, fmt, args);
+        va_end(args);
+        write(big.get(), n);
+      }
+
+      // 'data' should hold whole records
+      void write(const char *data, std::size_t len) {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        auto generation = reopenGeneration().load(std::memory_order_relaxed);
+        if (generation != reopenSeen_) {
+          reopenSeen_ = generation;
+          flushLocked();
+          closeFile();
+          openFile();
+        }
+
+        if (bufferLen_ + len > options_.bufferSize) {
+          flushLocked();
+        }
+        if (len >= options_.bufferSize) {
+          writeFully(data, len);
+          fileSize_ += len;
+          rotateIfNeeded();
+          return;
+        }
+        if (bufferLen_ == 0) {
+          oldestRecordTime_ = std::chrono::steady_clock::now();
+        }
+        memcpy(buffer_.get() + bufferLen_, data, len);
+        bufferLen_ += len;
+      }
+
+      void flush() {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        flushLocked();
+      }
+
+      // e.g. after the file is moved away by logrotate
+      bool reopen() {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        flushLocked();
+        closeFile();
+        return openFile();
+      }
+
+      bool rotate() {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        flushLocked();
+        return rotateLocked();
+      }
+
+      // the underlying fd, only for async-signal-safe last-resort writes
+      int fd() const {
+        return fd_;
+      }
+
+      /**
+       * every sink reopens its file before the next write once 'sig' is
+       * received, the handler only bumps a generation each sink compares
+       * with the last one it has seen
+       */
+      static void installReopenSignalHandler(int sig = SIGHUP) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = [](int) {
+          reopenGeneration().fetch_add(1, std::memory_order_relaxed);
+        };
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(sig, &sa, nullptr);
+      }
+
+    private:
+      // lock-free, so it is safe to bump from a signal handler
+      static std::atomic<uint32_t> &reopenGeneration() {
+        static std::atomic<uint32_t> generation{0};
+        return generation;
+      }
+
+      // must be called with mutex_ held
+      bool openFile() {
+        fd_ = ::open(
+          path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd_ == -1) {
+          fprintf(stderr, "failed to open %s: %s, logging to stderr\n",
+              path_.c_str(), strerror(errno));
+          fd_ = STDERR_FILENO;
+          fileSize_ = 0;
+          return false;
+        }
+        struct stat st;
+        fileSize_ = fstat(fd_, &st) == 0 ? st.st_size : 0;
+        openTime_ = time(nullptr);
+        return true;
+      }
+
+      void closeFile() {
+        if (fd_ != STDERR_FILENO) {
+          ::close(fd_);
+        }
+        fd_ = STDERR_FILENO;
+      }
+
+      void flushLocked() {
+        if (bufferLen_ > 0) {
+          writeFully(buffer_.get(), bufferLen_);
+          fileSize_ += bufferLen_;
+          bufferLen_ = 0;
+        }
+        rotateIfNeeded();
+      }
+
+      void rotateIfNeeded() {
+        if (fd_ == STDERR_FILENO) {
+          return;
+        }
+        auto tooLarge =
+          options_.maxFileSize > 0 && fileSize_ >= options_.maxFileSize;
+        auto tooOld = options_.rotateIntervalSec > 0 &&
+          time(nullptr) - openTime_ >= options_.rotateIntervalSec;
+        if (tooLarge || tooOld) {
+          rotateLocked();
+        }
+      }
+
+      bool rotateLocked() {
+        closeFile();
+        for (int i = options_.maxBackups - 1; i >= 1; --i) {
+          auto from = path_ + "." + std::to_string(i);
+          auto to = path_ + "." + std::to_string(i + 1);
+          rename(from.c_str(), to.c_str());
+        }
+        if (options_.maxBackups > 0) {
+          rename(path_.c_str(), (path_ + ".1").c_str());
+        } else {
+          unlink(path_.c_str());
+        }
+        return openFile();
+      }
+
+      void writeFully(const char *data, std::size_t len) {
+        while (len > 0) {
+          auto n = ::write(fd_, data, len);
+          if (n < 0) {
+            if (errno == EINTR) {
+              continue;
+            }
+            return;
+          }
+          data += n;
+          len -= n;
+        }
+      }
+
+      void flushLoop() {
+        auto interval = std::chrono::milliseconds(options_.flushIntervalMillis);
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        while (!stopping_) {
+          cond_.wait_for(lock, interval);
+          if (bufferLen_ > 0 &&
+              std::chrono::steady_clock::now() - oldestRecordTime_ >= interval) {
+            flushLocked();
+          } else if (bufferLen_ == 0) {
+            rotateIfNeeded();
+          }
+        }
+      }
+
+    private:
+      std::string path_;
+      Options options_;
+      int fd_{STDERR_FILENO};
+      uint64_t fileSize_{0};
+      time_t openTime_{0};
+      uint32_t reopenSeen_;
+
+      std::unique_ptr<char[]> buffer_;
+      std::size_t bufferLen_{0};
+      std::chrono::steady_clock::time_point oldestRecordTime_;
+
+      bool stopping_{false};
+      std::mutex mutex_;
+      std::condition_variable cond_;
+      std::thread flusher_;
+  };
+} /* end of namespace: nul */
+
+#endif /* end of include guard: NUL_LOG_FILE_SINK_H_ */
@@ -0,0 +1,389 @@
+#ifndef NUL_LOG_FLIGHT_RECORDER_H_
+#define NUL_LOG_FLIGHT_RECORDER_H_
+#include "log_binary.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+
+// records kept per thread, must be a power of 2
+#ifndef LOG_FLIGHT_RECORDER_RECORDS
+#define LOG_FLIGHT_RECORDER_RECORDS 1024
+#endif
+
+// bytes per record, arguments that do not fit are not kept
+#ifndef LOG_FLIGHT_RECORDER_RECORD_SIZE
+#define LOG_FLIGHT_RECORDER_RECORD_SIZE 128
+#endif
+
+// threads that get a ring, rings of exited threads are reused
+#ifndef LOG_FLIGHT_RECORDER_MAX_THREADS
+#define LOG_FLIGHT_RECORDER_MAX_THREADS 256
+#endif
+
+// rings allocated at startup, see FlightRecorder::reserve()
+#ifndef LOG_FLIGHT_RECORDER_RESERVED_THREADS
+#define LOG_FLIGHT_RECORDER_RESERVED_THREADS 16
+#endif
+
+namespace nul {
+
+  /**
+   * keeps the last LOG_FLIGHT_RECORDER_RECORDS records of every thread in
+   * memory, whatever their runtime level, so a crash dump has the verbose
+   * context that was filtered out of the log. with LOG_FLIGHT_RECORDER
+   * defined, every LOG_* call (of the compiled-in levels) is recorded.
+   *
+   * recording is lock-free and allocation-free: the rings are allocated up
+   * front, LOG_FLIGHT_RECORDER_RESERVED_THREADS of them at startup and more
+   * with reserve(), a thread takes a free ring on its first record and
+   * records nothing if there is none. the site pointer, a timestamp and
+   * the arguments in BinaryLogArgs encoding are copied into the next slot,
+   * which is guarded by a sequence number so a dump never reads a
+   * half-written record.
+   *
+   * dump() only uses async-signal-safe calls and writes the same format as
+   * LOG_BINARY, so it is read back with BinaryLogDecoder/binlog_decode.
+   */
+  class FlightRecorder final {
+    static_assert(
+      (LOG_FLIGHT_RECORDER_RECORDS & (LOG_FLIGHT_RECORDER_RECORDS - 1)) == 0,
+      "LOG_FLIGHT_RECORDER_RECORDS must be a power of 2");
+
+    public:
+      struct Site {
+        int prio;
+        int line;
+        const char *tag;
+        const char *file;
+        const char *function;
+        const char *fmt;
+      };
+
+      template <typename... Args>
+      static void record(const Site *site, const Args &... args) {
+        auto ring = threadRing();
+        if (!ring) {
+          return;
+        }
+        auto head = ring->head.load(std::memory_order_relaxed);
+        auto &slot = ring->slots[head & MASK];
+        auto seq = slot.seq.load(std::memory_order_relaxed);
+        slot.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        slot.site = site;
+        slot.timestamp = BinaryLogger::nowNanos();
+        auto len = BinaryLogArgs::size(args...);
+        if (len <= ARGS_SIZE) {
+          BinaryLogArgs::encode(slot.args, args...);
+          slot.argsLen = static_cast<uint16_t>(len);
+        } else {
+          slot.argsLen = 0;
+        }
+
+        slot.seq.store(seq + 2, std::memory_order_release);
+        ring->head.store(head + 1, std::memory_order_release);
+      }
+
+      /**
+       * allocates rings until there are at least 'threads' of them (up to
+       * LOG_FLIGHT_RECORDER_MAX_THREADS), call it at startup for processes
+       * with more threads, returns false if they could not be allocated
+       */
+      static bool reserve(int threads) {
+        auto &rings = ringTable();
+        auto count = 0;
+        for (auto &r : rings) {
+          if (count >= threads) {
+            break;
+          }
+          if (r.load(std::memory_order_acquire)) {
+            ++count;
+            continue;
+          }
+          auto ring = new (std::nothrow) Ring();
+          if (!ring) {
+            return false;
+          }
+          Ring *empty = nullptr;
+          if (r.compare_exchange_strong(empty, ring, std::memory_order_acq_rel)) {
+            ++count;
+          } else {
+            delete ring;
+            ++count;  // taken by a concurrent reserve()
+          }
+        }
+        return count >= threads;
+      }
+
+      /**
+       * writes the records of all threads, oldest first, returns false if
+       * the file cannot be written or another dump is in progress,
+       * async-signal-safe
+       */
+      static bool dump(const char *path) {
+        auto fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1) {
+          return false;
+        }
+        auto ok = dump(fd);
+        ::close(fd);
+        return ok;
+      }
+
+      static bool dump(int fd) {
+        static std::atomic<bool> dumping{false};
+        if (dumping.exchange(true, std::memory_order_acquire)) {
+          return false;
+        }
+        Writer out(fd);
+        out.append(BinaryLogger::MAGIC, strlen(BinaryLogger::MAGIC));
+
+        // merge the rings by timestamp, cursors are static so nothing is
+        // allocated in a signal handler
+        static uint64_t cursors[LOG_FLIGHT_RECORDER_MAX_THREADS];
+        static uint64_t ends[LOG_FLIGHT_RECORDER_MAX_THREADS];
+        auto &rings = ringTable();
+        for (int i = 0; i < LOG_FLIGHT_RECORDER_MAX_THREADS; ++i) {
+          auto ring = rings[i].load(std::memory_order_acquire);
+          ends[i] = ring ? ring->head.load(std::memory_order_acquire) : 0;
+          cursors[i] = ends[i] > RECORDS ? ends[i] - RECORDS : 0;
+        }
+
+        uint32_t id = 0;
+        while (true) {
+          auto oldest = -1;
+          uint64_t oldestTs = 0;
+          for (int i = 0; i < LOG_FLIGHT_RECORDER_MAX_THREADS; ++i) {
+            if (cursors[i] == ends[i]) {
+              continue;
+            }
+            auto ring = rings[i].load(std::memory_order_relaxed);
+            auto ts = ring->slots[cursors[i] & MASK].timestamp;
+            if (oldest == -1 || ts < oldestTs) {
+              oldest = i;
+              oldestTs = ts;
+            }
+          }
+          if (oldest == -1) {
+            break;
+          }
+
+          Slot copy;
+          auto index = cursors[oldest]++;
+          if (read(*rings[oldest].load(std::memory_order_relaxed), index, copy)) {
+            writeRecord(out, id++, copy);
+          }
+        }
+
+        auto ok = out.flush();
+        dumping.store(false, std::memory_order_release);
+        return ok;
+      }
+
+      /**
+       * dumps to 'path' on SIGSEGV, SIGBUS, SIGILL, SIGFPE and SIGABRT, then
+       * hands the signal to the previously installed handler (e.g.
+       * AsyncLogger's) or the default action
+       */
+      static void installSignalHandlers(const char *path) {
+        auto &p = dumpPath();
+        strncpy(p, path, sizeof(p) - 1);
+        p[sizeof(p) - 1] = '\0';
+
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = &FlightRecorder::onFatalSignal;
+        sa.sa_flags = SA_NODEFER;
+        sigemptyset(&sa.sa_mask);
+        for (auto sig : FATAL_SIGNALS) {
+          sigaction(sig, &sa, &previousAction(sig));
+        }
+      }
+
+    private:
+      static constexpr std::size_t RECORDS = LOG_FLIGHT_RECORDER_RECORDS;
+      static constexpr std::size_t MASK = RECORDS - 1;
+      static constexpr std::size_t ARGS_SIZE =
+        LOG_FLIGHT_RECORDER_RECORD_SIZE - 24;
+      static constexpr int FATAL_SIGNALS[] = {
+        SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT
+      };
+
+      struct Slot {
+        std::atomic<uint32_t> seq{0};
+        uint16_t argsLen{0};
+        const Site *site{nullptr};
+        uint64_t timestamp{0};
+        char args[ARGS_SIZE];
+      };
+
+      struct Ring {
+        std::atomic<uint64_t> head{0};
+        std::atomic<bool> inUse{false};
+        Slot slots[RECORDS];
+      };
+
+      struct RingHolder {
+        Ring *ring{nullptr};
+
+        ~RingHolder() {
+          if (ring) {
+            // kept for the dump, until another thread takes it over
+            ring->inUse.store(false, std::memory_order_release);
+          }
+        }
+      };
+
+      // buffered write(2)s
+      struct Writer {
+        explicit Writer(int fd) : fd(fd) {
+        }
+
+        int fd;
+        std::size_t len{0};
+        bool ok{true};
+        char buf[4096];
+
+        void append(const void *data, std::size_t n) {
+          auto p = static_cast<const char *>(data);
+          while (n > 0) {
+            auto chunk = std::min(n, sizeof(buf) - len);
+            memcpy(buf + len, p, chunk);
+            len += chunk;
+            p += chunk;
+            n -= chunk;
+            if (len == sizeof(buf)) {
+              flush();
+            }
+          }
+        }
+
+        bool flush() {
+          auto p = buf;
+          while (len > 0) {
+            auto n = ::write(fd, p, len);
+            if (n < 0) {
+              if (errno == EINTR) {
+                continue;
+              }
+              ok = false;
+              len = 0;
+              break;
+            }
+            p += n;
+            len -= n;
+          }
+          return ok;
+        }
+      };
+
+      static std::atomic<Ring *> (&ringTable())[LOG_FLIGHT_RECORDER_MAX_THREADS] {
+        static std::atomic<Ring *> rings[LOG_FLIGHT_RECORDER_MAX_THREADS];
+        return rings;
+      }
+
+      static Ring *threadRing() {
+        thread_local RingHolder holder;
+        if (!holder.ring) {
+          holder.ring = acquireRing();
+        }
+        return holder.ring;
+      }
+
+      /**
+       * a ring that has never been used, so the records of exited threads
+       * stay around, else the ring of an exited thread, nullptr if every
+       * ring is in use
+       */
+      static Ring *acquireRing() {
+        auto &rings = ringTable();
+        for (auto fresh : { true, false }) {
+          for (auto &r : rings) {
+            auto ring = r.load(std::memory_order_acquire);
+            if (!ring ||
+                (fresh && ring->head.load(std::memory_order_relaxed) != 0)) {
+              continue;
+            }
+            auto inUse = false;
+            if (ring->inUse.compare_exchange_strong(
+                  inUse, true, std::memory_order_acq_rel)) {
+              return ring;
+            }
+          }
+        }
+        return nullptr;
+      }
+
+      // copies the record 'index', false if it was overwritten or is being
+      // written
+      static bool read(const Ring &ring, uint64_t index, Slot &copy) {
+        auto &slot = ring.slots[index & MASK];
+        // the n-th write to a slot leaves its sequence number at 2n
+        auto expected = static_cast<uint32_t>(2 * (index / RECORDS + 1));
+        if (slot.seq.load(std::memory_order_acquire) != expected) {
+          return false;
+        }
+        copy.site = slot.site;
+        copy.timestamp = slot.timestamp;
+        copy.argsLen = std::min<std::size_t>(slot.argsLen, ARGS_SIZE);
+        memcpy(copy.args, slot.args, copy.argsLen);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot.seq.load(std::memory_order_relaxed) == expected &&
+          copy.site != nullptr;
+      }
+
+      // one site per record, so nothing has to be remembered across records
+      static void writeRecord(Writer &out, uint32_t id, const Slot &slot) {
+        auto site = slot.site;
+        int32_t prio = site->prio;
+        int32_t line = site->line;
+        out.append("S", 1);
+        out.append(&id, sizeof(id));
+        out.append(&prio, sizeof(prio));
+        out.append(&line, sizeof(line));
+        for (auto s : { site->tag, site->file, site->function, site->fmt }) {
+          uint32_t len = strlen(s);
+          out.append(&len, sizeof(len));
+          out.append(s, len);
+        }
+
+        uint32_t argsLen = slot.argsLen;
+        out.append("R", 1);
+        out.append(&id, sizeof(id));
+        out.append(&slot.timestamp, sizeof(slot.timestamp));
+        out.append(&argsLen, sizeof(argsLen));
+        out.append(slot.args, argsLen);
+      }
+
+      static char (&dumpPath())[256] {
+        static char path[256];
+        return path;
+      }
+
+      static struct sigaction &previousAction(int sig) {
+        static struct sigaction actions[NSIG];
+        return actions[sig];
+      }
+
+      static void onFatalSignal(int sig) {
+        dump(dumpPath());
+        sigaction(sig, &previousAction(sig), nullptr);
+        raise(sig);
+      }
+  };
+
+namespace detail {
+  // allocated at startup rather than by the first record of a thread
+  static const bool flightRecorderReserved =
+    FlightRecorder::reserve(LOG_FLIGHT_RECORDER_RESERVED_THREADS);
+} /* end of namespace: detail */
+} /* end of namespace: nul */
+
+#endif /* end of include guard: NUL_LOG_FLIGHT_RECORDER_H_ */
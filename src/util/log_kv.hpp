@@ -0,0 +1,309 @@
+#ifndef NUL_LOG_KV_H_
+#define NUL_LOG_KV_H_
+#include "log.hpp"
+#include <charconv>
+#include <string>
+#include <string_view>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace nul {
+
+  enum class LogKvFormat {
+    LOGFMT,
+    JSON,
+  };
+
+  // a typed field of a structured record, see kv()
+  template <typename T>
+  struct LogField {
+    const char *key;
+    const T &value;
+  };
+
+  // 'key' is written as is, it should be a plain identifier
+  template <typename T>
+  LogField<T> kv(const char *key, const T &value) {
+    return LogField<T>{key, value};
+  }
+
+  /**
+   * structured records for the LOG_KV_* macros, one line per record, e.g.
+   *
+   *   LOG_KV_I("request done", nul::kv("status", 200), nul::kv("path", path));
+   *
+   * logfmt (the default):
+   *   time=2020-01-02T03:04:05.678 level=info tag=nul file=a.cc line=12
+   *   func=f msg="request done" status=200 path=/index
+   * or JSON if LOG_KV_JSON is defined:
+   *   {"time":"2020-01-02T03:04:05.678","level":"info",...,"status":200}
+   *
+   * the static part of a record (level, tag, file, line and function) is
+   * encoded once per call site, strings are escaped a word at a time, and
+   * only copied byte by byte from the first byte that needs escaping.
+   * records go to the same sink as the LOG_* macros (async, file or stderr).
+   */
+  template <LogKvFormat FORMAT>
+  class BasicLogKv final {
+    public:
+      static constexpr bool JSON = FORMAT == LogKvFormat::JSON;
+
+      class Site final {
+        public:
+          Site(int prio, const char *tag, const char *file, int line,
+              const char *function) : prio_(prio), tag_(tag) {
+            appendKey(prefix_, "level");
+            appendString(prefix_, levelName(prio));
+            appendKey(prefix_, "tag");
+            appendString(prefix_, tag);
+            appendKey(prefix_, "file");
+            appendString(prefix_, file);
+            appendKey(prefix_, "line");
+            appendValue(prefix_, line);
+            appendKey(prefix_, "func");
+            appendString(prefix_, function);
+            appendKey(prefix_, "msg");
+          }
+
+          int prio() const {
+            return prio_;
+          }
+
+          const char *tag() const {
+            return tag_;
+          }
+
+          // everything between the time and the message
+          const std::string &prefix() const {
+            return prefix_;
+          }
+
+        private:
+          int prio_;
+          const char *tag_;
+          std::string prefix_;
+      };
+
+      template <typename... Fields>
+      static void format(std::string &out, const char *time,
+          const Site &site, const char *msg, const Fields &... fields) {
+        out.append(JSON ? "{\"time\":" : "time=");
+        appendString(out, time);
+        out.append(site.prefix());
+        appendString(out, msg);
+        (appendField(out, fields), ...);
+        out.append(JSON ? "}\n" : "\n");
+      }
+
+      template <typename... Fields>
+      static void write(
+          const Site &site, const char *msg, const Fields &... fields) {
+        thread_local std::string buf;
+        char time[TIME_BUFFER_SIZE];
+        log_strtime(time);
+        // ISO 8601
+        time[10] = 'T';
+        buf.clear();
+        format(buf, time, site, msg, fields...);
+        output(site, buf);
+      }
+
+      static void appendString(std::string &out, const char *s) {
+        if (!s) {
+          out.append(JSON ? "null" : "\"\"");
+          return;
+        }
+        appendString(out, s, strlen(s));
+      }
+
+      static void appendString(std::string &out, const char *s, std::size_t len) {
+        auto clean = cleanPrefix(s, len);
+        if (!JSON && clean == len && len > 0) {
+          // logfmt only quotes values that need it
+          out.append(s, len);
+          return;
+        }
+        out.push_back('"');
+        out.append(s, clean);
+        for (auto i = clean; i < len; ++i) {
+          auto c = static_cast<unsigned char>(s[i]);
+          switch (c) {
+            case '"': out.append("\\\""); break;
+            case '\\': out.append("\\\\"); break;
+            case '\n': out.append("\\n"); break;
+            case '\r': out.append("\\r"); break;
+            case '\t': out.append("\\t"); break;
+            default:
+              if (c < 0x20) {
+                char esc[8];
+                snprintf(esc, sizeof(esc), "\\u%04x", c);
+                out.append(esc);
+              } else {
+                out.push_back(c);
+              }
+          }
+        }
+        out.push_back('"');
+      }
+
+    private:
+      static const char *levelName(int prio) {
+        switch (prio) {
+          case LOG_LEVEL_VERBOSE: return "verbose";
+          case LOG_LEVEL_DEBUG: return "debug";
+          case LOG_LEVEL_INFO: return "info";
+          case LOG_LEVEL_WARN: return "warn";
+          case LOG_LEVEL_ERROR: return "error";
+        }
+        return "";
+      }
+
+      // length of the leading part of 's' that can be written as is
+      static std::size_t cleanPrefix(const char *s, std::size_t len) {
+        constexpr uint64_t ONES = 0x0101010101010101ull;
+        constexpr uint64_t HIGHS = 0x8080808080808080ull;
+        auto hasZero = [](uint64_t v) { return (v - ONES) & ~v & HIGHS; };
+
+        std::size_t i = 0;
+        for (; i + 8 <= len; i += 8) {
+          uint64_t v;
+          memcpy(&v, s + i, sizeof(v));
+          // bytes below 0x20 (bytes >= 0x80 are fine, UTF-8 passes through)
+          auto dirty = (v - ONES * 0x20) & ~v & HIGHS;
+          dirty |= hasZero(v ^ (ONES * '"')) | hasZero(v ^ (ONES * '\\'));
+          if (!JSON) {
+            dirty |= hasZero(v ^ (ONES * ' ')) | hasZero(v ^ (ONES * '='));
+          }
+          if (dirty) {
+            break;
+          }
+        }
+        for (; i < len; ++i) {
+          auto c = static_cast<unsigned char>(s[i]);
+          if (c < 0x20 || c == '"' || c == '\\' ||
+              (!JSON && (c == ' ' || c == '='))) {
+            break;
+          }
+        }
+        return i;
+      }
+
+      static void appendKey(std::string &out, const char *key) {
+        if (JSON) {
+          out.append(",\"").append(key).append("\":");
+        } else {
+          out.append(" ").append(key).append("=");
+        }
+      }
+
+      template <typename T>
+      static void appendField(std::string &out, const LogField<T> &field) {
+        appendKey(out, field.key);
+        appendValue(out, field.value);
+      }
+
+      static void appendValue(std::string &out, const char *s) {
+        appendString(out, s);
+      }
+
+      static void appendValue(std::string &out, char *s) {
+        appendString(out, s);
+      }
+
+      static void appendValue(std::string &out, const std::string &s) {
+        appendString(out, s.data(), s.size());
+      }
+
+      static void appendValue(std::string &out, std::string_view s) {
+        appendString(out, s.data(), s.size());
+      }
+
+      static void appendValue(std::string &out, bool b) {
+        out.append(b ? "true" : "false");
+      }
+
+      template <typename T>
+      static void appendValue(std::string &out, const T &v) {
+        static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value,
+            "unsupported log field type");
+        char buf[32];
+        if constexpr (std::is_floating_point<T>::value) {
+          if (v != v || v - v != 0) {
+            // nan and inf are not valid JSON numbers
+            out.append(JSON ? "null" : (v != v ? "nan" : v > 0 ? "inf" : "-inf"));
+            return;
+          }
+          out.append(buf, snprintf(buf, sizeof(buf), "%.15g", static_cast<double>(v)));
+        } else if constexpr (std::is_enum<T>::value) {
+          appendValue(out, static_cast<typename std::underlying_type<T>::type>(v));
+        } else {
+          auto res = std::to_chars(buf, buf + sizeof(buf), v);
+          out.append(buf, res.ptr - buf);
+        }
+      }
+
+      static void output([[maybe_unused]] const Site &site,
+          const std::string &line) {
+#if defined(LOG_ASYNC) && !defined(LOG_BINARY)
+        AsyncLogger::instance().write(line.data(), line.size());
+#elif defined(LOG_TO_FILE) && defined(LOG_FILE_PATH) && !defined(LOG_BINARY)
+        LogFileSink::instance().write(line.data(), line.size());
+#elif defined(__ANDROID__)
+        __android_log_write(site.prio(), site.tag(), line.c_str());
+#else
+        // the binary log only holds printf-style records
+        fwrite(line.data(), 1, line.size(), stderr);
+#endif
+      }
+  };
+
+#ifdef LOG_KV_JSON
+  using LogKv = BasicLogKv<LogKvFormat::JSON>;
+#else
+  using LogKv = BasicLogKv<LogKvFormat::LOGFMT>;
+#endif
+} /* end of namespace: nul */
+
+#define DO_LOG_KV_(prio, msg, ...) do { \
+  if (__builtin_expect( \
+        nul::LogLevels::enabled(prio, LOG_TAG_NAME, __FILENAME__), 0)) { \
+    static const nul::LogKv::Site _LogKvSite_( \
+        prio, LOG_TAG_NAME, __FILENAME__, __LINE__, __FUNCTION__); \
+    nul::LogKv::write(_LogKvSite_, msg, ##__VA_ARGS__); \
+  } \
+} while (0)
+
+// same compile-time levels as LOG_V ... LOG_E
+#if defined(LOG_VERBOSE)
+#define LOG_KV_V(msg, ...) DO_LOG_KV_(LOG_LEVEL_VERBOSE, msg, ##__VA_ARGS__)
+#else
+#define LOG_KV_V(msg, ...)
+#endif
+
+#if defined(LOG_DEBUG)
+#define LOG_KV_D(msg, ...) DO_LOG_KV_(LOG_LEVEL_DEBUG, msg, ##__VA_ARGS__)
+#else
+#define LOG_KV_D(msg, ...)
+#endif
+
+#if defined(LOG_INFO)
+#define LOG_KV_I(msg, ...) DO_LOG_KV_(LOG_LEVEL_INFO, msg, ##__VA_ARGS__)
+#else
+#define LOG_KV_I(msg, ...)
+#endif
+
+#if defined(LOG_WARN)
+#define LOG_KV_W(msg, ...) DO_LOG_KV_(LOG_LEVEL_WARN, msg, ##__VA_ARGS__)
+#else
+#define LOG_KV_W(msg, ...)
+#endif
+
+#if defined(LOG_ERROR)
+#define LOG_KV_E(msg, ...) DO_LOG_KV_(LOG_LEVEL_ERROR, msg, ##__VA_ARGS__)
+#else
+#define LOG_KV_E(msg, ...)
+#endif
+
+#endif /* end of include guard: NUL_LOG_KV_H_ */
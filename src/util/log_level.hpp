@@ -0,0 +1,181 @@
+#ifndef NUL_LOG_LEVEL_H_
+#define NUL_LOG_LEVEL_H_
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <climits>
+#include <csignal>
+#include <cstring>
+
+namespace nul {
+
+  /**
+   * runtime log levels for the LOG_* macros, on top of the compile-time
+   * LOG_VERBOSE/LOG_DEBUG/... ceiling: a record is written if its level is
+   * at least the level of its file (__FILENAME__), else of its tag
+   * (LOG_TAG_NAME), else the global one.
+   *
+   * the macros check a single word first, with one relaxed load: the lowest
+   * level in effect anywhere plus a flag telling whether any override
+   * exists, so without overrides a disabled record costs one load and one
+   * compare, its arguments are not evaluated. overrides live in an
+   * immutable map that is replaced (never modified) by the setters.
+   */
+  class LogLevels final {
+    public:
+      // above every level, disables logging
+      static constexpr int OFF = LOG_LEVEL_ERROR + 1;
+
+      static bool enabled(int prio, const char *tag, const char *file) {
+        auto s = state().load(std::memory_order_relaxed);
+        if (prio < (s & LEVEL_MASK)) {
+          return false;
+        }
+        return !(s & HAS_OVERRIDES) || enabledSlow(prio, tag, file);
+      }
+
+      static int level() {
+        return global().load(std::memory_order_relaxed);
+      }
+
+      static void setLevel(int level) {
+        global().store(level, std::memory_order_relaxed);
+        publish();
+      }
+
+      // 'tagOrFile' is matched against LOG_TAG_NAME and __FILENAME__
+      static void setLevel(const std::string &tagOrFile, int level) {
+        auto lock = std::unique_lock<std::mutex>(mutex());
+        auto map = overrides().load(std::memory_order_acquire);
+        auto copy = map ? new Map(*map) : new Map();
+        (*copy)[tagOrFile] = level;
+        replace(copy);
+      }
+
+      static void clearLevel(const std::string &tagOrFile) {
+        auto lock = std::unique_lock<std::mutex>(mutex());
+        auto map = overrides().load(std::memory_order_acquire);
+        if (!map || map->find(tagOrFile) == map->end()) {
+          return;
+        }
+        auto copy = new Map(*map);
+        copy->erase(tagOrFile);
+        replace(copy->empty() ? (delete copy, nullptr) : copy);
+      }
+
+      static void clearLevels() {
+        auto lock = std::unique_lock<std::mutex>(mutex());
+        replace(nullptr);
+      }
+
+      /**
+       * 'moreVerbose' lowers the global level by one, 'lessVerbose' raises it
+       * (up to OFF), the handlers only touch atomics
+       */
+      static void installSignalHandlers(
+        int moreVerbose = SIGUSR1, int lessVerbose = SIGUSR2) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_handler = [](int) { adjust(-1); };
+        sigaction(moreVerbose, &sa, nullptr);
+        sa.sa_handler = [](int) { adjust(1); };
+        sigaction(lessVerbose, &sa, nullptr);
+      }
+
+    private:
+      using Map = std::map<std::string, int, std::less<>>;
+
+      static constexpr int LEVEL_MASK = 0xff;
+      static constexpr int HAS_OVERRIDES = 0x100;
+
+      static std::atomic<int> &state() {
+        static std::atomic<int> s{LOG_DEFAULT_LEVEL};
+        return s;
+      }
+
+      static std::atomic<int> &global() {
+        static std::atomic<int> level{LOG_DEFAULT_LEVEL};
+        return level;
+      }
+
+      // lowest override level, INT_MAX if there is none
+      static std::atomic<int> &overrideFloor() {
+        static std::atomic<int> floor{INT_MAX};
+        return floor;
+      }
+
+      static std::atomic<const Map *> &overrides() {
+        static std::atomic<const Map *> map{nullptr};
+        return map;
+      }
+
+      static std::mutex &mutex() {
+        static std::mutex m;
+        return m;
+      }
+
+      static bool enabledSlow(int prio, const char *tag, const char *file) {
+        auto map = overrides().load(std::memory_order_acquire);
+        if (!map) {
+          return prio >= level();
+        }
+        auto it = map->find(file);
+        if (it == map->end()) {
+          it = map->find(tag);
+        }
+        return prio >= (it != map->end() ? it->second : level());
+      }
+
+      // must be called with mutex() held
+      static void replace(const Map *map) {
+        // readers may still hold the old map, old maps are kept alive, they
+        // are only replaced when someone changes a level by hand
+        static std::vector<std::unique_ptr<const Map>> retired;
+        auto old = overrides().exchange(map, std::memory_order_acq_rel);
+        if (old) {
+          retired.emplace_back(old);
+        }
+
+        auto floor = INT_MAX;
+        if (map) {
+          for (auto &kv : *map) {
+            floor = std::min(floor, kv.second);
+          }
+        }
+        overrideFloor().store(floor, std::memory_order_relaxed);
+        publish();
+      }
+
+      // recomputes state() from the global level and the override floor,
+      // async-signal-safe
+      static void publish() {
+        auto s = state().load(std::memory_order_relaxed);
+        int desired;
+        do {
+          auto floor = overrideFloor().load(std::memory_order_relaxed);
+          auto lowest = std::min(global().load(std::memory_order_relaxed), floor);
+          desired = (std::max(lowest, 0) & LEVEL_MASK) |
+            (floor != INT_MAX ? HAS_OVERRIDES : 0);
+        } while (!state().compare_exchange_weak(
+            s, desired, std::memory_order_release, std::memory_order_relaxed));
+      }
+
+      static void adjust(int delta) {
+        auto level = global().load(std::memory_order_relaxed);
+        int desired;
+        do {
+          desired = std::min(std::max(level + delta, LOG_LEVEL_VERBOSE), OFF);
+        } while (!global().compare_exchange_weak(
+            level, desired, std::memory_order_relaxed));
+        publish();
+      }
+  };
+} /* end of namespace: nul */
+
+#endif /* end of include guard: NUL_LOG_LEVEL_H_ */
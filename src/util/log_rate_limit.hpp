@@ -0,0 +1,95 @@
+#ifndef NUL_LOG_RATE_LIMIT_H_
+#define NUL_LOG_RATE_LIMIT_H_
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+namespace nul {
+
+  /**
+   * per-call-site state of the LOG_*_EVERY_N, LOG_*_EVERY_MS and
+   * LOG_*_RATE_LIMITED macros, one static instance per call site. allow()
+   * is lock-free, when it returns true 'suppressed' is the number of
+   * records dropped since the last one that was let through.
+   */
+
+  // the 1st, (n+1)th, (2n+1)th... records
+  class LogEveryN final {
+    public:
+      bool allow(uint64_t n, uint64_t &suppressed) {
+        auto count = count_.fetch_add(1, std::memory_order_relaxed);
+        if (n > 1 && count % n != 0) {
+          return false;
+        }
+        suppressed = count == 0 || n <= 1 ? 0 : n - 1;
+        return true;
+      }
+
+    private:
+      std::atomic<uint64_t> count_{0};
+  };
+
+  // at most one record every 'millis' milliseconds
+  class LogEveryMs final {
+    public:
+      bool allow(int64_t millis, uint64_t &suppressed) {
+        auto now = nowNanos();
+        auto next = next_.load(std::memory_order_relaxed);
+        if (now < next || !next_.compare_exchange_strong(
+              next, now + millis * 1000000, std::memory_order_relaxed)) {
+          suppressed_.fetch_add(1, std::memory_order_relaxed);
+          return false;
+        }
+        suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+        return true;
+      }
+
+      static int64_t nowNanos() {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+      }
+
+    private:
+      std::atomic<int64_t> next_{0};
+      std::atomic<uint64_t> suppressed_{0};
+  };
+
+  /**
+   * token bucket of 'perSecond' tokens refilled continuously, which is also
+   * its burst size, stored as a single "theoretical arrival time" (GCRA) so
+   * taking a token is one compare-and-swap
+   */
+  class LogRateLimiter final {
+    public:
+      bool allow(uint64_t perSecond, uint64_t &suppressed) {
+        if (perSecond == 0) {
+          suppressed_.fetch_add(1, std::memory_order_relaxed);
+          return false;
+        }
+        auto interval = static_cast<int64_t>(1000000000 / perSecond);
+        auto tolerance = interval * static_cast<int64_t>(perSecond);
+        auto now = LogEveryMs::nowNanos();
+        auto tat = tat_.load(std::memory_order_relaxed);
+        while (true) {
+          auto next = (tat > now ? tat : now) + interval;
+          if (next - now > tolerance) {
+            suppressed_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+          }
+          if (tat_.compare_exchange_weak(
+                tat, next, std::memory_order_relaxed)) {
+            break;
+          }
+        }
+        suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+        return true;
+      }
+
+    private:
+      std::atomic<int64_t> tat_{0};
+      std::atomic<uint64_t> suppressed_{0};
+  };
+} /* end of namespace: nul */
+
+#endif /* end of include guard: NUL_LOG_RATE_LIMIT_H_ */
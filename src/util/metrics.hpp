@@ -0,0 +1,597 @@
+#ifndef NUL_METRICS_H_
+#define NUL_METRICS_H_
+#include "buffer_pool.hpp"
+#include "queue_stats.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <unistd.h>
+
+// shards of counters and histograms, threads are spread round-robin
+#ifndef METRICS_SHARDS
+#define METRICS_SHARDS 8
+#endif
+
+namespace nul {
+namespace metrics {
+
+  using Labels = std::vector<std::pair<std::string, std::string>>;
+
+  enum class Type {
+    COUNTER,
+    GAUGE,
+    HISTOGRAM,
+    SUMMARY,
+  };
+
+  namespace detail {
+    inline std::size_t shardIndex() {
+      static std::atomic<std::size_t> nextThread{0};
+      thread_local std::size_t index =
+        nextThread.fetch_add(1, std::memory_order_relaxed) % METRICS_SHARDS;
+      return index;
+    }
+
+    inline void add(std::atomic<double> &a, double v) {
+      auto cur = a.load(std::memory_order_relaxed);
+      while (!a.compare_exchange_weak(cur, cur + v, std::memory_order_relaxed)) { }
+    }
+  } /* end of namespace: detail */
+
+  // monotonic, every thread adds to its own cache line
+  class Counter final {
+    public:
+      void inc(uint64_t n = 1) {
+        shards_[detail::shardIndex()].value.fetch_add(
+            n, std::memory_order_relaxed);
+      }
+
+      uint64_t value() const {
+        uint64_t v = 0;
+        for (auto &s : shards_) {
+          v += s.value.load(std::memory_order_relaxed);
+        }
+        return v;
+      }
+
+    private:
+      struct alignas(64) Shard {
+        std::atomic<uint64_t> value{0};
+      };
+
+      Shard shards_[METRICS_SHARDS];
+  };
+
+  class Gauge final {
+    public:
+      void set(double v) {
+        value_.store(v, std::memory_order_relaxed);
+      }
+
+      void add(double v) {
+        detail::add(value_, v);
+      }
+
+      double value() const {
+        return value_.load(std::memory_order_relaxed);
+      }
+
+    private:
+      std::atomic<double> value_{0.0};
+  };
+
+  /**
+   * counts observations into fixed buckets given by their upper bounds,
+   * like a Prometheus histogram, an observation above the last bound goes
+   * into the implicit +Inf bucket
+   */
+  class Histogram final {
+    public:
+      struct Snapshot {
+        std::vector<double> bounds;
+        // per bucket, not cumulative, the last one is +Inf
+        std::vector<uint64_t> counts;
+        uint64_t count{0};
+        double sum{0.0};
+      };
+
+      // 'bounds' are sorted
+      explicit Histogram(std::vector<double> bounds) :
+        bounds_(std::move(bounds)) {
+        std::sort(bounds_.begin(), bounds_.end());
+        for (auto &s : shards_) {
+          s.counts.reset(new std::atomic<uint64_t>[bounds_.size() + 1]);
+          for (std::size_t i = 0; i <= bounds_.size(); ++i) {
+            s.counts[i].store(0, std::memory_order_relaxed);
+          }
+        }
+      }
+
+      void observe(double v) {
+        auto i = std::lower_bound(bounds_.begin(), bounds_.end(), v) -
+          bounds_.begin();
+        auto &s = shards_[detail::shardIndex()];
+        s.counts[i].fetch_add(1, std::memory_order_relaxed);
+        detail::add(s.sum, v);
+      }
+
+      const std::vector<double> &bounds() const {
+        return bounds_;
+      }
+
+      Snapshot snapshot() const {
+        Snapshot snap;
+        snap.bounds = bounds_;
+        snap.counts.assign(bounds_.size() + 1, 0);
+        for (auto &s : shards_) {
+          for (std::size_t i = 0; i <= bounds_.size(); ++i) {
+            auto n = s.counts[i].load(std::memory_order_relaxed);
+            snap.counts[i] += n;
+            snap.count += n;
+          }
+          snap.sum += s.sum.load(std::memory_order_relaxed);
+        }
+        return snap;
+      }
+
+    private:
+      struct alignas(64) Shard {
+        std::unique_ptr<std::atomic<uint64_t>[]> counts;
+        std::atomic<double> sum{0.0};
+      };
+
+      std::vector<double> bounds_;
+      Shard shards_[METRICS_SHARDS];
+  };
+
+  // a sample of a family, 'suffix' is e.g. "_bucket", "_sum" or "_count"
+  struct Sample {
+    std::string suffix;
+    Labels labels;
+    double value;
+  };
+
+  struct Family {
+    std::string name;
+    std::string help;
+    Type type;
+    std::vector<Sample> samples;
+
+    void add(const Labels &labels, double value) {
+      samples.push_back(Sample{"", labels, value});
+    }
+
+    void add(const char *suffix, const Labels &labels, double value) {
+      samples.push_back(Sample{suffix, labels, value});
+    }
+  };
+
+  // the values of all metrics at one point, families sorted by name
+  struct Snapshot {
+    std::deque<Family> families;
+
+    // the family 'name', added if there is none yet, references stay valid
+    Family &family(const std::string &name, const std::string &help, Type type) {
+      for (auto &f : families) {
+        if (f.name == name) {
+          return f;
+        }
+      }
+      families.push_back(Family{name, help, type, {}});
+      return families.back();
+    }
+
+    const Family *find(const std::string &name) const {
+      for (auto &f : families) {
+        if (f.name == name) {
+          return &f;
+        }
+      }
+      return nullptr;
+    }
+  };
+
+  /**
+   * counters, gauges and histograms by name and labels, plus collectors that
+   * add samples of state kept elsewhere (addBufferPool(), addQueue(),
+   * addProfileSites() of profiler.hpp with PROFILE_METRICS) when a
+   * snapshot is taken.
+   *
+   * updating a metric never takes a lock, getting one does, so hot paths
+   * keep the reference. text() is the Prometheus text exposition format,
+   * writeFile() and startExporter() replace a file atomically for
+   * node_exporter's textfile collector.
+   */
+  class Registry final {
+    public:
+      using Collector = std::function<void(Snapshot &)>;
+
+      Registry() = default;
+
+      ~Registry() {
+        stopExporter();
+      }
+
+      Registry(const Registry &) = delete;
+      Registry &operator=(const Registry &) = delete;
+
+      static Registry &instance() {
+        // leaked on purpose, metrics may be updated from static destructors
+        static Registry *registry = []() {
+          auto r = new Registry();
+          atexit([]() { instance().stopExporter(); });
+          return r;
+        }();
+        return *registry;
+      }
+
+      /**
+       * the metric 'name' with 'labels', created on first use, nullptr if
+       * the name or a label name is invalid or 'name' has another type
+       */
+      Counter *counter(const std::string &name, const std::string &help,
+          const Labels &labels = {}) {
+        return get<Counter>(name, help, Type::COUNTER, labels,
+            [](Entry &e) { return &e.counters; });
+      }
+
+      Gauge *gauge(const std::string &name, const std::string &help,
+          const Labels &labels = {}) {
+        return get<Gauge>(name, help, Type::GAUGE, labels,
+            [](Entry &e) { return &e.gauges; });
+      }
+
+      // the bounds of an existing histogram are kept
+      Histogram *histogram(const std::string &name, const std::string &help,
+          const std::vector<double> &bounds, const Labels &labels = {}) {
+        return get<Histogram>(name, help, Type::HISTOGRAM, labels,
+            [](Entry &e) { return &e.histograms; }, bounds);
+      }
+
+      // returns an id for removeCollector()
+      uint64_t addCollector(Collector collector) {
+        auto lock = std::unique_lock<std::mutex>(collectMutex_);
+        collectors_.emplace_back(++lastCollectorId_, std::move(collector));
+        return lastCollectorId_;
+      }
+
+      // once it returns, the collector is not running and never runs again
+      void removeCollector(uint64_t id) {
+        auto lock = std::unique_lock<std::mutex>(collectMutex_);
+        collectors_.erase(std::remove_if(collectors_.begin(), collectors_.end(),
+              [id](auto &c) { return c.first == id; }), collectors_.end());
+      }
+
+      Snapshot snapshot() {
+        Snapshot snap;
+        {
+          auto lock = std::unique_lock<std::mutex>(mutex_);
+          for (auto &kv : entries_) {
+            auto &e = kv.second;
+            auto &f = snap.family(kv.first, e.help, e.type);
+            for (auto &c : e.counters) {
+              f.add(c.first, static_cast<double>(c.second->value()));
+            }
+            for (auto &g : e.gauges) {
+              f.add(g.first, g.second->value());
+            }
+            for (auto &h : e.histograms) {
+              addHistogram(f, h.first, h.second->snapshot());
+            }
+          }
+        }
+        {
+          auto lock = std::unique_lock<std::mutex>(collectMutex_);
+          for (auto &c : collectors_) {
+            c.second(snap);
+          }
+        }
+        std::stable_sort(snap.families.begin(), snap.families.end(),
+            [](const Family &a, const Family &b) { return a.name < b.name; });
+        return snap;
+      }
+
+      std::string text() {
+        return format(snapshot());
+      }
+
+      // the Prometheus text exposition format (version 0.0.4)
+      static std::string format(const Snapshot &snap) {
+        std::string out;
+        for (auto &f : snap.families) {
+          if (f.samples.empty()) {
+            continue;
+          }
+          out.append("# HELP ").append(f.name).append(" ");
+          appendEscaped(out, f.help, false);
+          out.append("\n# TYPE ").append(f.name).append(" ")
+            .append(typeName(f.type)).append("\n");
+          for (auto &s : f.samples) {
+            out.append(f.name).append(s.suffix);
+            if (!s.labels.empty()) {
+              out.append("{");
+              for (std::size_t i = 0; i < s.labels.size(); ++i) {
+                out.append(i ? "," : "").append(s.labels[i].first).append("=\"");
+                appendEscaped(out, s.labels[i].second, true);
+                out.append("\"");
+              }
+              out.append("}");
+            }
+            out.append(" ");
+            appendValue(out, s.value);
+            out.append("\n");
+          }
+        }
+        return out;
+      }
+
+      /**
+       * writes text() to a temporary file next to 'path' and renames it, so
+       * readers never see a partial file
+       */
+      bool writeFile(const std::string &path) {
+        auto text = this->text();
+        auto tmp = path + ".tmp." + std::to_string(getpid());
+        auto f = fopen(tmp.c_str(), "w");
+        if (!f) {
+          return false;
+        }
+        auto ok = fwrite(text.data(), 1, text.size(), f) == text.size();
+        ok = fclose(f) == 0 && ok;
+        if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+          unlink(tmp.c_str());
+          return false;
+        }
+        return true;
+      }
+
+      // rewrites 'path' every 'interval' from a background thread
+      void startExporter(const std::string &path,
+          std::chrono::milliseconds interval) {
+        stopExporter();
+        auto lock = std::unique_lock<std::mutex>(exporterMutex_);
+        stopping_ = false;
+        exporter_ = std::thread([this, path, interval]() {
+          auto lock = std::unique_lock<std::mutex>(exporterMutex_);
+          do {
+            lock.unlock();
+            writeFile(path);
+            lock.lock();
+          } while (!cond_.wait_for(lock, interval, [this]() { return stopping_; }));
+        });
+      }
+
+      void stopExporter() {
+        {
+          auto lock = std::unique_lock<std::mutex>(exporterMutex_);
+          stopping_ = true;
+          cond_.notify_all();
+        }
+        if (exporter_.joinable()) {
+          exporter_.join();
+        }
+      }
+
+      static const char *typeName(Type type) {
+        switch (type) {
+          case Type::COUNTER: return "counter";
+          case Type::GAUGE: return "gauge";
+          case Type::HISTOGRAM: return "histogram";
+          case Type::SUMMARY: return "summary";
+        }
+        return "untyped";
+      }
+
+      // the _bucket, _sum and _count samples of a Prometheus histogram
+      static void addHistogram(
+          Family &f, const Labels &labels, const Histogram::Snapshot &h) {
+        uint64_t cumulative = 0;
+        for (std::size_t i = 0; i < h.counts.size(); ++i) {
+          cumulative += h.counts[i];
+          auto withLe = labels;
+          withLe.emplace_back("le",
+              i < h.bounds.size() ? formatValue(h.bounds[i]) : "+Inf");
+          f.add("_bucket", withLe, static_cast<double>(cumulative));
+        }
+        f.add("_sum", labels, h.sum);
+        f.add("_count", labels, static_cast<double>(h.count));
+      }
+
+      /**
+       * the quantile, _sum and _count samples of a Prometheus summary from
+       * a nul::Histogram, values are multiplied by 'scale' (e.g. 1e-9 for
+       * nanoseconds to seconds)
+       */
+      static void addSummary(Family &f, const Labels &labels,
+          const nul::Histogram::Snapshot &h, double scale) {
+        for (auto q : { 0.5, 0.9, 0.99, 0.999 }) {
+          auto withQuantile = labels;
+          withQuantile.emplace_back("quantile", formatValue(q));
+          f.add(withQuantile, h.count ? h.percentile(q * 100) * scale : NAN);
+        }
+        f.add("_sum", labels, h.sum * scale);
+        f.add("_count", labels, static_cast<double>(h.count));
+      }
+
+      static std::string formatValue(double v) {
+        std::string s;
+        appendValue(s, v);
+        return s;
+      }
+
+    private:
+      struct Entry {
+        std::string help;
+        Type type;
+        std::vector<std::pair<Labels, std::unique_ptr<Counter>>> counters;
+        std::vector<std::pair<Labels, std::unique_ptr<Gauge>>> gauges;
+        std::vector<std::pair<Labels, std::unique_ptr<Histogram>>> histograms;
+      };
+
+      template <typename T, typename Select, typename... Args>
+      T *get(const std::string &name, const std::string &help, Type type,
+          const Labels &labels, Select select, const Args &... args) {
+        if (!validName(name, true)) {
+          return nullptr;
+        }
+        for (auto &l : labels) {
+          if (!validName(l.first, false)) {
+            return nullptr;
+          }
+        }
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        auto it = entries_.find(name);
+        if (it == entries_.end()) {
+          it = entries_.emplace(name, Entry{help, type, {}, {}, {}}).first;
+        } else if (it->second.type != type) {
+          return nullptr;
+        }
+        auto metrics = select(it->second);
+        for (auto &m : *metrics) {
+          if (m.first == labels) {
+            return m.second.get();
+          }
+        }
+        metrics->emplace_back(labels, std::make_unique<T>(args...));
+        return metrics->back().second.get();
+      }
+
+      // [a-zA-Z_:][a-zA-Z0-9_:]*, no ':' in label names
+      static bool validName(const std::string &name, bool metric) {
+        if (name.empty() || (name[0] >= '0' && name[0] <= '9')) {
+          return false;
+        }
+        for (auto c : name) {
+          if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                (c >= '0' && c <= '9') || c == '_' || (metric && c == ':'))) {
+            return false;
+          }
+        }
+        return true;
+      }
+
+      // '"' is only escaped in label values
+      static void appendEscaped(
+          std::string &out, const std::string &s, bool quote) {
+        for (auto c : s) {
+          if (c == '\\') {
+            out.append("\\\\");
+          } else if (c == '\n') {
+            out.append("\\n");
+          } else if (c == '"' && quote) {
+            out.append("\\\"");
+          } else {
+            out.push_back(c);
+          }
+        }
+      }
+
+      static void appendValue(std::string &out, double v) {
+        if (std::isnan(v)) {
+          out.append("NaN");
+        } else if (std::isinf(v)) {
+          out.append(v > 0 ? "+Inf" : "-Inf");
+        } else {
+          // the shortest of the two that reads back as 'v'
+          char buf[32];
+          auto n = snprintf(buf, sizeof(buf), "%.15g", v);
+          if (strtod(buf, nullptr) != v) {
+            n = snprintf(buf, sizeof(buf), "%.17g", v);
+          }
+          out.append(buf, n);
+        }
+      }
+
+      std::mutex mutex_;
+      std::map<std::string, Entry> entries_;
+
+      std::mutex collectMutex_;
+      uint64_t lastCollectorId_{0};
+      std::vector<std::pair<uint64_t, Collector>> collectors_;
+
+      bool stopping_{false};
+      std::mutex exporterMutex_;
+      std::condition_variable cond_;
+      std::thread exporter_;
+  };
+
+  /**
+   * samples the counters of 'pool' labelled pool="name", the pool must
+   * outlive the collector, see Registry::removeCollector()
+   */
+  inline uint64_t addBufferPool(
+      Registry &registry, const std::string &name, const BufferPool &pool) {
+    return registry.addCollector([name, &pool](Snapshot &snap) {
+      auto s = pool.stats();
+      Labels labels{{"pool", name}};
+      snap.family("nul_buffer_pool_requests_total",
+          "Buffers requested from the pool", Type::COUNTER)
+        .add(labels, static_cast<double>(s.requests));
+      snap.family("nul_buffer_pool_misses_total",
+          "Requests no free buffer was large enough for", Type::COUNTER)
+        .add(labels, static_cast<double>(s.misses));
+      snap.family("nul_buffer_pool_dropped_total",
+          "Returned buffers that were not kept", Type::COUNTER)
+        .add(labels, static_cast<double>(s.dropped));
+      snap.family("nul_buffer_pool_free_buffers",
+          "Buffers in the pool", Type::GAUGE)
+        .add(labels, static_cast<double>(s.freeBuffers));
+      snap.family("nul_buffer_pool_free_bytes",
+          "Capacity of the buffers in the pool", Type::GAUGE)
+        .add(labels, static_cast<double>(s.freeBytes));
+    });
+  }
+
+  /**
+   * samples the QueueStats of a CircularBuffer (queue.stats()) labelled
+   * queue="name", it must outlive the collector
+   */
+  inline uint64_t addQueue(
+      Registry &registry, const std::string &name, const QueueStats &stats) {
+    return registry.addCollector([name, &stats](Snapshot &snap) {
+      auto s = stats.snapshot();
+      Labels labels{{"queue", name}};
+      snap.family("nul_queue_enqueued_total",
+          "Elements put into the queue", Type::COUNTER)
+        .add(labels, static_cast<double>(s.enqueued));
+      snap.family("nul_queue_dequeued_total",
+          "Elements taken from the queue", Type::COUNTER)
+        .add(labels, static_cast<double>(s.dequeued));
+      snap.family("nul_queue_full_total",
+          "Puts that found the queue full", Type::COUNTER)
+        .add(labels, static_cast<double>(s.fullEvents));
+      snap.family("nul_queue_empty_total",
+          "Takes that found the queue empty", Type::COUNTER)
+        .add(labels, static_cast<double>(s.emptyEvents));
+      snap.family("nul_queue_occupancy",
+          "Elements in the queue", Type::GAUGE)
+        .add(labels, static_cast<double>(s.occupancy));
+      snap.family("nul_queue_peak_occupancy",
+          "Most elements the queue held", Type::GAUGE)
+        .add(labels, static_cast<double>(s.peakOccupancy));
+      Registry::addSummary(snap.family("nul_queue_put_blocked_seconds",
+            "Time a put waited for room", Type::SUMMARY),
+          labels, s.putBlockedNanos, 1e-9);
+      Registry::addSummary(snap.family("nul_queue_take_waited_seconds",
+            "Time a take waited for an element", Type::SUMMARY),
+          labels, s.takeWaitedNanos, 1e-9);
+    });
+  }
+} /* end of namespace: metrics */
+} /* end of namespace: nul */
+
+#endif /* end of include guard: NUL_METRICS_H_ */
@@ -0,0 +1,246 @@
+#ifndef NUL_PERF_COUNTERS_H_
+#define NUL_PERF_COUNTERS_H_
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// events counted per thread
+#ifndef PERF_COUNTERS_MAX_EVENTS
+#define PERF_COUNTERS_MAX_EVENTS 8
+#endif
+
+namespace nul {
+
+  // a perf_event_open(2) event, 'name' must be a string literal
+  struct PerfEvent {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+  };
+
+  /**
+   * hardware counters of the calling thread (cycles, instructions, L1d and
+   * LLC misses, branch misses by default), user space only.
+   *
+   * a thread opens its counters as one group on its first read(), so they
+   * are always scheduled together, and reads them with rdpmc when the kernel
+   * allows it (no syscall), else with one read(2) of the group. events the
+   * kernel refuses (no PMU in a VM, perf_event_paranoid, seccomp) are left
+   * out of the Sample, with none of them a read() costs a branch.
+   */
+  class PerfCounters final {
+    public:
+      static constexpr int MAX_EVENTS = PERF_COUNTERS_MAX_EVENTS;
+
+      struct Sample {
+        uint32_t valid{0}; // bit i is set if values[i] was read
+        uint64_t values[MAX_EVENTS];
+      };
+
+      static std::vector<PerfEvent> defaultEvents() {
+        return {
+          { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+          { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+          { "l1d_misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+            (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+          { "llc_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+          { "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        };
+      }
+
+      /**
+       * replaces the counted events, returns false if there are more than
+       * MAX_EVENTS or a thread has already opened its counters. a group
+       * larger than the PMU's counters (often 4 with hyper-threading) is
+       * never scheduled and reads nothing
+       */
+      static bool setEvents(const std::vector<PerfEvent> &events) {
+        auto &c = config();
+        auto lock = std::unique_lock<std::mutex>(c.mutex);
+        if (c.frozen || events.size() > MAX_EVENTS) {
+          return false;
+        }
+        c.count = static_cast<int>(events.size());
+        std::copy(events.begin(), events.end(), c.events);
+        return true;
+      }
+
+      // of the event at index 'i' of a Sample
+      static const char *name(int i) {
+        return config().events[i].name;
+      }
+
+      static void read(Sample &sample) {
+        threadCounters().read(sample);
+      }
+
+      // whether any event is counted on the calling thread
+      static bool available() {
+        return threadCounters().size_ > 0;
+      }
+
+      // whether the calling thread reads its counters without a syscall
+      static bool usesRdpmc() {
+        return threadCounters().rdpmc_;
+      }
+
+    private:
+      struct Config {
+        std::mutex mutex;
+        bool frozen{false};
+        int count{0};
+        PerfEvent events[MAX_EVENTS];
+
+        Config() {
+          auto events = defaultEvents();
+          count = static_cast<int>(events.size());
+          std::copy(events.begin(), events.end(), this->events);
+        }
+      };
+
+      class ThreadCounters final {
+        public:
+          ThreadCounters() {
+            auto &c = config();
+            auto lock = std::unique_lock<std::mutex>(c.mutex);
+            c.frozen = true;
+            auto pageSize = sysconf(_SC_PAGESIZE);
+            for (int i = 0; i < c.count; ++i) {
+              struct perf_event_attr attr;
+              memset(&attr, 0, sizeof(attr));
+              attr.size = sizeof(attr);
+              attr.type = c.events[i].type;
+              attr.config = c.events[i].config;
+              attr.exclude_kernel = 1;
+              attr.exclude_hv = 1;
+              attr.read_format = PERF_FORMAT_GROUP;
+              // the first event that opens leads the group
+              auto leader = size_ > 0 ? fds_[0] : -1;
+              int fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader,
+                  PERF_FLAG_FD_CLOEXEC);
+              if (fd == -1) {
+                continue;
+              }
+              auto page = mmap(nullptr, pageSize, PROT_READ, MAP_SHARED, fd, 0);
+              fds_[size_] = fd;
+              pages_[size_] = page == MAP_FAILED ? nullptr :
+                static_cast<perf_event_mmap_page *>(page);
+              events_[size_] = i;
+              ++size_;
+            }
+#if defined(__x86_64__) || defined(__i386__)
+            rdpmc_ = size_ > 0;
+            for (int k = 0; k < size_; ++k) {
+              rdpmc_ = rdpmc_ && pages_[k] && pages_[k]->cap_user_rdpmc;
+            }
+#endif
+          }
+
+          ~ThreadCounters() {
+            auto pageSize = sysconf(_SC_PAGESIZE);
+            for (int k = size_ - 1; k >= 0; --k) {
+              if (pages_[k]) {
+                munmap(pages_[k], pageSize);
+              }
+              close(fds_[k]);
+            }
+          }
+
+          void read(Sample &sample) {
+            sample.valid = 0;
+            if (size_ == 0) {
+              return;
+            }
+#if defined(__x86_64__) || defined(__i386__)
+            if (rdpmc_) {
+              auto k = 0;
+              for (; k < size_; ++k) {
+                if (!readPmc(pages_[k], sample.values[events_[k]])) {
+                  break;
+                }
+              }
+              if (k == size_) {
+                sample.valid = mask();
+                return;
+              }
+            }
+#endif
+            // nr, then the values in the order the events joined the group
+            uint64_t buf[1 + MAX_EVENTS];
+            auto n = ::read(fds_[0], buf, sizeof(buf));
+            if (n < static_cast<ssize_t>(sizeof(uint64_t)) ||
+                buf[0] != static_cast<uint64_t>(size_)) {
+              return;
+            }
+            for (int k = 0; k < size_; ++k) {
+              sample.values[events_[k]] = buf[1 + k];
+            }
+            sample.valid = mask();
+          }
+
+          int size_{0};
+          bool rdpmc_{false};
+
+        private:
+          uint32_t mask() const {
+            uint32_t m = 0;
+            for (int k = 0; k < size_; ++k) {
+              m |= 1u << events_[k];
+            }
+            return m;
+          }
+
+#if defined(__x86_64__) || defined(__i386__)
+          // the protocol of perf_event_mmap_page, false if the event is not
+          // on a hardware counter at the moment
+          static bool readPmc(const perf_event_mmap_page *page, uint64_t &value) {
+            auto lock = reinterpret_cast<const volatile uint32_t *>(&page->lock);
+            uint32_t seq;
+            do {
+              seq = *lock;
+              std::atomic_signal_fence(std::memory_order_seq_cst);
+              auto index = page->index;
+              if (!page->cap_user_rdpmc || index == 0) {
+                return false;
+              }
+              auto width = page->pmc_width;
+              // sign extended from the counter width
+              auto pmc = static_cast<int64_t>(
+                  static_cast<uint64_t>(__rdpmc(index - 1)) << (64 - width));
+              value = page->offset + (pmc >> (64 - width));
+              std::atomic_signal_fence(std::memory_order_seq_cst);
+            } while (*lock != seq);
+            return true;
+          }
+#endif
+
+          int fds_[MAX_EVENTS];
+          perf_event_mmap_page *pages_[MAX_EVENTS];
+          int events_[MAX_EVENTS]; // index in the Sample
+      };
+
+      static Config &config() {
+        // leaked on purpose, threads may read their counters at exit
+        static Config *c = new Config();
+        return *c;
+      }
+
+      static ThreadCounters &threadCounters() {
+        thread_local ThreadCounters counters;
+        return counters;
+      }
+  };
+} /* end of namespace: nul */
+
+#endif /* end of include guard: NUL_PERF_COUNTERS_H_ */
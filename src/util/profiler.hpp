@@ -1,11 +1,76 @@
 #ifndef PROFILER_H_
 #define PROFILER_H_
+#include <algorithm>
 #include <chrono>
 #include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
 #include <cinttypes>
+#include <atomic>
 #include <type_traits>
 
 #include "log.hpp"
+#include "histogram.hpp"
+#include "tsc_clock.hpp"
+#include "log_binary.hpp"
+#ifdef PROFILE_METRICS
+#include "metrics.hpp"
+#endif
+#ifdef PROFILE_TRACE
+#include "trace.hpp"
+#endif
+#ifdef PROFILE_PERF_COUNTERS
+#include "perf_counters.hpp"
+#endif
+#ifdef PROFILE_ALLOCS
+#include "alloc_tracker.hpp"
+#endif
+
+// shards of the per-call-site histograms of PROFILE_AGGREGATE
+#ifndef PROFILE_SHARDS
+#define PROFILE_SHARDS 8
+#endif
+
+// bytes a Profiler keeps its arguments in, larger ones are formatted early
+#ifndef PROFILE_ARGS_SIZE
+#define PROFILE_ARGS_SIZE 128
+#endif
+
+// the clock of the PROFILE_TIME_COST* macros, define PROFILE_USE_TSC for
+// nul::TscClock, the clock is part of the Profiler type, so translation
+// units built with different clocks can be linked together
+#ifndef PROFILE_CLOCK
+#ifdef PROFILE_USE_TSC
+#define PROFILE_CLOCK nul::TscClock
+#else
+#define PROFILE_CLOCK std::chrono::high_resolution_clock
+#endif
+#endif
+
+// the counters read around PROFILE_TIME_COST* scopes, define
+// PROFILE_PERF_COUNTERS for nul::PerfCounters and/or PROFILE_ALLOCS for
+// nul::AllocTracker, part of the Profiler type like the clock
+#ifndef PROFILE_COUNTERS
+#if defined(PROFILE_PERF_COUNTERS) && defined(PROFILE_ALLOCS)
+#define PROFILE_COUNTERS \
+    nul::JoinedProfileCounters<nul::PerfCounters, nul::AllocTracker>
+#elif defined(PROFILE_PERF_COUNTERS)
+#define PROFILE_COUNTERS nul::PerfCounters
+#elif defined(PROFILE_ALLOCS)
+#define PROFILE_COUNTERS nul::AllocTracker
+#else
+#define PROFILE_COUNTERS nul::NoProfileCounters
+#endif
+#endif
+
+// counters a ProfileSite keeps totals of
+#ifndef PROFILE_MAX_COUNTERS
+#define PROFILE_MAX_COUNTERS 16
+#endif
 
 #ifndef LOG_TAG_NAME
 #define LOG_TAG_NAME ""
@@ -24,47 +89,174 @@ namespace nul {
   };
 
   template <typename TimeUnit>
+  const char *time_unit_name() {
+    using namespace std::chrono;
+    return
+      (std::is_same<TimeUnit, milliseconds>::value ? "ms" :
+      (std::is_same<TimeUnit, microseconds>::value ? "us" :
+      (std::is_same<TimeUnit, nanoseconds>::value  ? "ns" :
+      (std::is_same<TimeUnit, seconds>::value      ? "s"  :
+      (std::is_same<TimeUnit, minutes>::value      ? "m"  :
+      (std::is_same<TimeUnit, hours>::value        ? "h"  : ""))))));
+  }
+
+  /**
+   * the counters policy of Profiler and AggregatingProfiler, counts
+   * nothing. a policy has MAX_EVENTS, a Sample with a 'valid' bit mask and
+   * 'values', read(Sample &) and name(i), see PerfCounters
+   */
+  struct NoProfileCounters {
+    static constexpr int MAX_EVENTS = 0;
+
+    struct Sample {
+    };
+
+    static void read(Sample &) {
+    }
+  };
+
+  // the counters of policy A followed by those of B
+  template <typename A, typename B>
+  struct JoinedProfileCounters {
+    static constexpr int MAX_EVENTS = A::MAX_EVENTS + B::MAX_EVENTS;
+    static_assert(MAX_EVENTS <= 32, "too many counters");
+
+    struct Sample {
+      uint32_t valid{0};
+      uint64_t values[MAX_EVENTS];
+    };
+
+    static void read(Sample &sample) {
+      typename A::Sample a;
+      typename B::Sample b;
+      A::read(a);
+      B::read(b);
+      std::copy(a.values, a.values + A::MAX_EVENTS, sample.values);
+      std::copy(b.values, b.values + B::MAX_EVENTS,
+          sample.values + A::MAX_EVENTS);
+      sample.valid = a.valid | (b.valid << A::MAX_EVENTS);
+    }
+
+    static const char *name(int i) {
+      return i < A::MAX_EVENTS ? A::name(i) : B::name(i - A::MAX_EVENTS);
+    }
+  };
+
+  // calls f(index, name, delta) for every counter read at both ends
+  template <typename Counters, typename F>
+  void profile_counter_deltas(
+      const typename Counters::Sample &begin,
+      const typename Counters::Sample &end, F &&f) {
+    if constexpr (Counters::MAX_EVENTS > 0) {
+      auto valid = begin.valid & end.valid;
+      for (int i = 0; i < Counters::MAX_EVENTS; ++i) {
+        if (valid & (1u << i)) {
+          f(i, Counters::name(i), end.values[i] - begin.values[i]);
+        }
+      }
+    }
+  }
+
+  // the threshold of PROFILE_SLOW_SCOPE, integers are microseconds
+  template <typename Rep, typename Period>
+  inline std::chrono::duration<Rep, Period> profile_threshold(
+      std::chrono::duration<Rep, Period> threshold) {
+    return threshold;
+  }
+
+  template <typename T, typename = typename std::enable_if<
+    std::is_integral<T>::value>::type>
+  inline std::chrono::microseconds profile_threshold(T micros) {
+    return std::chrono::microseconds(micros);
+  }
+
+  // never called, lets the compiler check the format of PROFILE_* macros
+  inline void profile_check_format(const char *, ...)
+    __attribute__((format(printf, 1, 2)));
+
+  /**
+   * prints the time spent in its scope when it is destroyed, or only if it
+   * is at least 'threshold'.
+   *
+   * the message is only formatted when it is printed, until then the
+   * arguments are kept in inline storage in BinaryLogArgs encoding (strings
+   * are copied, so temporaries are fine), nothing is allocated unless they
+   * do not fit in PROFILE_ARGS_SIZE bytes.
+   *
+   * with a Counters policy such as PerfCounters, the counter deltas of the
+   * scope are printed after the time
+   */
+  template <typename TimeUnit,
+           typename Clock = std::chrono::high_resolution_clock,
+           typename Counters = NoProfileCounters>
   class Profiler {
     static_assert(is_valid_time_unit<TimeUnit>::value, "Invalid TimeUnit");
 
     public:
+    template <typename... Args>
     Profiler(
         const char *filename, const char *function_name,
-        int line_num, const char *fmt, ...) :
+        int line_num, const char *fmt, const Args &... args) :
+      Profiler(filename, function_name, line_num, TimeUnit::zero(),
+          fmt, args...) {
+    }
+
+    template <typename Rep, typename Period, typename... Args>
+    Profiler(
+        const char *filename, const char *function_name,
+        int line_num, std::chrono::duration<Rep, Period> threshold,
+        const char *fmt, const Args &... args) :
       filename_(filename),
       function_name_(function_name),
+      fmt_(fmt),
       line_num_(line_num),
-      begin_time_(std::chrono::high_resolution_clock::now()) {
+      threshold_(std::chrono::duration_cast<typename Clock::duration>(
+            threshold)) {
 
-      va_list args;
-      va_start (args, fmt);
-      char buf[512];
-      vsnprintf(buf, 512, fmt, args);
-      va_end (args);
-
-      msg_.append(buf);
+      auto len = BinaryLogArgs::size(args...);
+      if (len <= sizeof(args_)) {
+        BinaryLogArgs::encode(args_, args...);
+        args_len_ = len;
+      } else {
+        char buf[512];
+        snprintf(buf, sizeof(buf), fmt, args...);
+        msg_.append(buf);
+        args_len_ = -1;
+      }
+      Counters::read(begin_counters_);
+      begin_time_ = Clock::now();
     }
 
     ~Profiler() {
       using namespace std::chrono;
 
-      auto duration = duration_cast<TimeUnit>(
-          high_resolution_clock::now() - begin_time_).count();
-      const char *unit_str = 
-        (std::is_same<TimeUnit, milliseconds>::value ? "ms" :
-        (std::is_same<TimeUnit, microseconds>::value ? "us" :
-        (std::is_same<TimeUnit, nanoseconds>::value  ? "ns" :
-        (std::is_same<TimeUnit, seconds>::value      ? "s"  :
-        (std::is_same<TimeUnit, minutes>::value      ? "m"  :
-        (std::is_same<TimeUnit, hours>::value        ? "h"  : ""))))));
+      auto elapsed = Clock::now() - begin_time_;
+      typename Counters::Sample end_counters;
+      Counters::read(end_counters);
+      if (elapsed < threshold_) {
+        return;
+      }
+      if (args_len_ >= 0) {
+        msg_ = BinaryLogArgs::format(fmt_, args_, args_len_);
+      }
+      std::string counters;
+      profile_counter_deltas<Counters>(begin_counters_, end_counters,
+          [&](int, const char *name, uint64_t delta) {
+            counters.append(", ").append(name).append(": ")
+              .append(std::to_string(delta));
+          });
+      auto duration = static_cast<long long>(
+          duration_cast<TimeUnit>(elapsed).count());
+      const char *unit_str = time_unit_name<TimeUnit>();
 #ifdef __ANDROID__
-      __android_log_print(ANDROID_LOG_INFO, LOG_TAG_NAME, "[%s:%d] %s - %s, time_cost: %lli %s\n",
-          filename_, line_num_, function_name_, msg_.c_str(), duration, unit_str);
+      __android_log_print(ANDROID_LOG_INFO, LOG_TAG_NAME, "[%s:%d] %s - %s, time_cost: %lli %s%s\n",
+          filename_, line_num_, function_name_, msg_.c_str(), duration, unit_str,
+          counters.c_str());
 #else
       char buf[TIME_BUFFER_SIZE];
-      fprintf(stderr, KBLU "%s %s [I] [%s#%d] %s - %s, time_cost: " KEND KYEL "%lli" KEND KBLU " %s\n" KEND,
+      fprintf(stderr, KBLU "%s %s [I] [%s#%d] %s - %s, time_cost: " KEND KYEL "%lli" KEND KBLU " %s%s\n" KEND,
           log_strtime(buf), LOG_TAG_NAME, filename_, line_num_,
-          function_name_, msg_.c_str(), duration, unit_str);
+          function_name_, msg_.c_str(), duration, unit_str, counters.c_str());
 #endif
     }
 
@@ -72,8 +264,13 @@ namespace nul {
     std::string msg_;
     const char *filename_{nullptr}; // must be string literal
     const char *function_name_{nullptr}; // must be string literal
+    const char *fmt_{nullptr}; // must be string literal
     int line_num_{0};
-    std::chrono::high_resolution_clock::time_point begin_time_;
+    int args_len_{0}; // -1 if formatted into msg_
+    typename Clock::duration threshold_;
+    typename Clock::time_point begin_time_;
+    typename Counters::Sample begin_counters_;
+    char args_[PROFILE_ARGS_SIZE];
   };
 
   using TimeCostCalcMsec = Profiler<std::chrono::milliseconds>;
@@ -82,19 +279,318 @@ namespace nul {
   using TimeCostCalcHour = Profiler<std::chrono::hours>;
   using TimeCostCalcMinute = Profiler<std::chrono::minutes>;
   using TimeCostCalcSec = Profiler<std::chrono::seconds>;
+
+  /**
+   * a call site of PROFILE_TIME_COST* in aggregating mode, durations are
+   * recorded in nanoseconds into a thread-sharded histogram and reported
+   * in the unit of the call site, counter deltas are summed up and
+   * reported per call
+   */
+  class ProfileSite final {
+    public:
+    ProfileSite(
+        const char *filename, const char *function_name, int line_num,
+        const char *label, const char *unit, uint64_t nanos_per_unit) :
+      filename_(filename),
+      function_name_(function_name),
+      label_(label),
+      unit_(unit),
+      line_num_(line_num),
+      nanos_per_unit_(nanos_per_unit) {
+    }
+
+    void record(uint64_t nanos) {
+      histogram_.record(nanos);
+    }
+
+    Histogram::Snapshot snapshot() const {
+      return histogram_.snapshot();
+    }
+
+    void reset() {
+      histogram_.reset();
+      for (auto &c : counters_) {
+        c.total.store(0, std::memory_order_relaxed);
+        c.calls.store(0, std::memory_order_relaxed);
+      }
+    }
+
+    // 'name' must be a string literal
+    void record_counter(int i, const char *name, uint64_t delta) {
+      if (i >= PROFILE_MAX_COUNTERS) {
+        return;
+      }
+      auto &c = counters_[i];
+      c.name.store(name, std::memory_order_relaxed);
+      c.total.fetch_add(delta, std::memory_order_relaxed);
+      c.calls.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // the mean delta of counter 'i' per call, false if it was not recorded
+    bool counter(int i, const char *&name, double &mean) const {
+      auto &c = counters_[i];
+      auto calls = c.calls.load(std::memory_order_relaxed);
+      if (calls == 0) {
+        return false;
+      }
+      name = c.name.load(std::memory_order_relaxed);
+      mean = static_cast<double>(
+          c.total.load(std::memory_order_relaxed)) / calls;
+      return true;
+    }
+
+    const char *filename() const { return filename_; }
+    const char *function_name() const { return function_name_; }
+    const char *label() const { return label_; }
+    const char *unit() const { return unit_; }
+    int line_num() const { return line_num_; }
+    uint64_t nanos_per_unit() const { return nanos_per_unit_; }
+
+  private:
+    const char *filename_; // must be string literal
+    const char *function_name_; // must be string literal
+    const char *label_; // must be string literal
+    const char *unit_;
+    int line_num_;
+    uint64_t nanos_per_unit_;
+    ShardedHistogram<PROFILE_SHARDS> histogram_;
+
+    struct Counter {
+      std::atomic<const char *> name{nullptr};
+      std::atomic<uint64_t> total{0};
+      std::atomic<uint64_t> calls{0};
+    };
+    Counter counters_[PROFILE_MAX_COUNTERS];
+  };
+
+  /**
+   * all ProfileSites, report() prints one line per call site with its count
+   * and latency percentiles, startReporter() does it periodically from a
+   * background thread
+   */
+  class ProfileRegistry final {
+    public:
+    static ProfileRegistry &instance() {
+      // leaked on purpose, sites may be recorded from static destructors
+      static ProfileRegistry *registry = []() {
+        auto r = new ProfileRegistry();
+        atexit([]() { instance().stopReporter(); });
+        return r;
+      }();
+      return *registry;
+    }
+
+    template <typename TimeUnit>
+    ProfileSite &site(
+        const char *filename, const char *function_name, int line_num,
+        const char *label) {
+      using namespace std::chrono;
+      auto site = new ProfileSite(filename, function_name, line_num, label,
+          time_unit_name<TimeUnit>(),
+          duration_cast<nanoseconds>(TimeUnit(1)).count());
+      auto lock = std::unique_lock<std::mutex>(mutex_);
+      sites_.push_back(site);
+      return *site;
+    }
+
+    std::vector<ProfileSite *> sites() {
+      auto lock = std::unique_lock<std::mutex>(mutex_);
+      return sites_;
+    }
+
+    // 'reset' starts a new interval for every site
+    void report(FILE *out = stderr, bool reset = false) {
+      char time_buf[TIME_BUFFER_SIZE];
+      log_strtime(time_buf);
+      for (auto site : sites()) {
+        auto s = site->snapshot();
+        std::string counters;
+        for (int i = 0; i < PROFILE_MAX_COUNTERS; ++i) {
+          const char *name;
+          double mean;
+          if (site->counter(i, name, mean)) {
+            char buf[64];
+            snprintf(buf, sizeof(buf), ": %.1f", mean);
+            counters.append(", ").append(name).append(buf);
+          }
+        }
+        if (reset) {
+          site->reset();
+        }
+        if (s.count == 0) {
+          continue;
+        }
+        double unit = site->nanos_per_unit();
+        fprintf(out, "%s %s [I] [%s#%d] %s - %s, count: %" PRIu64
+            ", min: %.3f, mean: %.3f, p50: %.3f, p90: %.3f, p99: %.3f"
+            ", p99.9: %.3f, max: %.3f %s%s\n",
+            time_buf, LOG_TAG_NAME, site->filename(), site->line_num(),
+            site->function_name(), site->label(), s.count,
+            s.min / unit, s.mean() / unit, s.percentile(50) / unit,
+            s.percentile(90) / unit, s.percentile(99) / unit,
+            s.percentile(99.9) / unit, s.max / unit, site->unit(),
+            counters.c_str());
+      }
+      fflush(out);
+    }
+
+    void startReporter(
+        std::chrono::milliseconds interval, bool reset = false,
+        FILE *out = stderr) {
+      stopReporter();
+      auto lock = std::unique_lock<std::mutex>(mutex_);
+      stopping_ = false;
+      reporter_ = std::thread([this, interval, reset, out]() {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        while (!cond_.wait_for(lock, interval, [this]() { return stopping_; })) {
+          lock.unlock();
+          report(out, reset);
+          lock.lock();
+        }
+      });
+    }
+
+    void stopReporter() {
+      {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        stopping_ = true;
+        cond_.notify_all();
+      }
+      if (reporter_.joinable()) {
+        reporter_.join();
+      }
+    }
+
+  private:
+    ProfileRegistry() = default;
+
+    std::vector<ProfileSite *> sites_;
+    bool stopping_{false};
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::thread reporter_;
+  };
+
+#ifdef PROFILE_METRICS
+namespace metrics {
+  /**
+   * samples the call sites of PROFILE_AGGREGATE as a summary in seconds
+   * and their counters per call, labelled by call site, only defined with
+   * PROFILE_METRICS so other users of the profiler do not pull in metrics
+   */
+  inline uint64_t addProfileSites(Registry &registry,
+      ProfileRegistry &profiles = ProfileRegistry::instance()) {
+    return registry.addCollector([&profiles](Snapshot &snap) {
+      auto &seconds = snap.family("nul_profile_seconds",
+          "Time spent in profiled scopes", Type::SUMMARY);
+      auto &counters = snap.family("nul_profile_counter_per_call",
+          "Mean counter delta of profiled scopes", Type::GAUGE);
+      for (auto site : profiles.sites()) {
+        Labels labels{
+          {"file", site->filename()},
+          {"line", std::to_string(site->line_num())},
+          {"function", site->function_name()},
+          {"label", site->label()},
+        };
+        Registry::addSummary(seconds, labels, site->snapshot(), 1e-9);
+        for (int i = 0; i < PROFILE_MAX_COUNTERS; ++i) {
+          const char *name;
+          double mean;
+          if (site->counter(i, name, mean)) {
+            auto withEvent = labels;
+            withEvent.emplace_back("event", name);
+            counters.add(withEvent, mean);
+          }
+        }
+      }
+    });
+  }
+} /* end of namespace: metrics */
+#endif
+
+  // the scope object of PROFILE_TIME_COST* in aggregating mode
+  template <typename Clock = std::chrono::high_resolution_clock,
+           typename Counters = NoProfileCounters>
+  class AggregatingProfiler final {
+    static_assert(Counters::MAX_EVENTS <= PROFILE_MAX_COUNTERS,
+        "more counters than PROFILE_MAX_COUNTERS");
+
+    public:
+    explicit AggregatingProfiler(ProfileSite &site) :
+      site_(site) {
+      Counters::read(begin_counters_);
+      begin_time_ = Clock::now();
+    }
+
+    ~AggregatingProfiler() {
+      using namespace std::chrono;
+      auto elapsed = Clock::now() - begin_time_;
+      typename Counters::Sample end_counters;
+      Counters::read(end_counters);
+      site_.record(duration_cast<nanoseconds>(elapsed).count());
+      profile_counter_deltas<Counters>(begin_counters_, end_counters,
+          [this](int i, const char *name, uint64_t delta) {
+            site_.record_counter(i, name, delta);
+          });
+    }
+
+  private:
+    ProfileSite &site_;
+    typename Clock::time_point begin_time_;
+    typename Counters::Sample begin_counters_;
+  };
 } /* end of namespace: nul */
 
 #define EXPAND_(a, b) a ## b
 #define COMBINE_(a, b) EXPAND_(a, b)
 
-#ifdef ENABLE_PROFILING
+/**
+ * with PROFILE_AGGREGATE, a scope only records its duration into the
+ * histogram of its call site instead of printing a line, 'fmt' is used as
+ * is as the label of the call site, its arguments are not evaluated, see
+ * nul::ProfileRegistry for reporting
+ *
+ * with PROFILE_TRACE, a scope is recorded as a trace event named 'fmt',
+ * again without its arguments, see nul::Tracer
+ */
+#if defined(ENABLE_PROFILING) && defined(PROFILE_TRACE)
 #define PROFILE_TIME_COST(time_unit, fmt, ...)\
-    nul::Profiler<time_unit> \
+    nul::TraceScope COMBINE_(__t, __LINE__) (fmt, LOG_TAG_NAME)
+#elif defined(ENABLE_PROFILING) && defined(PROFILE_AGGREGATE)
+#define PROFILE_TIME_COST(time_unit, fmt, ...)\
+    static nul::ProfileSite &COMBINE_(__site, __LINE__) = \
+    nul::ProfileRegistry::instance().site<time_unit>( \
+        __FILENAME__, __FUNCTION__, __LINE__, fmt); \
+    nul::AggregatingProfiler<PROFILE_CLOCK, PROFILE_COUNTERS> \
+    COMBINE_(__t, __LINE__) (COMBINE_(__site, __LINE__))
+#elif defined(ENABLE_PROFILING)
+#define PROFILE_TIME_COST(time_unit, fmt, ...)\
+    (void)sizeof(nul::profile_check_format(fmt, ##__VA_ARGS__), 0); \
+    nul::Profiler<time_unit, PROFILE_CLOCK, PROFILE_COUNTERS> \
     COMBINE_(__t, __LINE__) (__FILENAME__, __FUNCTION__, __LINE__, fmt, ##__VA_ARGS__)
 #else
 #define PROFILE_TIME_COST(time_unit, fmt, ...)
 #endif
 
+/**
+ * prints only if the scope takes at least 'threshold', a std::chrono
+ * duration or an integer number of microseconds, chrono literals can be
+ * used, e.g. PROFILE_SLOW_SCOPE(5ms, "id=%d", id), and so can locals and
+ * members. a scope below the threshold costs two clock reads and the copy
+ * of its arguments
+ */
+#ifdef ENABLE_PROFILING
+#define PROFILE_SLOW_SCOPE(threshold, fmt, ...)\
+    (void)sizeof(nul::profile_check_format(fmt, ##__VA_ARGS__), 0); \
+    nul::Profiler<std::chrono::microseconds, PROFILE_CLOCK, PROFILE_COUNTERS> \
+    COMBINE_(__t, __LINE__) (__FILENAME__, __FUNCTION__, __LINE__, \
+        nul::profile_threshold([&]() { \
+          using namespace std::chrono_literals; return threshold; }()), \
+        fmt, ##__VA_ARGS__)
+#else
+#define PROFILE_SLOW_SCOPE(threshold, fmt, ...)
+#endif
+
 #define PROFILE_TIME_COST_USEC(fmt, ...)\
     PROFILE_TIME_COST(std::chrono::microseconds, fmt, ##__VA_ARGS__)
 
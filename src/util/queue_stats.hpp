@@ -0,0 +1,112 @@
+#ifndef NUL_QUEUE_STATS_H_
+#define NUL_QUEUE_STATS_H_
+#include "histogram.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace nul {
+
+  /**
+   * the default Stats policy of CircularBuffer, every hook is an empty
+   * inline function and ENABLED is false, so the clock reads around
+   * blocking waits are compiled out as well
+   */
+  struct NoQueueStats {
+    static constexpr bool ENABLED = false;
+
+    void onPut(std::size_t) { }
+    void onTake(std::size_t) { }
+    void onFull() { }
+    void onEmpty() { }
+    void onPutBlocked(uint64_t) { }
+    void onTakeWaited(uint64_t) { }
+  };
+
+  /**
+   * opt-in CircularBuffer instrumentation, e.g.
+   *
+   *   CircularBuffer<Msg, 1024, QueueStats> q;
+   *   auto s = q.stats().snapshot();
+   *
+   * hooks are called with the queue lock held, but everything is stored in
+   * relaxed atomics so snapshot() and occupancy() never take the queue lock.
+   * blocked/waited times are in nanoseconds.
+   */
+  class QueueStats final {
+    public:
+      static constexpr bool ENABLED = true;
+
+      struct Snapshot {
+        uint64_t enqueued{0};
+        uint64_t dequeued{0};
+        // put() found the queue full
+        uint64_t fullEvents{0};
+        // take() or takeOrDefault() found the queue empty
+        uint64_t emptyEvents{0};
+        uint64_t occupancy{0};
+        uint64_t peakOccupancy{0};
+        Histogram::Snapshot putBlockedNanos;
+        Histogram::Snapshot takeWaitedNanos;
+      };
+
+      void onPut(std::size_t sizeAfter) {
+        enqueued_.fetch_add(1, std::memory_order_relaxed);
+        occupancy_.store(sizeAfter, std::memory_order_relaxed);
+        if (sizeAfter > peakOccupancy_.load(std::memory_order_relaxed)) {
+          peakOccupancy_.store(sizeAfter, std::memory_order_relaxed);
+        }
+      }
+
+      void onTake(std::size_t sizeAfter) {
+        dequeued_.fetch_add(1, std::memory_order_relaxed);
+        occupancy_.store(sizeAfter, std::memory_order_relaxed);
+      }
+
+      void onFull() {
+        fullEvents_.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      void onEmpty() {
+        emptyEvents_.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      void onPutBlocked(uint64_t nanos) {
+        putBlockedNanos_.record(nanos);
+      }
+
+      void onTakeWaited(uint64_t nanos) {
+        takeWaitedNanos_.record(nanos);
+      }
+
+      // lock-free alternative to CircularBuffer::size()
+      std::size_t occupancy() const {
+        return occupancy_.load(std::memory_order_relaxed);
+      }
+
+      Snapshot snapshot() const {
+        Snapshot s;
+        s.enqueued = enqueued_.load(std::memory_order_relaxed);
+        s.dequeued = dequeued_.load(std::memory_order_relaxed);
+        s.fullEvents = fullEvents_.load(std::memory_order_relaxed);
+        s.emptyEvents = emptyEvents_.load(std::memory_order_relaxed);
+        s.occupancy = occupancy_.load(std::memory_order_relaxed);
+        s.peakOccupancy = peakOccupancy_.load(std::memory_order_relaxed);
+        s.putBlockedNanos = putBlockedNanos_.snapshot();
+        s.takeWaitedNanos = takeWaitedNanos_.snapshot();
+        return s;
+      }
+
+    private:
+      std::atomic<uint64_t> enqueued_{0};
+      std::atomic<uint64_t> dequeued_{0};
+      std::atomic<uint64_t> fullEvents_{0};
+      std::atomic<uint64_t> emptyEvents_{0};
+      std::atomic<std::size_t> occupancy_{0};
+      std::atomic<std::size_t> peakOccupancy_{0};
+      Histogram putBlockedNanos_;
+      Histogram takeWaitedNanos_;
+  };
+} /* end of namespace: nul */
+
+#endif /* end of include guard: NUL_QUEUE_STATS_H_ */
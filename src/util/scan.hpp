@@ -0,0 +1,211 @@
+#ifndef NUL_SCAN_H_
+#define NUL_SCAN_H_
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+#if (defined(__x86_64__) || defined(__i386__)) && \
+  (defined(__GNUC__) || defined(__clang__)) && !defined(NUL_SCAN_NO_SIMD)
+#include <immintrin.h>
+#define NUL_SCAN_X86_ 1
+#endif
+
+namespace nul {
+
+  /**
+   * a set of bytes to scan for, built at compile time, e.g.
+   *
+   *   static constexpr ByteSet DELIMITERS{":/?"};
+   *
+   * besides the bitmap it keeps the layouts the SIMD scanners load: the
+   * bytes themselves for pcmpestri (up to 16 of them) and the nibble
+   * tables of the shuffle lookup (ASCII bytes only).
+   */
+  class ByteSet final {
+    public:
+      constexpr ByteSet() = default;
+
+      constexpr explicit ByteSet(const char *chars) {
+        for (; *chars != '\0'; ++chars) {
+          add(static_cast<unsigned char>(*chars));
+        }
+      }
+
+      constexpr bool contains(unsigned char c) const {
+        return (bits_[c >> 6] >> (c & 63)) & 1;
+      }
+
+      constexpr int size() const {
+        return size_;
+      }
+
+    private:
+      friend class Scan;
+
+      constexpr void add(unsigned char c) {
+        if (contains(c)) {
+          return;
+        }
+        bits_[c >> 6] |= uint64_t{1} << (c & 63);
+        if (size_ < 16) {
+          chars_[size_] = static_cast<char>(c);
+        }
+        ++size_;
+        if (c < 0x80) {
+          // a byte matches if the bits of its two nibbles intersect
+          lo_[c & 0x0f] |= static_cast<uint8_t>(1u << (c >> 4));
+          hi_[c >> 4] = static_cast<uint8_t>(1u << (c >> 4));
+        } else {
+          ascii_ = false;
+        }
+      }
+
+      uint64_t bits_[4]{};
+      char chars_[16]{};
+      uint8_t lo_[16]{};
+      uint8_t hi_[16]{};
+      int size_{0};
+      bool ascii_{true};
+  };
+
+  /**
+   * finds the first byte of a ByteSet in a string: 32 bytes per step with
+   * AVX2 (a shuffle-based nibble lookup), 16 with SSE4.2 (pcmpestri), one
+   * otherwise. the instruction set is picked once at runtime, the SIMD
+   * code is compiled with target attributes so no -m flags are needed,
+   * NUL_SCAN_NO_SIMD builds the scalar loop only.
+   */
+  class Scan final {
+    public:
+      static constexpr std::size_t npos = std::string_view::npos;
+
+      enum class Impl {
+        SCALAR,
+        SSE42,
+        AVX2,
+      };
+
+      // the position of the first byte of 'set' at or after 'pos', or npos
+      static std::size_t findFirstOf(
+        std::string_view s, const ByteSet &set, std::size_t pos = 0) {
+        return findFirstOf(impl(), s, set, pos);
+      }
+
+      static std::size_t findFirstOf(
+        Impl impl, std::string_view s, const ByteSet &set, std::size_t pos) {
+        if (pos >= s.size()) {
+          return npos;
+        }
+        auto p = s.data() + pos;
+        auto n = s.size() - pos;
+        std::size_t i;
+#ifdef NUL_SCAN_X86_
+        if (impl == Impl::AVX2 && set.ascii_) {
+          i = findAvx2(p, n, set);
+        } else if (impl != Impl::SCALAR && set.size_ <= 16) {
+          i = findSse42(p, n, set);
+        } else {
+          i = findScalar(p, n, set, 0);
+        }
+#else
+        i = findScalar(p, n, set, 0);
+#endif
+        return i == n ? npos : pos + i;
+      }
+
+      // the position of the first 'c' at or after 'pos', or npos
+      static std::size_t find(std::string_view s, char c, std::size_t pos = 0) {
+        if (pos >= s.size()) {
+          return npos;
+        }
+        // glibc's memchr is vectorized already
+        auto p = static_cast<const char *>(
+          memchr(s.data() + pos, c, s.size() - pos));
+        return p ? static_cast<std::size_t>(p - s.data()) : npos;
+      }
+
+      // the fastest one the CPU supports
+      static Impl impl() {
+        static const Impl best = detect();
+        return best;
+      }
+
+      static bool supports(Impl impl) {
+        return static_cast<int>(impl) <= static_cast<int>(Scan::impl());
+      }
+
+    private:
+      static Impl detect() {
+#ifdef NUL_SCAN_X86_
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+          return Impl::AVX2;
+        }
+        if (__builtin_cpu_supports("sse4.2")) {
+          return Impl::SSE42;
+        }
+#endif
+        return Impl::SCALAR;
+      }
+
+      static std::size_t findScalar(
+        const char *p, std::size_t n, const ByteSet &set, std::size_t i) {
+        for (; i < n; ++i) {
+          if (set.contains(static_cast<unsigned char>(p[i]))) {
+            return i;
+          }
+        }
+        return n;
+      }
+
+#ifdef NUL_SCAN_X86_
+      __attribute__((target("sse4.2")))
+      static std::size_t findSse42(
+        const char *p, std::size_t n, const ByteSet &set) {
+        constexpr int MODE = _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY |
+          _SIDD_LEAST_SIGNIFICANT;
+        auto chars = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(set.chars_));
+        std::size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+          auto block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+          auto k = _mm_cmpestri(chars, set.size_, block, 16, MODE);
+          if (k < 16) {
+            return i + k;
+          }
+        }
+        return findScalar(p, n, set, i);
+      }
+
+      __attribute__((target("avx2")))
+      static std::size_t findAvx2(
+        const char *p, std::size_t n, const ByteSet &set) {
+        auto lo = _mm256_broadcastsi128_si256(
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(set.lo_)));
+        auto hi = _mm256_broadcastsi128_si256(
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(set.hi_)));
+        auto nibble = _mm256_set1_epi8(0x0f);
+        auto zero = _mm256_setzero_si256();
+        std::size_t i = 0;
+        for (; i + 32 <= n; i += 32) {
+          auto block = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(p + i));
+          // bytes >= 0x80 have high nibbles >= 8, whose hi_ entries are 0
+          auto bitsLo = _mm256_shuffle_epi8(lo, _mm256_and_si256(block, nibble));
+          auto bitsHi = _mm256_shuffle_epi8(
+            hi, _mm256_and_si256(_mm256_srli_epi16(block, 4), nibble));
+          auto miss = _mm256_cmpeq_epi8(_mm256_and_si256(bitsLo, bitsHi), zero);
+          auto mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(miss));
+          if (mask != 0) {
+            return i + __builtin_ctz(mask);
+          }
+        }
+        if (n - i >= 16 && set.size_ <= 16) {
+          return i + findSse42(p + i, n - i, set);
+        }
+        return findScalar(p, n, set, i);
+      }
+#endif
+  };
+} /* end of namespace: nul */
+
+#endif /* end of include guard: NUL_SCAN_H_ */
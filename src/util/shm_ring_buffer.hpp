@@ -0,0 +1,383 @@
+#ifndef NUL_SHM_RING_BUFFER_H_
+#define NUL_SHM_RING_BUFFER_H_
+#include "buffer.hpp"
+#include "log.hpp"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <new>
+#include <string>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+namespace nul {
+
+  /**
+   * a single-producer/single-consumer ring buffer of variable-length
+   * records placed in shared memory, so two processes can exchange
+   * messages without a syscall per message.
+   *
+   * the region is a named POSIX shm object (create()/open()) or an
+   * anonymous memfd (createAnonymous(), share fd() over a unix socket or
+   * fork), head and tail are byte offsets rather than pointers so the
+   * region can be mapped at different addresses. blocked put()/take()
+   * sleep on a futex in the region, the other side only issues the wake
+   * syscall when somebody is actually waiting.
+   *
+   * semantics follow CircularBuffer: waitTimeMillis <= 0 waits forever,
+   * once interrupted put() fails and take() drains what is left.
+   */
+  class ShmRingBuffer final {
+    public:
+      static std::unique_ptr<ShmRingBuffer> create(
+        const std::string &name, std::size_t capacity) {
+        auto fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd == -1) {
+          LOG_E("shm_open failed: %s, %s", name.c_str(), strerror(errno));
+          return nullptr;
+        }
+        return init(fd, capacity);
+      }
+
+      static std::unique_ptr<ShmRingBuffer> open(const std::string &name) {
+        auto fd = shm_open(name.c_str(), O_RDWR, 0600);
+        if (fd == -1) {
+          LOG_E("shm_open failed: %s, %s", name.c_str(), strerror(errno));
+          return nullptr;
+        }
+        return attach(fd);
+      }
+
+      static std::unique_ptr<ShmRingBuffer> createAnonymous(
+        std::size_t capacity) {
+        auto fd = static_cast<int>(syscall(SYS_memfd_create, "nul_shm_ring", 0));
+        if (fd == -1) {
+          LOG_E("memfd_create failed: %s", strerror(errno));
+          return nullptr;
+        }
+        return init(fd, capacity);
+      }
+
+      // maps a region created by another process, takes ownership of 'fd'
+      static std::unique_ptr<ShmRingBuffer> attach(int fd) {
+        struct stat st;
+        if (fstat(fd, &st) == -1 ||
+            static_cast<std::size_t>(st.st_size) < sizeof(Header)) {
+          LOG_E("invalid shm region");
+          ::close(fd);
+          return nullptr;
+        }
+        auto ring = map(fd, st.st_size);
+        if (ring && (ring->header_->magic != MAGIC ||
+            ring->header_->capacity + sizeof(Header) !=
+            static_cast<std::size_t>(st.st_size))) {
+          LOG_E("invalid shm region");
+          return nullptr;
+        }
+        return ring;
+      }
+
+      static bool unlink(const std::string &name) {
+        return shm_unlink(name.c_str()) == 0;
+      }
+
+      ~ShmRingBuffer() {
+        munmap(header_, mappedSize_);
+        ::close(fd_);
+      }
+
+      ShmRingBuffer(const ShmRingBuffer &) = delete;
+      ShmRingBuffer &operator=(const ShmRingBuffer &) = delete;
+
+      /**
+       * producer side, blocks while there is no room, returns false if
+       * interrupted, timed out, or len > maxRecordSize()
+       */
+      bool put(const char *data, std::size_t len, int waitTimeMillis = 0) {
+        auto &h = *header_;
+        if (len > maxRecordSize() ||
+            h.interrupted.load(std::memory_order_acquire)) {
+          return false;
+        }
+        auto head = h.head.load(std::memory_order_relaxed);
+        auto pos = head & mask_;
+        auto need = recordSize(len);
+        // a record never wraps, skip the rest of the ring instead
+        auto skip = h.capacity - pos < need ? h.capacity - pos : 0;
+
+        auto hasRoom = [&]() {
+          return h.capacity -
+            (head - h.tail.load(std::memory_order_acquire)) >= skip + need;
+        };
+        if (!wait(hasRoom, h.producerWaiting, h.consumerSeq, waitTimeMillis)) {
+          return false;
+        }
+
+        if (skip > 0) {
+          storeLength(pos, WRAP_MARKER);
+          head += skip;
+          pos = 0;
+        }
+        storeLength(pos, static_cast<uint32_t>(len));
+        memcpy(data_ + pos + LENGTH_BYTES, data, len);
+        h.head.store(head + need, std::memory_order_release);
+
+        wake(h.consumerWaiting, h.producerSeq);
+        return true;
+      }
+
+      bool tryPut(const char *data, std::size_t len) {
+        return put(data, len, -1);
+      }
+
+      /**
+       * consumer side, calls visitor(const char *data, std::size_t len)
+       * with a pointer into the shared region, which is only valid until
+       * the visitor returns. returns false if interrupted and empty, or
+       * timed out (waitTimeMillis < 0 never waits).
+       */
+      template <typename Visitor>
+      bool takeWith(Visitor &&visitor, int waitTimeMillis = 0) {
+        auto &h = *header_;
+        auto tail = h.tail.load(std::memory_order_relaxed);
+        auto hasData = [&]() {
+          return h.head.load(std::memory_order_acquire) != tail;
+        };
+        if (!wait(hasData, h.consumerWaiting, h.producerSeq, waitTimeMillis)) {
+          return false;
+        }
+
+        auto pos = tail & mask_;
+        auto len = loadLength(pos);
+        if (len == WRAP_MARKER) {
+          tail += h.capacity - pos;
+          pos = 0;
+          len = loadLength(pos);
+        }
+        visitor(static_cast<const char *>(data_ + pos + LENGTH_BYTES),
+                static_cast<std::size_t>(len));
+        h.tail.store(tail + recordSize(len), std::memory_order_release);
+
+        wake(h.producerWaiting, h.consumerSeq);
+        return true;
+      }
+
+      // returns nullptr if interrupted and empty, or timed out
+      std::unique_ptr<Buffer> take(int waitTimeMillis = 0) {
+        std::unique_ptr<Buffer> buf;
+        takeWith([&buf](const char *data, std::size_t len) {
+          buf = std::make_unique<Buffer>(len);
+          buf->assign(data, len);
+        }, waitTimeMillis);
+        return buf;
+      }
+
+      std::unique_ptr<Buffer> takeOrDefault() {
+        return take(-1);
+      }
+
+      bool empty() const {
+        return header_->head.load(std::memory_order_acquire) ==
+          header_->tail.load(std::memory_order_acquire);
+      }
+
+      std::size_t capacity() const {
+        return header_->capacity;
+      }
+
+      // a record may take up to half of the ring
+      std::size_t maxRecordSize() const {
+        return header_->capacity / 2 - LENGTH_BYTES;
+      }
+
+      bool interrupted() const {
+        return header_->interrupted.load(std::memory_order_acquire);
+      }
+
+      bool interruptedAndEmpty() const {
+        return interrupted() && empty();
+      }
+
+      // visible to both processes
+      void interrupt() {
+        auto &h = *header_;
+        h.interrupted.store(1, std::memory_order_seq_cst);
+        h.producerSeq.fetch_add(1, std::memory_order_seq_cst);
+        h.consumerSeq.fetch_add(1, std::memory_order_seq_cst);
+        futex(&h.producerSeq, FUTEX_WAKE, INT_MAX, nullptr);
+        futex(&h.consumerSeq, FUTEX_WAKE, INT_MAX, nullptr);
+      }
+
+      int fd() const {
+        return fd_;
+      }
+
+    private:
+      static constexpr uint32_t MAGIC = 0x4e55524e;  // "NURN"
+      static constexpr uint32_t WRAP_MARKER = 0xffffffff;
+      static constexpr std::size_t LENGTH_BYTES = sizeof(uint32_t);
+      static constexpr std::size_t ALIGNMENT = 8;
+
+      static_assert(
+        std::atomic<uint64_t>::is_always_lock_free &&
+        std::atomic<uint32_t>::is_always_lock_free,
+        "shared memory atomics must be lock-free");
+
+      struct Header {
+        uint32_t magic;
+        uint64_t capacity;
+
+        alignas(64) std::atomic<uint64_t> head;
+        // futex word bumped by the producer when the consumer is waiting
+        std::atomic<uint32_t> producerSeq;
+        std::atomic<uint32_t> consumerWaiting;
+
+        alignas(64) std::atomic<uint64_t> tail;
+        // futex word bumped by the consumer when the producer is waiting
+        std::atomic<uint32_t> consumerSeq;
+        std::atomic<uint32_t> producerWaiting;
+
+        alignas(64) std::atomic<uint32_t> interrupted;
+      };
+
+      ShmRingBuffer(int fd, Header *header, std::size_t mappedSize) :
+        fd_(fd), mappedSize_(mappedSize), header_(header),
+        data_(reinterpret_cast<char *>(header) + sizeof(Header)),
+        mask_(header->capacity - 1) { }
+
+      static std::unique_ptr<ShmRingBuffer> init(int fd, std::size_t capacity) {
+        // round up to a power of 2 so positions can be masked
+        std::size_t cap = 64;
+        while (cap < capacity) {
+          cap <<= 1;
+        }
+        if (ftruncate(fd, sizeof(Header) + cap) == -1) {
+          LOG_E("ftruncate failed: %s", strerror(errno));
+          ::close(fd);
+          return nullptr;
+        }
+        auto ring = map(fd, sizeof(Header) + cap);
+        if (!ring) {
+          return nullptr;
+        }
+        auto h = new (ring->header_) Header{};
+        h->capacity = cap;
+        ring->mask_ = cap - 1;
+        std::atomic_thread_fence(std::memory_order_release);
+        h->magic = MAGIC;
+        return ring;
+      }
+
+      static std::unique_ptr<ShmRingBuffer> map(int fd, std::size_t size) {
+        auto addr = mmap(
+          nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+          LOG_E("mmap failed: %s", strerror(errno));
+          ::close(fd);
+          return nullptr;
+        }
+        return std::unique_ptr<ShmRingBuffer>(
+          new ShmRingBuffer(fd, static_cast<Header *>(addr), size));
+      }
+
+      static std::size_t recordSize(std::size_t len) {
+        return (LENGTH_BYTES + len + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+      }
+
+      void storeLength(std::size_t pos, uint32_t len) {
+        memcpy(data_ + pos, &len, LENGTH_BYTES);
+      }
+
+      uint32_t loadLength(std::size_t pos) const {
+        uint32_t len;
+        memcpy(&len, data_ + pos, LENGTH_BYTES);
+        return len;
+      }
+
+      static long futex(
+        std::atomic<uint32_t> *addr, int op, uint32_t val,
+        const struct timespec *timeout) {
+        // no FUTEX_PRIVATE_FLAG, the word is shared between processes
+        return syscall(SYS_futex, addr, op, val, timeout, nullptr, 0);
+      }
+
+      /**
+       * waits until 'ready' returns true, 'waiting' tells the other side to
+       * bump and wake 'seq', returns false if interrupted (and still not
+       * ready) or timed out
+       */
+      template <typename Predicate>
+      bool wait(
+        Predicate &&ready,
+        std::atomic<uint32_t> &waiting,
+        std::atomic<uint32_t> &seq,
+        int waitTimeMillis) {
+        auto &h = *header_;
+        for (int spin = 0; spin < 64; ++spin) {
+          if (ready()) {
+            return true;
+          }
+        }
+        if (waitTimeMillis < 0) {
+          return false;
+        }
+
+        struct timespec timeout;
+        timeout.tv_sec = waitTimeMillis / 1000;
+        timeout.tv_nsec = (waitTimeMillis % 1000) * 1000000L;
+        auto deadline = std::chrono::steady_clock::now() +
+          std::chrono::milliseconds(waitTimeMillis);
+
+        while (true) {
+          auto s = seq.load(std::memory_order_seq_cst);
+          waiting.store(1, std::memory_order_seq_cst);
+          if (ready()) {
+            break;
+          }
+          if (h.interrupted.load(std::memory_order_seq_cst)) {
+            waiting.store(0, std::memory_order_relaxed);
+            // the consumer may still drain what is left
+            return ready();
+          }
+          if (waitTimeMillis > 0) {
+            auto remaining = deadline - std::chrono::steady_clock::now();
+            if (remaining <= std::chrono::nanoseconds::zero()) {
+              waiting.store(0, std::memory_order_relaxed);
+              return false;
+            }
+            auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+              remaining).count();
+            timeout.tv_sec = nanos / 1000000000L;
+            timeout.tv_nsec = nanos % 1000000000L;
+          }
+          futex(&seq, FUTEX_WAIT, s, waitTimeMillis > 0 ? &timeout : nullptr);
+        }
+        waiting.store(0, std::memory_order_relaxed);
+        return true;
+      }
+
+      void wake(std::atomic<uint32_t> &waiting, std::atomic<uint32_t> &seq) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_seq_cst)) {
+          seq.fetch_add(1, std::memory_order_seq_cst);
+          futex(&seq, FUTEX_WAKE, 1, nullptr);
+        }
+      }
+
+    private:
+      int fd_;
+      std::size_t mappedSize_;
+      Header *header_;
+      char *data_;
+      uint64_t mask_;
+  };
+} /* end of namespace: nul */
+
+#endif /* end of include guard: NUL_SHM_RING_BUFFER_H_ */
@@ -0,0 +1,501 @@
+#ifndef NUL_THREAD_POOL_H_
+#define NUL_THREAD_POOL_H_
+#include "circular_buffer.hpp"
+#include "log.hpp"
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <exception>
+#include <type_traits>
+#include <algorithm>
+#include <cstdint>
+
+namespace nul {
+
+  /**
+   * Chase-Lev work-stealing deque with a fixed capacity, the owner thread
+   * pushes and pops at the bottom, other threads steal from the top.
+   * T must be a pointer type, nullptr means "nothing".
+   *
+   * ref: Lê et al., "Correct and Efficient Work-Stealing for Weak Memory
+   * Models", PPoPP 2013
+   */
+  template <typename T, std::size_t CAPACITY>
+  class WorkStealingDeque final {
+    static_assert(std::is_pointer<T>::value, "T must be a pointer type");
+    static_assert(
+      CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0,
+      "CAPACITY must be a power of 2");
+
+    public:
+      WorkStealingDeque() {
+        for (auto &slot : arr_) {
+          slot.store(nullptr, std::memory_order_relaxed);
+        }
+      }
+
+      // owner only, returns false if the deque is full
+      bool push(T data) {
+        auto b = bottom_.load(std::memory_order_relaxed);
+        auto t = top_.load(std::memory_order_acquire);
+        if (b - t >= static_cast<int64_t>(CAPACITY)) {
+          return false;
+        }
+        arr_[b & MASK].store(data, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return true;
+      }
+
+      // owner only
+      T pop() {
+        auto b = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = top_.load(std::memory_order_relaxed);
+
+        T data = nullptr;
+        if (t <= b) {
+          data = arr_[b & MASK].load(std::memory_order_relaxed);
+          if (t == b) {
+            // last element, race against thieves
+            if (!top_.compare_exchange_strong(
+                t, t + 1,
+                std::memory_order_seq_cst, std::memory_order_relaxed)) {
+              data = nullptr;
+            }
+            bottom_.store(b + 1, std::memory_order_relaxed);
+          }
+        } else {
+          bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+        return data;
+      }
+
+      // any thread
+      T steal() {
+        auto t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto b = bottom_.load(std::memory_order_acquire);
+        if (t < b) {
+          T data = arr_[t & MASK].load(std::memory_order_relaxed);
+          if (top_.compare_exchange_strong(
+              t, t + 1,
+              std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return data;
+          }
+        }
+        return nullptr;
+      }
+
+      // approximate when called concurrently
+      bool empty() const {
+        return bottom_.load(std::memory_order_relaxed) <=
+          top_.load(std::memory_order_relaxed);
+      }
+
+    private:
+      static constexpr int64_t MASK = CAPACITY - 1;
+
+      alignas(64) std::atomic<int64_t> top_{0};
+      alignas(64) std::atomic<int64_t> bottom_{0};
+      std::atomic<T> arr_[CAPACITY];
+  };
+
+  namespace detail {
+    template <typename R>
+    struct FutureState {
+      std::atomic<bool> ready{false};
+      std::mutex mutex;
+      std::condition_variable cond;
+      std::exception_ptr exception;
+      typename std::conditional<std::is_void<R>::value, char, R>::type value{};
+
+      // set by the pool, lets a worker run other tasks instead of blocking
+      bool (*help)(void *pool){nullptr};
+      void *pool{nullptr};
+
+      void complete() {
+        auto lock = std::unique_lock<std::mutex>(mutex);
+        ready.store(true, std::memory_order_release);
+        cond.notify_all();
+      }
+    };
+  } /* end of namespace: detail */
+
+  /**
+   * a one-shot, single-consumer future returned by ThreadPool::submit(),
+   * cheaper than std::future since it does not go through std::packaged_task
+   */
+  template <typename R>
+  class TaskFuture final {
+    public:
+      TaskFuture() = default;
+      explicit TaskFuture(std::shared_ptr<detail::FutureState<R>> state) :
+        state_(std::move(state)) { }
+
+      // false if the task was rejected because the pool is shut down
+      bool valid() const {
+        return !!state_;
+      }
+
+      bool ready() const {
+        return state_ && state_->ready.load(std::memory_order_acquire);
+      }
+
+      void wait() const {
+        while (!ready()) {
+          // when called from a worker of the pool, run other tasks while
+          // waiting, so nested submit() + get() cannot starve the pool
+          if (state_->help && state_->help(state_->pool)) {
+            continue;
+          }
+          auto lock = std::unique_lock<std::mutex>(state_->mutex);
+          state_->cond.wait_for(lock, std::chrono::milliseconds(1), [&]() {
+            return state_->ready.load(std::memory_order_acquire);
+          });
+        }
+      }
+
+      // rethrows the exception thrown by the task, if any
+      R get() {
+        wait();
+        auto state = std::move(state_);
+        if (state->exception) {
+          std::rethrow_exception(state->exception);
+        }
+        if constexpr (!std::is_void<R>::value) {
+          return std::move(state->value);
+        }
+      }
+
+    private:
+      std::shared_ptr<detail::FutureState<R>> state_;
+  };
+
+  /**
+   * each worker owns a Chase-Lev deque for tasks submitted from inside the
+   * pool, tasks submitted from other threads go through a bounded injection
+   * queue (put blocks once MAX_PENDING_TASKS tasks are queued), idle workers
+   * steal from random victims.
+   */
+  template <std::size_t MAX_PENDING_TASKS = 1024>
+  class BasicThreadPool final {
+    public:
+      explicit BasicThreadPool(
+        std::size_t threadCount = std::thread::hardware_concurrency()) {
+        threadCount = std::max<std::size_t>(threadCount, 1);
+        for (std::size_t i = 0; i < threadCount; ++i) {
+          workers_.push_back(std::make_unique<Worker>());
+        }
+        for (std::size_t i = 0; i < threadCount; ++i) {
+          workers_[i]->thread = std::thread([this, i]() { workerLoop(i); });
+        }
+      }
+
+      ~BasicThreadPool() {
+        shutdown();
+      }
+
+      BasicThreadPool(const BasicThreadPool &) = delete;
+      BasicThreadPool &operator=(const BasicThreadPool &) = delete;
+
+      /**
+       * returns an invalid future if the pool is shut down, exceptions
+       * thrown by 'fn' are rethrown by TaskFuture::get()
+       */
+      template <typename F>
+      auto submit(F &&fn) -> TaskFuture<typename std::invoke_result<F>::type> {
+        using R = typename std::invoke_result<F>::type;
+        auto state = std::make_shared<detail::FutureState<R>>();
+        state->help = &BasicThreadPool::helpOnce;
+        state->pool = this;
+
+        auto accepted = post(
+          [state, fn = std::forward<F>(fn)]() mutable {
+            try {
+              if constexpr (std::is_void<R>::value) {
+                fn();
+              } else {
+                state->value = fn();
+              }
+            } catch (...) {
+              state->exception = std::current_exception();
+            }
+            state->complete();
+          });
+        return accepted ? TaskFuture<R>{std::move(state)} : TaskFuture<R>{};
+      }
+
+      // fire-and-forget, returns false if the pool is shut down
+      bool execute(std::function<void()> fn) {
+        return post(std::move(fn));
+      }
+
+      /**
+       * calls fn(i) for every i in [begin, end), the range is split into
+       * chunks of 'grain' indices (0 means choose one), the calling thread
+       * takes part in the work and returns once every index is processed,
+       * the first exception thrown by 'fn' is rethrown
+       */
+      template <typename F>
+      void parallel_for(
+        std::size_t begin, std::size_t end, F &&fn, std::size_t grain = 0) {
+        if (begin >= end) {
+          return;
+        }
+        auto count = end - begin;
+        if (grain == 0) {
+          grain = std::max<std::size_t>(1, count / (workers_.size() * 4));
+        }
+
+        struct ForState {
+          std::atomic<std::size_t> nextChunk{0};
+          std::atomic<std::size_t> doneChunks{0};
+          std::size_t chunkCount;
+          std::atomic<bool> failed{false};
+          std::exception_ptr exception;
+          std::mutex mutex;
+          std::condition_variable cond;
+        };
+        auto state = std::make_shared<ForState>();
+        state->chunkCount = (count + grain - 1) / grain;
+
+        auto runChunks = [state, begin, end, grain, &fn]() {
+          std::size_t chunk;
+          while ((chunk = state->nextChunk.fetch_add(1)) < state->chunkCount) {
+            auto first = begin + chunk * grain;
+            auto last = std::min(end, first + grain);
+            if (!state->failed.load(std::memory_order_relaxed)) {
+              try {
+                for (auto i = first; i < last; ++i) {
+                  fn(i);
+                }
+              } catch (...) {
+                auto lock = std::unique_lock<std::mutex>(state->mutex);
+                if (!state->failed.exchange(true)) {
+                  state->exception = std::current_exception();
+                }
+              }
+            }
+            if (state->doneChunks.fetch_add(1) + 1 == state->chunkCount) {
+              auto lock = std::unique_lock<std::mutex>(state->mutex);
+              state->cond.notify_all();
+            }
+          }
+        };
+
+        // 'fn' is captured by reference, helpers that start after all chunks
+        // are claimed never touch it, so it outlives every use
+        auto helpers = std::min(workers_.size(), state->chunkCount - 1);
+        for (std::size_t i = 0; i < helpers; ++i) {
+          if (!post(runChunks)) {
+            break;
+          }
+        }
+        runChunks();
+
+        while (state->doneChunks.load() < state->chunkCount) {
+          if (currentPool_ == this && runPendingTask()) {
+            continue;
+          }
+          auto lock = std::unique_lock<std::mutex>(state->mutex);
+          state->cond.wait_for(lock, std::chrono::milliseconds(1), [&]() {
+            return state->doneChunks.load() == state->chunkCount;
+          });
+        }
+
+        if (state->exception) {
+          std::rethrow_exception(state->exception);
+        }
+      }
+
+      /**
+       * interrupts the injection queue just like CircularBuffer::interrupt(),
+       * so no more tasks are accepted from outside the pool, tasks already
+       * queued (and tasks they submit) are still run before workers exit
+       */
+      void shutdown() {
+        injectionQueue_.interrupt();
+        wakeIdleWorkers(true);
+        for (auto &w : workers_) {
+          if (w->thread.joinable()) {
+            w->thread.join();
+          }
+        }
+      }
+
+      bool interrupted() {
+        return injectionQueue_.interrupted();
+      }
+
+      std::size_t threadCount() const {
+        return workers_.size();
+      }
+
+    private:
+      struct Task {
+        std::function<void()> fn;
+      };
+
+      static constexpr std::size_t LOCAL_QUEUE_SIZE = 1024;
+
+      struct alignas(64) Worker {
+        WorkStealingDeque<Task *, LOCAL_QUEUE_SIZE> deque;
+        std::thread thread;
+      };
+
+      bool post(std::function<void()> fn) {
+        auto task = new Task{std::move(fn)};
+        if (currentPool_ == this) {
+          if (workers_[workerIndex_]->deque.push(task)) {
+            wakeIdleWorkers(false);
+            return true;
+          }
+          // local deque is full, or the pool is shut down, run it inline
+          // rather than blocking a worker on the injection queue
+          if (!injectionQueue_.tryPut(std::move(task))) {
+            runTask(task);
+            return true;
+          }
+          wakeIdleWorkers(false);
+          return true;
+        }
+
+        if (!injectionQueue_.put(task)) {
+          delete task;
+          return false;
+        }
+        wakeIdleWorkers(false);
+        return true;
+      }
+
+      static bool helpOnce(void *pool) {
+        auto self = static_cast<BasicThreadPool *>(pool);
+        return currentPool_ == self && self->runPendingTask();
+      }
+
+      // worker threads only
+      bool runPendingTask() {
+        auto task = nextTask(workerIndex_);
+        if (task) {
+          runTask(task);
+          return true;
+        }
+        return false;
+      }
+
+      Task *nextTask(std::size_t index) {
+        auto task = workers_[index]->deque.pop();
+        if (task) {
+          return task;
+        }
+        task = injectionQueue_.takeOrDefault();
+        if (task) {
+          return task;
+        }
+
+        // start from a random victim to spread the contention
+        auto count = workers_.size();
+        auto start = nextRandom() % count;
+        for (std::size_t i = 0; i < count; ++i) {
+          auto victim = (start + i) % count;
+          if (victim == index) {
+            continue;
+          }
+          task = workers_[victim]->deque.steal();
+          if (task) {
+            return task;
+          }
+        }
+        return nullptr;
+      }
+
+      static void runTask(Task *task) {
+        try {
+          task->fn();
+        } catch (...) {
+          LOG_E("uncaught exception in thread pool task");
+        }
+        delete task;
+      }
+
+      void workerLoop(std::size_t index) {
+        currentPool_ = this;
+        workerIndex_ = index;
+        randomState_ = static_cast<uint32_t>(index * 2654435761u + 1);
+
+        while (true) {
+          auto seenEpoch = epoch_.load();
+          auto task = nextTask(index);
+          if (task) {
+            runTask(task);
+            continue;
+          }
+
+          if (injectionQueue_.interruptedAndEmpty() && allDequesEmpty()) {
+            break;
+          }
+
+          auto lock = std::unique_lock<std::mutex>(idleMutex_);
+          idleCount_.fetch_add(1);
+          idleCond_.wait_for(lock, std::chrono::milliseconds(10), [&]() {
+            return epoch_.load() != seenEpoch;
+          });
+          idleCount_.fetch_sub(1);
+        }
+
+        currentPool_ = nullptr;
+      }
+
+      bool allDequesEmpty() const {
+        for (auto &w : workers_) {
+          if (!w->deque.empty()) {
+            return false;
+          }
+        }
+        return true;
+      }
+
+      void wakeIdleWorkers(bool all) {
+        epoch_.fetch_add(1);
+        if (idleCount_.load() > 0 || all) {
+          auto lock = std::unique_lock<std::mutex>(idleMutex_);
+          if (all) {
+            idleCond_.notify_all();
+          } else {
+            idleCond_.notify_one();
+          }
+        }
+      }
+
+      static uint32_t nextRandom() {
+        // xorshift32
+        auto x = randomState_;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        randomState_ = x;
+        return x;
+      }
+
+    private:
+      std::vector<std::unique_ptr<Worker>> workers_;
+      CircularBuffer<Task *, MAX_PENDING_TASKS> injectionQueue_;
+
+      std::mutex idleMutex_;
+      std::condition_variable idleCond_;
+      std::atomic<std::size_t> idleCount_{0};
+      std::atomic<uint64_t> epoch_{0};
+
+      static inline thread_local BasicThreadPool *currentPool_{nullptr};
+      static inline thread_local std::size_t workerIndex_{0};
+      static inline thread_local uint32_t randomState_{2463534242u};
+  };
+
+  using ThreadPool = BasicThreadPool<>;
+} /* end of namespace: nul */
+
+#endif /* end of include guard: NUL_THREAD_POOL_H_ */
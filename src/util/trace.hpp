@@ -0,0 +1,367 @@
+#ifndef NUL_TRACE_H_
+#define NUL_TRACE_H_
+#include "log_kv.hpp"
+#include "log_binary.hpp"
+#include "tsc_clock.hpp"
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cinttypes>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// events kept per thread, older ones are overwritten
+#ifndef TRACE_BUFFER_EVENTS
+#define TRACE_BUFFER_EVENTS 8192
+#endif
+
+// threads that get a buffer, buffers of exited threads are reused after that
+#ifndef TRACE_MAX_THREADS
+#define TRACE_MAX_THREADS 256
+#endif
+
+// key/value arguments per event, and the bytes their values are kept in
+#ifndef TRACE_MAX_ARGS
+#define TRACE_MAX_ARGS 4
+#endif
+
+#ifndef TRACE_ARGS_SIZE
+#define TRACE_ARGS_SIZE 64
+#endif
+
+namespace nul {
+
+  /**
+   * records scopes (TRACE_SCOPE, or PROFILE_TIME_COST* with PROFILE_TRACE)
+   * as complete events with their thread, nesting depth and key/value
+   * arguments, and writes them as Chrome Trace Event JSON, which
+   * chrome://tracing and ui.perfetto.dev open.
+   *
+   * recording is off until start(), a disabled scope costs one relaxed
+   * load. each thread records into its own ring of TRACE_BUFFER_EVENTS
+   * events, so memory is bounded and the newest events are kept.
+   */
+  class Tracer final {
+    public:
+      struct Event {
+        const char *name;
+        const char *category;
+        uint64_t beginNanos;
+        uint64_t durationNanos;
+        int depth;
+        int argc;
+        const char *keys[TRACE_MAX_ARGS];
+        uint16_t argsLen;
+        char args[TRACE_ARGS_SIZE];
+      };
+
+      static Tracer &instance() {
+        // leaked on purpose, scopes may end in static destructors
+        static Tracer *tracer = new Tracer();
+        return *tracer;
+      }
+
+      void start() {
+        enabled_.store(true, std::memory_order_relaxed);
+      }
+
+      void stop() {
+        enabled_.store(false, std::memory_order_relaxed);
+      }
+
+      bool enabled() const {
+        return enabled_.load(std::memory_order_relaxed);
+      }
+
+      // events overwritten before they were written out
+      uint64_t overwritten() const {
+        return overwritten_.load(std::memory_order_relaxed);
+      }
+
+      // shown instead of the thread id
+      static void setThreadName(const char *name) {
+        auto buf = instance().threadBuffer();
+        if (buf) {
+          buf->lock();
+          buf->name = name;
+          buf->unlock();
+        }
+      }
+
+      void record(const Event &event) {
+        auto buf = threadBuffer();
+        if (!buf) {
+          return;
+        }
+        buf->lock();
+        if (buf->count == TRACE_BUFFER_EVENTS) {
+          overwritten_.fetch_add(1, std::memory_order_relaxed);
+        } else {
+          ++buf->count;
+        }
+        buf->events[buf->next] = event;
+        buf->next = (buf->next + 1) % TRACE_BUFFER_EVENTS;
+        buf->unlock();
+      }
+
+      void clear() {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        for (auto &buf : buffers_) {
+          buf->lock();
+          buf->count = 0;
+          buf->next = 0;
+          buf->unlock();
+        }
+      }
+
+      bool write(const char *path) {
+        auto f = fopen(path, "w");
+        if (!f) {
+          return false;
+        }
+        write(f);
+        return fclose(f) == 0;
+      }
+
+      // events may be recorded meanwhile, they are left out or included
+      void write(FILE *out) {
+        using Json = BasicLogKv<LogKvFormat::JSON>;
+        std::string s = "{\"traceEvents\":[";
+        auto first = true;
+        auto pid = getpid();
+        auto separate = [&]() {
+          if (!first) {
+            s.append(",\n");
+          }
+          first = false;
+        };
+
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        for (auto &buf : buffers_) {
+          buf->lock();
+          if (buf->name) {
+            separate();
+            s.append("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":")
+              .append(std::to_string(pid)).append(",\"tid\":")
+              .append(std::to_string(buf->tid))
+              .append(",\"args\":{\"name\":");
+            Json::appendString(s, buf->name);
+            s.append("}}");
+          }
+          auto begin = (buf->next + TRACE_BUFFER_EVENTS - buf->count) %
+            TRACE_BUFFER_EVENTS;
+          for (std::size_t i = 0; i < buf->count; ++i) {
+            separate();
+            appendEvent(s, buf->events[(begin + i) % TRACE_BUFFER_EVENTS],
+                pid, buf->tid);
+          }
+          buf->unlock();
+
+          fwrite(s.data(), 1, s.size(), out);
+          s.clear();
+        }
+        s.append("],\"displayTimeUnit\":\"ns\"}\n");
+        fwrite(s.data(), 1, s.size(), out);
+      }
+
+      static uint64_t nowNanos() {
+        return TscClock::now().time_since_epoch().count();
+      }
+
+      // nesting depth of the calling thread
+      static int &depth() {
+        thread_local int d = 0;
+        return d;
+      }
+
+    private:
+      struct Buffer {
+        std::atomic<bool> busy{false};
+        std::atomic<bool> retired{false};
+        long tid{0};
+        const char *name{nullptr};
+        std::size_t next{0};
+        std::size_t count{0};
+        std::unique_ptr<Event[]> events{new Event[TRACE_BUFFER_EVENTS]};
+
+        // only contended while the trace is written out
+        void lock() {
+          while (busy.exchange(true, std::memory_order_acquire)) {
+            while (busy.load(std::memory_order_relaxed)) { }
+          }
+        }
+
+        void unlock() {
+          busy.store(false, std::memory_order_release);
+        }
+      };
+
+      struct BufferHolder {
+        Buffer *buf{nullptr};
+
+        ~BufferHolder() {
+          if (buf) {
+            buf->retired.store(true, std::memory_order_release);
+          }
+        }
+      };
+
+      Tracer() = default;
+
+      Buffer *threadBuffer() {
+        thread_local BufferHolder holder;
+        if (!holder.buf) {
+          holder.buf = acquireBuffer();
+        }
+        return holder.buf;
+      }
+
+      // a new buffer while there is room, so events of exited threads stay
+      Buffer *acquireBuffer() {
+        auto lock = std::unique_lock<std::mutex>(mutex_);
+        Buffer *buf = nullptr;
+        if (buffers_.size() < TRACE_MAX_THREADS) {
+          buffers_.emplace_back(new Buffer());
+          buf = buffers_.back().get();
+        } else {
+          for (auto &b : buffers_) {
+            auto retired = true;
+            if (b->retired.compare_exchange_strong(retired, false)) {
+              buf = b.get();
+              buf->lock();
+              buf->count = buf->next = 0;
+              buf->name = nullptr;
+              buf->unlock();
+              break;
+            }
+          }
+        }
+        if (buf) {
+          buf->tid = syscall(SYS_gettid);
+        }
+        return buf;
+      }
+
+      static void appendEvent(
+          std::string &s, const Event &e, pid_t pid, long tid) {
+        using Json = BasicLogKv<LogKvFormat::JSON>;
+        char num[64];
+        s.append("{\"name\":");
+        Json::appendString(s, e.name);
+        s.append(",\"cat\":");
+        Json::appendString(s, e.category);
+        // microseconds
+        snprintf(num, sizeof(num), ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f",
+            e.beginNanos / 1000.0, e.durationNanos / 1000.0);
+        s.append(num);
+        s.append(",\"pid\":").append(std::to_string(pid))
+          .append(",\"tid\":").append(std::to_string(tid))
+          .append(",\"args\":{\"depth\":").append(std::to_string(e.depth));
+
+        // values in BinaryLogArgs encoding
+        auto p = e.args;
+        auto end = e.args + e.argsLen;
+        for (int i = 0; i < e.argc && p < end; ++i) {
+          s.append(",");
+          Json::appendString(s, e.keys[i]);
+          s.append(":");
+          auto tag = *p++;
+          if (tag == BinaryLogArgs::TAG_STRING) {
+            uint32_t len;
+            memcpy(&len, p, sizeof(len));
+            Json::appendString(s, p + sizeof(len), len);
+            p += sizeof(len) + len;
+            continue;
+          }
+          uint64_t raw;
+          memcpy(&raw, p, sizeof(raw));
+          p += sizeof(raw);
+          if (tag == BinaryLogArgs::TAG_INT) {
+            s.append(std::to_string(static_cast<int64_t>(raw)));
+          } else if (tag == BinaryLogArgs::TAG_UINT) {
+            s.append(std::to_string(raw));
+          } else if (tag == BinaryLogArgs::TAG_DOUBLE) {
+            double d;
+            memcpy(&d, &raw, sizeof(d));
+            snprintf(num, sizeof(num), "%.15g", d);
+            s.append(d == d && d - d == 0 ? num : "null");
+          } else {
+            snprintf(num, sizeof(num), "\"0x%" PRIx64 "\"", raw);
+            s.append(num);
+          }
+        }
+        s.append("}}");
+      }
+
+    private:
+      std::atomic<bool> enabled_{false};
+      std::atomic<uint64_t> overwritten_{0};
+      std::mutex mutex_;
+      std::vector<std::unique_ptr<Buffer>> buffers_;
+  };
+
+  // the scope object of TRACE_SCOPE, 'name' must be a string literal
+  class TraceScope final {
+    public:
+      template <typename... Fields>
+      explicit TraceScope(
+          const char *name, const char *category, const Fields &... fields) {
+        static_assert(sizeof...(Fields) <= TRACE_MAX_ARGS,
+            "too many trace arguments, see TRACE_MAX_ARGS");
+        if (!Tracer::instance().enabled()) {
+          return;
+        }
+        active_ = true;
+        event_.name = name;
+        event_.category = category;
+        event_.depth = Tracer::depth()++;
+        event_.argc = 0;
+        event_.argsLen = 0;
+        if (BinaryLogArgs::size(fields.value...) <= TRACE_ARGS_SIZE) {
+          auto end = BinaryLogArgs::encode(event_.args, fields.value...);
+          event_.argsLen = static_cast<uint16_t>(end - event_.args);
+          ((event_.keys[event_.argc++] = fields.key), ...);
+        }
+        event_.beginNanos = Tracer::nowNanos();
+      }
+
+      ~TraceScope() {
+        if (!active_) {
+          return;
+        }
+        event_.durationNanos = Tracer::nowNanos() - event_.beginNanos;
+        --Tracer::depth();
+        Tracer::instance().record(event_);
+      }
+
+      TraceScope(const TraceScope &) = delete;
+      TraceScope &operator=(const TraceScope &) = delete;
+
+    private:
+      bool active_{false};
+      Tracer::Event event_;
+  };
+} /* end of namespace: nul */
+
+#ifndef COMBINE_
+#define EXPAND_(a, b) a ## b
+#define COMBINE_(a, b) EXPAND_(a, b)
+#endif
+
+/**
+ * TRACE_SCOPE("parse", nul::kv("bytes", len)), arguments are string or
+ * arithmetic nul::kv() fields, the category is LOG_TAG_NAME
+ */
+#ifdef ENABLE_TRACING
+#define TRACE_SCOPE(name, ...)\
+    nul::TraceScope COMBINE_(__trace, __LINE__) (name, LOG_TAG_NAME, ##__VA_ARGS__)
+#else
+#define TRACE_SCOPE(name, ...)
+#endif
+
+#endif /* end of include guard: NUL_TRACE_H_ */
@@ -0,0 +1,143 @@
+#ifndef NUL_TSC_CLOCK_H_
+#define NUL_TSC_CLOCK_H_
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+// how long the TSC is measured against CLOCK_MONOTONIC
+#ifndef TSC_CALIBRATION_MS
+#define TSC_CALIBRATION_MS 10
+#endif
+
+namespace nul {
+
+  /**
+   * a std::chrono clock (steady, nanoseconds) read from the time stamp
+   * counter: rdtsc costs a few cycles where clock_gettime costs ~20ns.
+   *
+   * the TSC frequency is measured once against CLOCK_MONOTONIC, on first
+   * use (TSC_CALIBRATION_MS), ticks are then converted with a multiply and
+   * a shift. the TSC is only used if the CPU reports it as invariant
+   * (constant rate, synchronized across cores), otherwise and on other
+   * architectures the clock falls back to CLOCK_MONOTONIC.
+   */
+  class TscClock final {
+    public:
+      using duration = std::chrono::nanoseconds;
+      using rep = duration::rep;
+      using period = duration::period;
+      using time_point = std::chrono::time_point<TscClock>;
+      static constexpr bool is_steady = true;
+
+      static time_point now() {
+        return time_point(duration(toNanos(ticks())));
+      }
+
+      // like now(), but not executed before the preceding instructions
+      static time_point nowOrdered() {
+        return time_point(duration(toNanos(ticksOrdered())));
+      }
+
+      // raw ticks, nanoseconds when the TSC is not used
+      static uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+        if (__builtin_expect(calibration().usable, 1)) {
+          return __rdtsc();
+        }
+#endif
+        return monotonicNanos();
+      }
+
+      static uint64_t ticksOrdered() {
+#if defined(__x86_64__) || defined(__i386__)
+        if (__builtin_expect(calibration().usable, 1)) {
+          unsigned aux;
+          return __rdtscp(&aux);
+        }
+#endif
+        return monotonicNanos();
+      }
+
+      static uint64_t toNanos(uint64_t ticks) {
+        auto &c = calibration();
+        if (!c.usable) {
+          return ticks;
+        }
+        return static_cast<uint64_t>(
+          (static_cast<unsigned __int128>(ticks) * c.mult) >> SHIFT);
+      }
+
+      // whether the TSC is used
+      static bool usable() {
+        return calibration().usable;
+      }
+
+      // 0 when the TSC is not used
+      static double ticksPerNanosecond() {
+        auto &c = calibration();
+        return c.usable ? static_cast<double>(1ull << SHIFT) / c.mult : 0.0;
+      }
+
+    private:
+      static constexpr unsigned SHIFT = 32;
+
+      struct Calibration {
+        bool usable{false};
+        // nanoseconds per tick, << SHIFT
+        uint64_t mult{0};
+      };
+
+      static const Calibration &calibration() {
+        static const Calibration c = calibrate();
+        return c;
+      }
+
+      static uint64_t monotonicNanos() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+      }
+
+      static bool invariantTsc() {
+#if defined(__x86_64__) || defined(__i386__)
+        unsigned eax, ebx, ecx, edx;
+        if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) ||
+            eax < 0x80000007) {
+          return false;
+        }
+        __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+        return edx & (1u << 8);
+#else
+        return false;
+#endif
+      }
+
+      static Calibration calibrate() {
+        Calibration c;
+#if defined(__x86_64__) || defined(__i386__)
+        if (!invariantTsc()) {
+          return c;
+        }
+        auto ns0 = monotonicNanos();
+        auto t0 = __rdtsc();
+        struct timespec wait = { 0, TSC_CALIBRATION_MS * 1000000L };
+        while (nanosleep(&wait, &wait) != 0) { }
+        auto ns1 = monotonicNanos();
+        auto t1 = __rdtsc();
+        if (t1 <= t0 || ns1 <= ns0) {
+          return c;
+        }
+        c.mult = static_cast<uint64_t>(
+          (static_cast<unsigned __int128>(ns1 - ns0) << SHIFT) / (t1 - t0));
+        c.usable = c.mult > 0;
+#endif
+        return c;
+      }
+  };
+} /* end of namespace: nul */
+
+#endif /* end of include guard: NUL_TSC_CLOCK_H_ */
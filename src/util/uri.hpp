@@ -1,32 +1,44 @@
 #ifndef NUL_URI_H_
 #define NUL_URI_H_
 #include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
 #include "log.hpp"
+#include "scan.hpp"
 
 namespace nul {
-  class URI final {
+
+  /**
+   * a parsed URI whose components are string_views into the parsed string,
+   * which must outlive it. parse() neither allocates nor copies, components
+   * are kept as offsets, so a UriView is cheap to copy.
+   */
+  class UriView final {
     public:
-      bool parse(const std::string &strUri) {
-        if (strUri.empty()) {
+      bool parse(std::string_view strUri) {
+        *this = UriView{};
+        if (strUri.empty() || strUri.size() > UINT32_MAX) {
           return false;
         }
 
         strUri_ = strUri;
 
-        auto start = 0;
+        std::size_t start = 0;
         auto fragmentStart = scan(strUri, '#', start, strUri.length());
-        if (fragmentStart != -1) {
-          fragment_ = std::string(strUri, fragmentStart + 1);
+        if (fragmentStart != NPOS) {
+          fragment_ = range(fragmentStart + 1, strUri.length());
 
         } else {
           fragmentStart = strUri.length();
         }
 
-        auto schemeEnd = scan(strUri, ":/?", start, fragmentStart);
-        if (schemeEnd != -1 && strUri[schemeEnd] == ':') {
+        auto schemeEnd = scan(strUri, SCHEME_END, start, fragmentStart);
+        if (schemeEnd != NPOS && strUri[schemeEnd] == ':') {
 
           bool isValidScheme = true;
-          for (int i = start; i < schemeEnd; ++i) {
+          for (auto i = start; i < schemeEnd; ++i) {
             if (!isValidSchemeChar(i, strUri[i])) {
               // invalid scheme, do not treat it as scheme
               isValidScheme = false;
@@ -35,7 +47,7 @@ namespace nul {
           }
 
           if (isValidScheme) {
-            scheme_ = std::string(strUri, start, schemeEnd - start);
+            scheme_ = range(start, schemeEnd);
             start = schemeEnd + 1;
           }
         }
@@ -44,12 +56,12 @@ namespace nul {
           start += 2; // ignore "//"
         }
 
-        auto authorityEnd = scan(strUri, "/?", start, fragmentStart);
-        if (authorityEnd == -1) {
+        auto authorityEnd = scan(strUri, AUTHORITY_END, start, fragmentStart);
+        if (authorityEnd == NPOS) {
           authorityEnd = fragmentStart;
         }
-        if (authorityEnd > start) {
-          authority_ = std::string(strUri, start, authorityEnd - start);
+        if (authorityEnd > start && authorityEnd != NPOS) {
+          authority_ = range(start, authorityEnd);
           parseAuthority(strUri, start, authorityEnd);
 
           start = authorityEnd;
@@ -57,62 +69,84 @@ namespace nul {
 
         if (start < fragmentStart) {
           auto pathEnd = scan(strUri, '?', start, fragmentStart);
-          if (pathEnd != -1) {
-            path_ = std::string(strUri, start, pathEnd - start);
+          if (pathEnd != NPOS) {
+            path_ = range(start, pathEnd);
             start = pathEnd + 1;  // ignore '?'
 
-            queryStr_ = std::string(strUri, start, fragmentStart - start);
+            queryStr_ = range(start, fragmentStart);
 
           } else {
-            path_ = std::string(strUri, start, fragmentStart - start);
+            path_ = range(start, fragmentStart);
           }
         }
 
         return true;
       }
 
-      std::string getScheme() const {
-        return scheme_;
+      std::string_view getScheme() const {
+        return get(scheme_);
       }
 
-      std::string getAuthority() const {
-        return authority_;
+      std::string_view getAuthority() const {
+        return get(authority_);
       }
 
-      std::string getUserInfo() const {
-        return userInfo_;
+      std::string_view getUserInfo() const {
+        return get(userInfo_);
       }
 
-      std::string getHost() const {
-        return host_;
+      std::string_view getHost() const {
+        return get(host_);
       }
 
-      const uint16_t getPort() const {
+      uint16_t getPort() const {
         return port_;
       }
 
-      std::string getPath() const {
-        return path_;
+      std::string_view getPath() const {
+        return get(path_);
       }
 
-      std::string getQueryStr() const {
-        return queryStr_;
+      std::string_view getQueryStr() const {
+        return get(queryStr_);
       }
 
-      std::string getFragment() const {
-        return fragment_;
+      std::string_view getFragment() const {
+        return get(fragment_);
       }
 
-      std::string getStrUri() const {
+      std::string_view getStrUri() const {
         return strUri_;
       }
 
     private:
+      friend class URI;
+
+      static constexpr std::size_t NPOS = std::string_view::npos;
+      static constexpr ByteSet SCHEME_END{":/?"};
+      static constexpr ByteSet AUTHORITY_END{"/?"};
+
+      // [begin, end) of strUri_
+      struct Range {
+        uint32_t begin{0};
+        uint32_t end{0};
+      };
+
+      static Range range(std::size_t begin, std::size_t end) {
+        return Range{
+          static_cast<uint32_t>(begin), static_cast<uint32_t>(end)
+        };
+      }
+
+      std::string_view get(Range r) const {
+        return strUri_.substr(r.begin, r.end - r.begin);
+      }
+
       void parseAuthority(
-        const std::string &strUri, std::size_t start, std::size_t end) {
+        std::string_view strUri, std::size_t start, std::size_t end) {
         auto userInfoEnd = scan(strUri, '@', start, end);
-        if (userInfoEnd != -1) {
-          userInfo_ = std::string{strUri, start, userInfoEnd - start};
+        if (userInfoEnd != NPOS) {
+          userInfo_ = range(start, userInfoEnd);
           start = userInfoEnd + 1;  // ignore '@'
         }
 
@@ -124,67 +158,49 @@ namespace nul {
         auto hostEnd = hasOpenBracket ?
           scan(strUri, ']', start, end) :
           scan(strUri, ':', start, end);
-        if (hostEnd != -1) {
-          host_ = std::string{strUri, start, hostEnd - start};
+        if (hostEnd != NPOS) {
+          host_ = range(start, hostEnd);
           start = hostEnd + 1;  // ignore ':'
           if (hasOpenBracket) {
             ++start;  // ignore ]
           }
 
           if (start < end) {
-            for (std::size_t i = start; i < end; ++i) {
-              if (!isdigit(strUri[i])) {
+            // wraps like the uint16_t conversion of the whole number
+            uint16_t port = 0;
+            for (auto i = start; i < end; ++i) {
+              if (!isdigit(static_cast<unsigned char>(strUri[i]))) {
                 return;
               }
+              port = static_cast<uint16_t>(port * 10 + (strUri[i] - '0'));
             }
 
-            port_ = std::stoi(strUri.substr(start, end - start));
+            port_ = port;
           }
 
         } else {
-          host_ = std::string{strUri, start, end - start};
+          host_ = range(start, end);
         }
       }
 
-      int scan(
-        const std::string &strUri,
-        const char *stopChars,
+      static std::size_t scan(
+        std::string_view strUri,
+        const ByteSet &stopChars,
         std::size_t start,
         std::size_t end) {
-
-        auto len = strlen(stopChars);
-        while (start < end) {
-          for (std::size_t i = 0; i < len; ++i) {
-            if (strUri[start] == stopChars[i]) {
-              return start;
-            }
-          }
-
-          ++start;
-        }
-
-        return -1;
+        return Scan::findFirstOf(strUri.substr(0, end), stopChars, start);
       }
 
-      int scan(
-        const std::string &strUri,
+      static std::size_t scan(
+        std::string_view strUri,
         char stopChar,
-        int start,
-        int end) {
-
-        while (start < end) {
-          if (strUri[start] == stopChar) {
-            return start;
-          }
-
-          ++start;
-        }
-
-        return -1;
+        std::size_t start,
+        std::size_t end) {
+        return Scan::find(strUri.substr(0, end), stopChar, start);
       }
 
-      bool regionMatches(
-        const std::string &s, const char *region, std::size_t start) {
+      static bool regionMatches(
+        std::string_view s, const char *region, std::size_t start) {
         auto regionLen = strlen(region);
         auto strSize = s.size();
         if (regionLen > strSize) {
@@ -203,7 +219,7 @@ namespace nul {
         return true;
       }
 
-      bool isValidSchemeChar(int index, char c) {
+      static bool isValidSchemeChar(std::size_t index, char c) {
         if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
           return true;
         }
@@ -219,15 +235,357 @@ namespace nul {
       }
 
     private:
-      std::string strUri_;
-      std::string scheme_;
-      std::string authority_;
-      std::string userInfo_;
-      std::string host_;
+      std::string_view strUri_;
+      Range scheme_;
+      Range authority_;
+      Range userInfo_;
+      Range host_;
       uint16_t port_{0};
-      std::string path_;
-      std::string queryStr_;
-      std::string fragment_;
+      Range path_;
+      Range queryStr_;
+      Range fragment_;
+  };
+
+  /**
+   * a UriView over its own copy of the string, the getters return copies,
+   * use view() to read the components without copying
+   */
+  class URI final {
+    public:
+      URI() = default;
+
+      URI(const URI &other) : strUri_(other.strUri_), view_(other.view_) {
+        view_.strUri_ = strUri_;
+      }
+
+      URI(URI &&other) noexcept :
+        strUri_(std::move(other.strUri_)), view_(other.view_) {
+        view_.strUri_ = strUri_;
+        other.view_ = UriView{};
+      }
+
+      URI &operator=(const URI &other) {
+        if (this != &other) {
+          strUri_ = other.strUri_;
+          view_ = other.view_;
+          view_.strUri_ = strUri_;
+        }
+        return *this;
+      }
+
+      URI &operator=(URI &&other) noexcept {
+        if (this != &other) {
+          strUri_ = std::move(other.strUri_);
+          view_ = other.view_;
+          view_.strUri_ = strUri_;
+          other.view_ = UriView{};
+        }
+        return *this;
+      }
+
+      bool parse(std::string_view strUri) {
+        if (strUri.empty()) {
+          return false;
+        }
+
+        strUri_.assign(strUri.data(), strUri.size());
+        return view_.parse(strUri_);
+      }
+
+      const UriView &view() const {
+        return view_;
+      }
+
+      std::string getScheme() const {
+        return std::string(view_.getScheme());
+      }
+
+      std::string getAuthority() const {
+        return std::string(view_.getAuthority());
+      }
+
+      std::string getUserInfo() const {
+        return std::string(view_.getUserInfo());
+      }
+
+      std::string getHost() const {
+        return std::string(view_.getHost());
+      }
+
+      const uint16_t getPort() const {
+        return view_.getPort();
+      }
+
+      std::string getPath() const {
+        return std::string(view_.getPath());
+      }
+
+      std::string getQueryStr() const {
+        return std::string(view_.getQueryStr());
+      }
+
+      std::string getFragment() const {
+        return std::string(view_.getFragment());
+      }
+
+      std::string getStrUri() const {
+        return strUri_;
+      }
+
+    private:
+      std::string strUri_;
+      UriView view_;
+  };
+
+  // a raw or decoded key=value pair of a query string
+  struct QueryParam {
+    std::string_view key;
+    std::string_view value;
+  };
+
+  /**
+   * iterates over the key=value pairs of a query string without decoding
+   * or allocating, empty pairs are skipped and a pair without '=' has an
+   * empty value, e.g.
+   *
+   *   char buf[256];
+   *   for (const auto &param : QueryString{uri.view().getQueryStr()}) {
+   *     std::string_view key;
+   *     if (QueryString::decode(param.key, buf, sizeof(buf), key)) ...
+   *   }
+   */
+  class QueryString final {
+    public:
+      class Iterator final {
+        public:
+          const QueryParam &operator*() const {
+            return param_;
+          }
+
+          const QueryParam *operator->() const {
+            return &param_;
+          }
+
+          Iterator &operator++() {
+            advance();
+            return *this;
+          }
+
+          bool operator==(const Iterator &other) const {
+            return pos_ == other.pos_;
+          }
+
+          bool operator!=(const Iterator &other) const {
+            return pos_ != other.pos_;
+          }
+
+        private:
+          friend class QueryString;
+
+          static constexpr std::size_t END = std::string_view::npos;
+
+          Iterator(std::string_view query, std::size_t pos) :
+            query_(query), next_(pos), pos_(pos) {
+            if (pos_ != END) {
+              advance();
+            }
+          }
+
+          void advance() {
+            while (next_ < query_.size()) {
+              auto pairEnd = Scan::find(query_, '&', next_);
+              if (pairEnd == Scan::npos) {
+                pairEnd = query_.size();
+              }
+              auto pair = query_.substr(next_, pairEnd - next_);
+              pos_ = next_;
+              next_ = pairEnd + 1;
+              if (pair.empty()) {
+                continue;
+              }
+
+              auto eq = Scan::find(pair, '=');
+              if (eq == Scan::npos) {
+                param_ = QueryParam{pair, {}};
+              } else {
+                param_ = QueryParam{pair.substr(0, eq), pair.substr(eq + 1)};
+              }
+              return;
+            }
+            pos_ = END;
+          }
+
+          std::string_view query_;
+          std::size_t next_;
+          std::size_t pos_;  // of the current pair, END past the last one
+          QueryParam param_;
+      };
+
+      explicit QueryString(std::string_view query) : query_(query) {
+      }
+
+      Iterator begin() const {
+        return Iterator{query_, 0};
+      }
+
+      Iterator end() const {
+        return Iterator{query_, Iterator::END};
+      }
+
+      /**
+       * percent-decodes 'in' into 'buf', and '+' into ' ' if 'plusAsSpace',
+       * 'out' views the result in 'buf'. decoding never makes a string
+       * longer, false if 'size' is less than in.size(). malformed escapes
+       * are kept as they are.
+       *
+       * runs of bytes that need no decoding are found with Scan and copied
+       * with memcpy, so mostly plain values decode at memcpy speed
+       */
+      static bool decode(
+        std::string_view in,
+        char *buf,
+        std::size_t size,
+        std::string_view &out,
+        bool plusAsSpace = true) {
+        if (size < in.size()) {
+          return false;
+        }
+
+        static constexpr ByteSet ESCAPES{"%+"};
+        static constexpr ByteSet PERCENT{"%"};
+        const auto &escapes = plusAsSpace ? ESCAPES : PERCENT;
+
+        std::size_t n = 0;
+        std::size_t i = 0;
+        while (i < in.size()) {
+          auto escape = Scan::findFirstOf(in, escapes, i);
+          if (escape == Scan::npos) {
+            escape = in.size();
+          }
+          memcpy(buf + n, in.data() + i, escape - i);
+          n += escape - i;
+          i = escape;
+          if (i == in.size()) {
+            break;
+          }
+
+          if (in[i] == '+') {
+            buf[n++] = ' ';
+            ++i;
+            continue;
+          }
+
+          int hi, lo;
+          if (i + 2 < in.size() &&
+              (hi = hexValue(in[i + 1])) >= 0 &&
+              (lo = hexValue(in[i + 2])) >= 0) {
+            buf[n++] = static_cast<char>((hi << 4) | lo);
+            i += 3;
+          } else {
+            buf[n++] = '%';
+            ++i;
+          }
+        }
+
+        out = std::string_view(buf, n);
+        return true;
+      }
+
+    private:
+      static int hexValue(char c) {
+        if (c >= '0' && c <= '9') {
+          return c - '0';
+        }
+        if (c >= 'a' && c <= 'f') {
+          return c - 'a' + 10;
+        }
+        if (c >= 'A' && c <= 'F') {
+          return c - 'A' + 10;
+        }
+        return -1;
+      }
+
+      std::string_view query_;
+  };
+
+  /**
+   * the decoded pairs of a query string in a flat array, for looking keys
+   * up repeatedly without allocating. keys are compared linearly, which
+   * beats hashing for the handful of parameters a query has.
+   *
+   *   char buf[1024];
+   *   QueryMap<> params;
+   *   if (params.parse(uri.view().getQueryStr(), buf, sizeof(buf))) {
+   *     auto page = params.get("page", "1");
+   *   }
+   */
+  template <std::size_t N = 16>
+  class QueryMap final {
+    public:
+      /**
+       * decodes the pairs of 'query' into 'buf', which must outlive the
+       * map, query.size() bytes always suffice. false if 'buf' is too
+       * small or there are more than N pairs
+       */
+      bool parse(std::string_view query, char *buf, std::size_t size) {
+        size_ = 0;
+        std::size_t used = 0;
+        for (const auto &param : QueryString{query}) {
+          if (size_ == N) {
+            return false;
+          }
+
+          auto &decoded = params_[size_];
+          if (!QueryString::decode(
+                param.key, buf + used, size - used, decoded.key)) {
+            return false;
+          }
+          used += decoded.key.size();
+          if (!QueryString::decode(
+                param.value, buf + used, size - used, decoded.value)) {
+            return false;
+          }
+          used += decoded.value.size();
+          ++size_;
+        }
+        return true;
+      }
+
+      // the first pair of 'key', nullptr if there is none
+      const QueryParam *find(std::string_view key) const {
+        for (std::size_t i = 0; i < size_; ++i) {
+          if (params_[i].key == key) {
+            return &params_[i];
+          }
+        }
+        return nullptr;
+      }
+
+      std::string_view get(
+        std::string_view key, std::string_view defaultValue = {}) const {
+        auto param = find(key);
+        return param ? param->value : defaultValue;
+      }
+
+      bool contains(std::string_view key) const {
+        return find(key) != nullptr;
+      }
+
+      std::size_t size() const {
+        return size_;
+      }
+
+      const QueryParam *begin() const {
+        return params_;
+      }
+
+      const QueryParam *end() const {
+        return params_ + size_;
+      }
+
+    private:
+      QueryParam params_[N];
+      std::size_t size_{0};
   };
 } /* end of namspace: nul */
 
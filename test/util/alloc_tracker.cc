@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+#define NUL_ALLOC_TRACKER_IMPLEMENTATION
+#define NUL_ALLOC_TRACKER_MALLOC
+#include "util/alloc_tracker.hpp"
+#define ENABLE_PROFILING
+#define PROFILE_ALLOCS
+#include "util/profiler.hpp"
+#include "capture_stderr.hpp"
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace nul;
+
+static int sum(const std::vector<int> &v) {
+  int s = 0;
+  for (auto x : v) {
+    s += x;
+  }
+  return s;
+}
+
+TEST(AllocTracker, Test) {
+  ASSERT_TRUE(AllocTracker::installed());
+  std::vector<int> v(100, 1);
+
+  AllocScope none;
+  ASSERT_EQ(100, sum(v));
+  ASSERT_EQ(0u, none.allocs());
+  ASSERT_EQ(0u, none.allocBytes());
+
+  AllocScope scope;
+  {
+    auto p = std::make_unique<char[]>(1000);
+    auto s = std::string(100, 'x');
+    auto m = malloc(50);
+    m = realloc(m, 5000);
+    free(m);
+  }
+  // new[], std::string, malloc, realloc
+  ASSERT_EQ(4u, scope.allocs());
+  ASSERT_EQ(4u, scope.frees());
+  ASSERT_GE(scope.allocBytes(), 1000u + 100 + 5000);
+  ASSERT_EQ(scope.allocBytes(), scope.freedBytes());
+
+  // per thread
+  AllocScope other;
+  std::thread([]() {
+    auto p = std::make_unique<int>(1);
+    (void)p;
+  }).join();
+  ASSERT_EQ(0u, other.freedBytes());
+}
+
+TEST(AllocTracker, Profiler) {
+  auto out = captureStderr([]() {
+    {
+      PROFILE_TIME_COST_USEC("alloc %d", 1);
+      auto p = std::make_unique<char[]>(64);
+    }
+    {
+      PROFILE_TIME_COST_USEC("no alloc %d", 2);
+    }
+  });
+
+  // the usable size of an allocation depends on the allocator
+  auto pos = out.find(" us, allocs: 1, frees: 1, alloc_bytes: ");
+  ASSERT_NE(std::string::npos, pos);
+  unsigned long long allocBytes = 0, freedBytes = 0;
+  ASSERT_EQ(2, sscanf(out.c_str() + pos,
+        " us, allocs: 1, frees: 1, alloc_bytes: %llu, freed_bytes: %llu",
+        &allocBytes, &freedBytes));
+  ASSERT_GE(allocBytes, 64u);
+  ASSERT_EQ(allocBytes, freedBytes);
+  ASSERT_NE(std::string::npos, out.find(
+      " us, allocs: 0, frees: 0, alloc_bytes: 0, freed_bytes: 0"));
+}
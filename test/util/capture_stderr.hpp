@@ -0,0 +1,30 @@
+#ifndef NUL_TEST_CAPTURE_STDERR_H_
+#define NUL_TEST_CAPTURE_STDERR_H_
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+
+// what 'fn' writes to stderr
+template <typename Fn>
+inline std::string captureStderr(Fn fn) {
+  fflush(stderr);
+  auto saved = dup(STDERR_FILENO);
+  auto tmp = tmpfile();
+  dup2(fileno(tmp), STDERR_FILENO);
+  fn();
+  fflush(stderr);
+  dup2(saved, STDERR_FILENO);
+  close(saved);
+
+  std::string out;
+  char buf[256];
+  rewind(tmp);
+  std::size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), tmp)) > 0) {
+    out.append(buf, n);
+  }
+  fclose(tmp);
+  return out;
+}
+
+#endif /* end of include guard: NUL_TEST_CAPTURE_STDERR_H_ */
@@ -4,12 +4,17 @@
 #include <future>
 #include <thread>
 #include <functional>
+#include <poll.h>
 
 #define ENABLE_PROFILING
 #include "util/profiler.hpp"
 
 using namespace nul;
 
+#if defined(NUL_REQUIRE_COROUTINES) && !defined(NUL_HAS_COROUTINES)
+#error "the compiler does not support coroutines, asyncTake() is not tested"
+#endif
+
 TEST(CircularBuffer, Test) {
   constexpr auto MAX_SIZE = 3;
   nul::CircularBuffer<int, MAX_SIZE> cbuf;
@@ -85,3 +90,243 @@ TEST(CircularBuffer, UniquePointer) {
   f2.get();
   f1.get();
 }
+
+static bool fdReadable(int fd) {
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+TEST(CircularBuffer, TryPut) {
+  nul::CircularBuffer<std::unique_ptr<int>, 1> cbuf;
+  ASSERT_TRUE(cbuf.tryPut(std::make_unique<int>(1)));
+  auto p = std::make_unique<int>(2);
+  ASSERT_FALSE(cbuf.tryPut(std::move(p)));
+  ASSERT_TRUE(p && *p == 2);
+  ASSERT_EQ(1, *cbuf.take());
+  cbuf.interrupt();
+  ASSERT_FALSE(cbuf.tryPut(std::move(p)));
+  ASSERT_TRUE(p && *p == 2);
+}
+
+TEST(CircularBuffer, EventFd) {
+  constexpr auto MAX_SIZE = 2;
+  nul::CircularBuffer<int, MAX_SIZE> cbuf;
+  ASSERT_EQ(-1, cbuf.readableFd());
+  ASSERT_TRUE(cbuf.enableEventFd(true));
+  ASSERT_NE(-1, cbuf.readableFd());
+  ASSERT_NE(-1, cbuf.writableFd());
+
+  ASSERT_FALSE(fdReadable(cbuf.readableFd()));
+  ASSERT_TRUE(fdReadable(cbuf.writableFd()));
+
+  cbuf.put(1);
+  ASSERT_TRUE(fdReadable(cbuf.readableFd()));
+  ASSERT_TRUE(fdReadable(cbuf.writableFd()));
+
+  cbuf.put(2);
+  ASSERT_TRUE(fdReadable(cbuf.readableFd()));
+  ASSERT_FALSE(fdReadable(cbuf.writableFd()));
+
+  ASSERT_EQ(1, cbuf.takeOrDefault());
+  ASSERT_TRUE(fdReadable(cbuf.readableFd()));
+  ASSERT_TRUE(fdReadable(cbuf.writableFd()));
+
+  ASSERT_EQ(2, cbuf.takeOrDefault());
+  ASSERT_FALSE(fdReadable(cbuf.readableFd()));
+
+  cbuf.interrupt();
+  ASSERT_TRUE(fdReadable(cbuf.readableFd()));
+  ASSERT_TRUE(fdReadable(cbuf.writableFd()));
+}
+
+TEST(MultiLaneCircularBuffer, Test) {
+  nul::MultiLaneCircularBuffer<int, 2, 3> cbuf;
+  ASSERT_EQ(2, cbuf.LANE_COUNT);
+  ASSERT_EQ(5, cbuf.capacity());
+  ASSERT_EQ(2, cbuf.capacity(0));
+  ASSERT_EQ(3, cbuf.capacity(1));
+  ASSERT_TRUE(cbuf.empty());
+  ASSERT_FALSE(cbuf.put(2, 0));
+
+  cbuf.put(1, 10);
+  cbuf.put(1, 11);
+  cbuf.put(0, 1);
+  cbuf.put(1, 12);
+  cbuf.put(0, 2);
+  ASSERT_EQ(5, cbuf.size());
+  ASSERT_EQ(2, cbuf.size(0));
+  ASSERT_EQ(3, cbuf.size(1));
+
+  ASSERT_EQ(1, cbuf.take());
+  ASSERT_EQ(2, cbuf.take());
+  ASSERT_EQ(10, cbuf.take());
+  cbuf.put(0, 3);
+  ASSERT_EQ(3, cbuf.take());
+  ASSERT_EQ(11, cbuf.take());
+  ASSERT_EQ(12, cbuf.take());
+  ASSERT_EQ(0, cbuf.take(5));
+}
+
+TEST(MultiLaneCircularBuffer, Interrupt) {
+  nul::MultiLaneCircularBuffer<int, 1, 1> cbuf;
+  cbuf.put(1, 10);
+
+  // control lane is not blocked by a full data lane
+  ASSERT_TRUE(cbuf.put(0, 1));
+
+  auto f = std::async(std::launch::async, [&](){
+    return cbuf.put(1, 11);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  cbuf.interrupt();
+  ASSERT_FALSE(f.get());
+  ASSERT_FALSE(cbuf.put(0, 2));
+
+  ASSERT_EQ(1, cbuf.take());
+  ASSERT_EQ(10, cbuf.take());
+  ASSERT_TRUE(cbuf.interruptedAndEmpty());
+  ASSERT_EQ(0, cbuf.take());
+}
+
+TEST(CircularBuffer, Stats) {
+  nul::CircularBuffer<int, 2, nul::QueueStats> cbuf;
+  ASSERT_EQ(0, cbuf.takeOrDefault());
+  cbuf.put(1);
+  cbuf.put(2);
+  ASSERT_EQ(2, cbuf.stats().occupancy());
+
+  auto f = std::async(std::launch::async, [&](){
+    return cbuf.put(3);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  ASSERT_EQ(1, cbuf.take());
+  ASSERT_TRUE(f.get());
+  ASSERT_EQ(2, cbuf.take());
+  ASSERT_EQ(3, cbuf.take());
+  ASSERT_EQ(0, cbuf.take(1));
+
+  auto s = cbuf.stats().snapshot();
+  ASSERT_EQ(3, s.enqueued);
+  ASSERT_EQ(3, s.dequeued);
+  ASSERT_EQ(1, s.fullEvents);
+  ASSERT_EQ(2, s.emptyEvents);
+  ASSERT_EQ(0, s.occupancy);
+  ASSERT_EQ(2, s.peakOccupancy);
+  ASSERT_EQ(1, s.putBlockedNanos.count);
+  ASSERT_GE(s.putBlockedNanos.min, 10 * 1000 * 1000);
+  ASSERT_EQ(1, s.takeWaitedNanos.count);
+  ASSERT_GE(s.takeWaitedNanos.percentile(50), 1000 * 1000);
+}
+
+TEST(Histogram, Test) {
+  nul::Histogram h;
+  for (uint64_t i = 1; i <= 1000; ++i) {
+    h.record(i);
+  }
+  auto s = h.snapshot();
+  ASSERT_EQ(1000, s.count);
+  ASSERT_EQ(1, s.min);
+  ASSERT_EQ(1000, s.max);
+  ASSERT_EQ(500500, s.sum);
+  ASSERT_NEAR(500, s.percentile(50), 500 / 16);
+  ASSERT_NEAR(990, s.percentile(99), 990 / 16);
+  ASSERT_EQ(1000, s.percentile(100));
+
+  for (uint64_t v : {0ull, 1ull, 15ull, 16ull, 1ull << 40, ~0ull}) {
+    auto i = nul::Histogram::bucketIndex(v);
+    ASSERT_LT(i, nul::Histogram::BUCKET_COUNT);
+    ASSERT_GE(nul::Histogram::bucketUpperBound(i), v);
+  }
+}
+
+#ifdef NUL_HAS_COROUTINES
+namespace {
+  // fire-and-forget coroutine
+  struct Detached {
+    struct promise_type {
+      Detached get_return_object() { return {}; }
+      std::suspend_never initial_suspend() noexcept { return {}; }
+      std::suspend_never final_suspend() noexcept { return {}; }
+      void return_void() { }
+      void unhandled_exception() { std::terminate(); }
+    };
+  };
+
+  struct InlineExecutor {
+    int executed{0};
+
+    bool execute(std::function<void()> fn) {
+      ++executed;
+      fn();
+      return true;
+    }
+  };
+
+  template <typename Queue>
+  Detached consume(Queue &q, InlineExecutor &ex, std::vector<int> &out) {
+    while (true) {
+      auto v = co_await q.asyncTake(ex);
+      if (v == 0) {
+        co_return;
+      }
+      out.push_back(v);
+    }
+  }
+
+  template <typename Queue>
+  Detached produce(Queue &q, InlineExecutor &ex, int from, int to, int &done) {
+    for (int i = from; i < to; ++i) {
+      if (!co_await q.asyncPut(i, ex)) {
+        co_return;
+      }
+    }
+    ++done;
+  }
+}
+
+TEST(CircularBuffer, AsyncTakeAndPut) {
+  nul::CircularBuffer<int, 4> cbuf;
+  InlineExecutor ex;
+  std::vector<int> out;
+
+  // thousands of logical consumers on a single thread
+  for (int i = 0; i < 1000; ++i) {
+    consume(cbuf, ex, out);
+  }
+  ASSERT_EQ(0, ex.executed);
+
+  int done = 0;
+  produce(cbuf, ex, 1, 101, done);
+  ASSERT_EQ(1, done);
+  ASSERT_EQ(100, out.size());
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_EQ(i + 1, out[i]);
+  }
+
+  cbuf.interrupt();
+  ASSERT_EQ(100, out.size());
+  ASSERT_TRUE(cbuf.interruptedAndEmpty());
+}
+
+TEST(CircularBuffer, AsyncPutBlocksWhenFull) {
+  nul::CircularBuffer<int, 2> cbuf;
+  InlineExecutor ex;
+  int done = 0;
+  produce(cbuf, ex, 1, 6, done);
+  ASSERT_EQ(0, done);
+  ASSERT_EQ(2, cbuf.size());
+
+  ASSERT_EQ(1, cbuf.take());
+  ASSERT_EQ(2, cbuf.take());
+  ASSERT_EQ(3, cbuf.take());
+  ASSERT_EQ(1, done);
+  ASSERT_EQ(2, cbuf.size());
+
+  produce(cbuf, ex, 10, 20, done);
+  cbuf.interrupt();
+  ASSERT_EQ(1, done);
+  ASSERT_EQ(4, cbuf.take());
+  ASSERT_EQ(5, cbuf.take());
+  ASSERT_TRUE(cbuf.interruptedAndEmpty());
+}
+#endif
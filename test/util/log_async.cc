@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+#define LOG_ASYNC
+#define LOG_TO_FILE
+#define LOG_FILE_PATH "/tmp/nul_log_async_test.log"
+#include "util/log.hpp"
+#include <fstream>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace nul;
+
+static std::vector<std::string> readLines(const char *path) {
+  std::vector<std::string> lines;
+  std::ifstream in(path);
+  std::string line;
+  while (std::getline(in, line)) {
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+// before Test, which shuts the writer down
+TEST(AsyncLogger, FlushWhileLogging) {
+  unlink(LOG_FILE_PATH);
+  auto &logger = AsyncLogger::instance();
+
+  std::atomic<bool> done{false};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&done, t]() {
+      for (int i = 0; !done.load(std::memory_order_relaxed); ++i) {
+        LOG_D("flusher=%d, line=%d", t, i);
+      }
+    });
+  }
+
+  // flushes racing producers that have claimed slots but not published
+  // them must still return
+  auto flushes = std::async(std::launch::async, [&logger]() {
+    for (int i = 0; i < 200; ++i) {
+      logger.flush();
+    }
+  });
+  auto status = flushes.wait_for(std::chrono::seconds(30));
+  done.store(true);
+  for (auto &t : threads) {
+    t.join();
+  }
+  ASSERT_EQ(std::future_status::ready, status);
+}
+
+TEST(AsyncLogger, Test) {
+  auto &logger = AsyncLogger::instance();
+  ASSERT_NE(STDERR_FILENO, logger.fd());
+  auto droppedBefore = logger.dropped();
+
+  constexpr auto THREADS = 4;
+  constexpr auto LINES = 500;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < THREADS; ++t) {
+    threads.emplace_back([t]() {
+      for (int i = 0; i < LINES; ++i) {
+        LOG_I("thread=%d, line=%d", t, i);
+        if (i % 100 == 0) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  logger.flush();
+
+  auto lines = readLines(LOG_FILE_PATH);
+  auto logged = 0;
+  for (auto &line : lines) {
+    if (line.find(" [I] [log_async.cc:") != std::string::npos &&
+        line.find("thread=") != std::string::npos) {
+      ++logged;
+    }
+  }
+  ASSERT_EQ(THREADS * LINES, logged + logger.dropped() - droppedBefore);
+
+  LOG_W("%s", std::string(1000, 'x').c_str());
+  logger.shutdown();
+  lines = readLines(LOG_FILE_PATH);
+  ASSERT_EQ(LOG_ASYNC_RECORD_SIZE - 1, lines.back().size() + 1);
+
+  // written synchronously after shutdown
+  LOG_E("after shutdown");
+  lines = readLines(LOG_FILE_PATH);
+  ASSERT_NE(std::string::npos, lines.back().find("after shutdown"));
+}
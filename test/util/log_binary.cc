@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+#define LOG_BINARY
+#define LOG_BINARY_FILE_PATH "/tmp/nul_log_binary_test.binlog"
+#include "util/log.hpp"
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace nul;
+
+static std::vector<std::string> decode(const char *path) {
+  std::vector<std::string> lines;
+  auto in = fopen(path, "rb");
+  char *text = nullptr;
+  std::size_t len = 0;
+  auto out = open_memstream(&text, &len);
+  auto ok = in && BinaryLogDecoder::decode(in, out);
+  fclose(out);
+  if (in) {
+    fclose(in);
+  }
+  if (ok) {
+    std::istringstream ss(std::string(text, len));
+    std::string line;
+    while (std::getline(ss, line)) {
+      lines.push_back(line);
+    }
+  }
+  free(text);
+  return lines;
+}
+
+static std::string message(const std::string &line) {
+  auto pos = line.find(" - ");
+  return pos == std::string::npos ? "" : line.substr(pos + 3);
+}
+
+TEST(BinaryLogArgs, Format) {
+  char buf[256];
+  auto check = [&](const char *expected, auto end) {
+    ASSERT_EQ(expected, BinaryLogArgs::format(
+        "%d|%5u|%-4x|%lld|%.2f|%e|%s|%8s|%c|%*d|%%|%zu",
+        buf, end - buf));
+  };
+  auto end = BinaryLogArgs::encode(buf, -1, 7u, 255, -3ll, 3.14159, 1.0,
+      "str", "right", 'c', 3, 5, static_cast<std::size_t>(42));
+  ASSERT_EQ(static_cast<std::size_t>(end - buf), BinaryLogArgs::size(-1, 7u,
+      255, -3ll, 3.14159, 1.0, "str", "right", 'c', 3, 5,
+      static_cast<std::size_t>(42)));
+  check("-1|    7|ff  |-3|3.14|1.000000e+00|str|   right|c|  5|%|42", end);
+
+  const char *null = nullptr;
+  end = BinaryLogArgs::encode(buf, null);
+  ASSERT_EQ("(null)", BinaryLogArgs::format("%s", buf, end - buf));
+}
+
+TEST(BinaryLogger, Test) {
+  auto &logger = BinaryLogger::instance();
+
+  constexpr auto THREADS = 4;
+  constexpr auto LINES = 500;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < THREADS; ++t) {
+    threads.emplace_back([t]() {
+      for (int i = 0; i < LINES; ++i) {
+        LOG_I("thread=%d, line=%d", t, i);
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  std::string name = "binary";
+  LOG_W("name=%s, ratio=%.3f, ptr=%p", name.c_str(), 0.5, nullptr);
+  logger.flush();
+
+  auto lines = decode(LOG_BINARY_FILE_PATH);
+  ASSERT_EQ(THREADS * LINES + 1, lines.size() + logger.dropped());
+  ASSERT_EQ(0u, logger.dropped());
+  for (std::size_t i = 0; i + 1 < lines.size(); ++i) {
+    ASSERT_NE(std::string::npos, lines[i].find(" nul [I] [log_binary.cc:"));
+    ASSERT_EQ(0u, message(lines[i]).find("thread="));
+  }
+  ASSERT_NE(std::string::npos, lines.back().find(" [W] "));
+  ASSERT_EQ("name=binary, ratio=0.500, ptr=(nil)", message(lines.back()));
+
+  // merged by timestamp, so per-thread order is kept
+  std::vector<int> next(THREADS, 0);
+  for (std::size_t i = 0; i + 1 < lines.size(); ++i) {
+    int t, line;
+    ASSERT_EQ(2, sscanf(message(lines[i]).c_str(), "thread=%d, line=%d", &t, &line));
+    ASSERT_EQ(next[t]++, line);
+  }
+}
+
+TEST(BinaryLogger, SitesRegisteredWhileDraining) {
+  auto &logger = BinaryLogger::instance();
+  logger.flush();
+  auto before = decode(LOG_BINARY_FILE_PATH).size();
+
+  // every record is of a site registered after the writer took its
+  // snapshot of the sites
+  constexpr auto THREADS = 4;
+  constexpr auto SITES = 5000;
+  std::atomic<bool> done{false};
+  std::thread flusher([&]() {
+    while (!done.load()) {
+      logger.flush();
+    }
+  });
+  std::vector<std::thread> threads;
+  for (int t = 0; t < THREADS; ++t) {
+    threads.emplace_back([&logger, t]() {
+      for (int i = 0; i < SITES; ++i) {
+        auto id = logger.registerSite(
+          4, "nul", "log_binary.cc", __LINE__, __func__, "site %d of %d");
+        logger.log(id, i, t);
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  done.store(true);
+  flusher.join();
+  logger.flush();
+
+  auto lines = decode(LOG_BINARY_FILE_PATH);
+  ASSERT_EQ(0u, logger.dropped());
+  ASSERT_EQ(before + THREADS * SITES, lines.size());
+}
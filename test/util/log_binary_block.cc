@@ -0,0 +1,59 @@
+#include <gtest/gtest.h>
+#define LOG_BINARY
+#define LOG_BINARY_BLOCK
+#define LOG_BINARY_FILE_PATH "/tmp/nul_log_binary_block_test.binlog"
+// a tiny ring and no periodic drain, only the fill wake-ups make progress
+#define LOG_BINARY_THREAD_BUFFER_SIZE 4096
+#define LOG_BINARY_FLUSH_INTERVAL_MS 600000
+#include "util/log.hpp"
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace nul;
+
+TEST(BinaryLogger, BlockWhenFull) {
+  auto &logger = BinaryLogger::instance();
+
+  constexpr auto THREADS = 4;
+  constexpr auto LINES = 20000;  // several rings' worth per thread
+  std::vector<std::thread> threads;
+  for (int t = 0; t < THREADS; ++t) {
+    threads.emplace_back([t]() {
+      for (int i = 0; i < LINES; ++i) {
+        LOG_I("thread=%d, line=%d", t, i);
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  logger.flush();
+  ASSERT_EQ(0u, logger.dropped());
+
+  auto in = fopen(LOG_BINARY_FILE_PATH, "rb");
+  ASSERT_NE(nullptr, in);
+  char *text = nullptr;
+  std::size_t len = 0;
+  auto out = open_memstream(&text, &len);
+  ASSERT_TRUE(BinaryLogDecoder::decode(in, out));
+  fclose(out);
+  fclose(in);
+
+  std::vector<int> next(THREADS, 0);
+  std::istringstream ss(std::string(text, len));
+  free(text);
+  std::string line;
+  while (std::getline(ss, line)) {
+    int t, i;
+    auto pos = line.find("thread=");
+    ASSERT_NE(std::string::npos, pos);
+    ASSERT_EQ(2, sscanf(line.c_str() + pos, "thread=%d, line=%d", &t, &i));
+    ASSERT_EQ(next[t]++, i);
+  }
+  for (int t = 0; t < THREADS; ++t) {
+    ASSERT_EQ(LINES, next[t]);
+  }
+  unlink(LOG_BINARY_FILE_PATH);
+}
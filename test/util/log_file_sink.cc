@@ -0,0 +1,122 @@
+#include <gtest/gtest.h>
+#include "util/log_file_sink.hpp"
+#include <fstream>
+#include <sstream>
+#include <string>
+
+using namespace nul;
+
+static std::string readFile(const std::string &path) {
+  std::ifstream in(path);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+static std::string makePath(const char *name) {
+  auto path = std::string("/tmp/nul_log_file_sink_") + name +
+    std::to_string(getpid());
+  unlink(path.c_str());
+  for (int i = 1; i <= 3; ++i) {
+    unlink((path + "." + std::to_string(i)).c_str());
+  }
+  return path;
+}
+
+TEST(LogFileSink, Buffering) {
+  auto path = makePath("buffering");
+  {
+    auto options = LogFileSink::Options{};
+    options.bufferSize = 64;
+    options.flushIntervalMillis = 20;
+    LogFileSink sink(path, options);
+
+    sink.printf("line %d\n", 1);
+    ASSERT_EQ("", readFile(path));
+    sink.flush();
+    ASSERT_EQ("line 1\n", readFile(path));
+
+    sink.printf("line %d\n", 2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ASSERT_EQ("line 1\nline 2\n", readFile(path));
+
+    // larger than the buffer, written directly
+    auto big = std::string(100, 'x') + "\n";
+    sink.write(big.data(), big.size());
+    sink.printf("line %d\n", 3);
+  }
+  auto expected = "line 1\nline 2\n" + std::string(100, 'x') + "\nline 3\n";
+  ASSERT_EQ(expected, readFile(path));
+}
+
+TEST(LogFileSink, Rotation) {
+  auto path = makePath("rotation");
+  auto options = LogFileSink::Options{};
+  options.bufferSize = 16;
+  options.flushIntervalMillis = 0;
+  options.maxFileSize = 20;
+  options.maxBackups = 2;
+  LogFileSink sink(path, options);
+
+  // rotated once a flush makes the file reach 20 bytes
+  for (int i = 0; i < 7; ++i) {
+    sink.printf("record %04d\n", i);   // 12 bytes
+    sink.flush();
+  }
+  ASSERT_EQ("record 0006\n", readFile(path));
+  ASSERT_EQ("record 0004\nrecord 0005\n", readFile(path + ".1"));
+  ASSERT_EQ("record 0002\nrecord 0003\n", readFile(path + ".2"));
+  ASSERT_EQ("", readFile(path + ".3"));
+}
+
+TEST(LogFileSink, Reopen) {
+  auto path = makePath("reopen");
+  auto options = LogFileSink::Options{};
+  options.flushIntervalMillis = 0;
+  LogFileSink sink(path, options);
+  LogFileSink::installReopenSignalHandler(SIGHUP);
+
+  sink.printf("before\n");
+  sink.flush();
+  auto moved = path + ".1";
+  ASSERT_EQ(0, rename(path.c_str(), moved.c_str()));
+
+  raise(SIGHUP);
+  sink.printf("after\n");
+  sink.flush();
+  ASSERT_EQ("before\n", readFile(moved));
+  ASSERT_EQ("after\n", readFile(path));
+
+  ASSERT_TRUE(sink.rotate());
+  ASSERT_EQ("after\n", readFile(path + ".1"));
+}
+
+TEST(LogFileSink, ReopenEverySink) {
+  auto path1 = makePath("reopen_every1_");
+  auto path2 = makePath("reopen_every2_");
+  auto options = LogFileSink::Options{};
+  options.flushIntervalMillis = 0;
+  LogFileSink sink1(path1, options);
+  LogFileSink sink2(path2, options);
+  LogFileSink::installReopenSignalHandler(SIGHUP);
+
+  ASSERT_EQ(0, rename(path1.c_str(), (path1 + ".1").c_str()));
+  ASSERT_EQ(0, rename(path2.c_str(), (path2 + ".1").c_str()));
+  raise(SIGHUP);
+
+  // the first sink to write must not consume the request of the other
+  sink1.printf("one\n");
+  sink1.flush();
+  sink2.printf("two\n");
+  sink2.flush();
+  ASSERT_EQ("one\n", readFile(path1));
+  ASSERT_EQ("two\n", readFile(path2));
+
+  // reopened once per signal
+  sink1.printf("three\n");
+  sink1.flush();
+  ASSERT_EQ(0, rename(path1.c_str(), (path1 + ".2").c_str()));
+  sink1.printf("four\n");
+  sink1.flush();
+  ASSERT_EQ("one\nthree\nfour\n", readFile(path1 + ".2"));
+}
@@ -0,0 +1,154 @@
+#include <gtest/gtest.h>
+#define LOG_FLIGHT_RECORDER
+#define LOG_TO_FILE
+#define LOG_FILE_PATH "/tmp/nul_log_flight_recorder_test.log"
+#include "util/log.hpp"
+#define NUL_ALLOC_TRACKER_IMPLEMENTATION
+#include "util/alloc_tracker.hpp"
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+
+using namespace nul;
+
+static const char *DUMP_PATH = "/tmp/nul_log_flight_recorder_test.binlog";
+
+static std::vector<std::string> decode(const char *path) {
+  std::vector<std::string> lines;
+  auto in = fopen(path, "rb");
+  char *text = nullptr;
+  std::size_t len = 0;
+  auto out = open_memstream(&text, &len);
+  auto ok = in && BinaryLogDecoder::decode(in, out);
+  fclose(out);
+  if (in) {
+    fclose(in);
+  }
+  if (ok) {
+    std::istringstream ss(std::string(text, len));
+    std::string line;
+    while (std::getline(ss, line)) {
+      lines.push_back(line);
+    }
+  }
+  free(text);
+  return lines;
+}
+
+static std::string message(const std::string &line) {
+  auto pos = line.find(" - ");
+  return pos == std::string::npos ? "" : line.substr(pos + 3);
+}
+
+static int evaluated = 0;
+
+static int touch() {
+  return ++evaluated;
+}
+
+TEST(FlightRecorder, Test) {
+  LogLevels::setLevel(LOG_LEVEL_ERROR);
+  LOG_V("verbose %d", touch());
+  LOG_D("debug %s", "filtered");
+  LOG_E("error %d", touch());
+  // evaluated once, even though both recorded and written
+  ASSERT_EQ(2, evaluated);
+  LOG_I("no args");
+  LOG_I("too long %s", std::string(200, 'x').c_str());
+
+  ASSERT_TRUE(FlightRecorder::dump(DUMP_PATH));
+  auto lines = decode(DUMP_PATH);
+  ASSERT_EQ(5u, lines.size());
+  ASSERT_NE(std::string::npos, lines[0].find(" nul [V] [log_flight_recorder.cc:"));
+  ASSERT_NE(std::string::npos, lines[0].find("] TestBody - verbose 1"));
+  ASSERT_EQ("debug filtered", message(lines[1]));
+  ASSERT_EQ("error 2", message(lines[2]));
+  ASSERT_EQ("no args", message(lines[3]));
+  // the arguments did not fit
+  ASSERT_EQ("too long (null)", message(lines[4]));
+  LogLevels::setLevel(LOG_LEVEL_VERBOSE);
+}
+
+TEST(FlightRecorder, Threads) {
+  LogLevels::setLevel(LogLevels::OFF);
+  constexpr int THREADS = 4;
+  constexpr int LINES = LOG_FLIGHT_RECORDER_RECORDS + 100;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < THREADS; ++t) {
+    threads.emplace_back([t]() {
+      for (int i = 0; i < LINES; ++i) {
+        LOG_D("thread=%d, line=%d", t, i);
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  LogLevels::setLevel(LOG_LEVEL_VERBOSE);
+
+  ASSERT_TRUE(FlightRecorder::dump(DUMP_PATH));
+  std::vector<int> next(THREADS, LINES - LOG_FLIGHT_RECORDER_RECORDS);
+  auto count = 0;
+  for (auto &line : decode(DUMP_PATH)) {
+    int t, i;
+    if (sscanf(message(line).c_str(), "thread=%d, line=%d", &t, &i) == 2) {
+      // only the last records of each thread, in order
+      ASSERT_EQ(next[t]++, i);
+      ++count;
+    }
+  }
+  ASSERT_EQ(THREADS * LOG_FLIGHT_RECORDER_RECORDS, count);
+}
+
+TEST(FlightRecorder, Crash) {
+  unlink(DUMP_PATH);
+  auto pid = fork();
+  if (pid == 0) {
+    FlightRecorder::installSignalHandlers(DUMP_PATH);
+    LogLevels::setLevel(LogLevels::OFF);
+    LOG_V("before the crash, %d", 42);
+    abort();
+  }
+  int status;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  ASSERT_TRUE(WIFSIGNALED(status));
+  ASSERT_EQ(SIGABRT, WTERMSIG(status));
+
+  auto lines = decode(DUMP_PATH);
+  ASSERT_FALSE(lines.empty());
+  ASSERT_EQ("before the crash, 42", message(lines.back()));
+}
+
+TEST(FlightRecorder, PreallocatedRings) {
+  ASSERT_TRUE(FlightRecorder::reserve(8));
+  LogLevels::setLevel(LogLevels::OFF);
+  uint64_t allocs = ~0ull;
+  std::thread([&allocs]() {
+    // the first record of a thread takes a ring, it does not allocate one
+    AllocScope scope;
+    LOG_D("first record of a thread, %d", 1);
+    allocs = scope.allocs();
+  }).join();
+  LogLevels::setLevel(LOG_LEVEL_VERBOSE);
+  ASSERT_EQ(0u, allocs);
+}
+
+TEST(FlightRecorder, RateLimited) {
+  LogLevels::setLevel(LogLevels::OFF);
+  for (int i = 0; i < 3; ++i) {
+    LOG_I_EVERY_N(100, "limited %d", i);
+  }
+  LogLevels::setLevel(LOG_LEVEL_VERBOSE);
+
+  ASSERT_TRUE(FlightRecorder::dump(DUMP_PATH));
+  std::vector<std::string> limited;
+  for (auto &line : decode(DUMP_PATH)) {
+    if (message(line).find("limited ") == 0) {
+      limited.push_back(message(line));
+    }
+  }
+  std::vector<std::string> expected = { "limited 0", "limited 1", "limited 2" };
+  ASSERT_EQ(expected, limited);
+}
@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+#define LOG_TO_FILE
+#define LOG_FILE_PATH "/tmp/nul_log_kv_test.log"
+#include "util/log_kv.hpp"
+#include <fstream>
+#include <string>
+
+using namespace nul;
+
+using Logfmt = BasicLogKv<LogKvFormat::LOGFMT>;
+using Json = BasicLogKv<LogKvFormat::JSON>;
+
+TEST(LogKv, Logfmt) {
+  Logfmt::Site site(LOG_LEVEL_WARN, "nul", "a.cc", 12, "f");
+  std::string out;
+  std::string path = "/a b";
+  Logfmt::format(out, "2020-01-02T03:04:05.678", site, "request done",
+      kv("status", 200), kv("path", path), kv("ok", true), kv("ratio", 0.25),
+      kv("raw", "plain"), kv("empty", ""));
+  ASSERT_EQ(
+    "time=2020-01-02T03:04:05.678 level=warn tag=nul file=a.cc line=12 func=f "
+    "msg=\"request done\" status=200 path=\"/a b\" ok=true ratio=0.25 "
+    "raw=plain empty=\"\"\n", out);
+}
+
+TEST(LogKv, Json) {
+  Json::Site site(LOG_LEVEL_INFO, "nul", "a.cc", 12, "f");
+  std::string out;
+  const char *null = nullptr;
+  Json::format(out, "2020-01-02T03:04:05.678", site, "done",
+      kv("n", -3), kv("u", 7u), kv("s", null), kv("nan", 0.0 / 0.0));
+  ASSERT_EQ(
+    "{\"time\":\"2020-01-02T03:04:05.678\",\"level\":\"info\",\"tag\":\"nul\","
+    "\"file\":\"a.cc\",\"line\":12,\"func\":\"f\",\"msg\":\"done\","
+    "\"n\":-3,\"u\":7,\"s\":null,\"nan\":null}\n", out);
+}
+
+TEST(LogKv, Escape) {
+  std::string out;
+  Json::appendString(out, "a long clean prefix \"quoted\"\\\n\x01 tail");
+  ASSERT_EQ("\"a long clean prefix \\\"quoted\\\"\\\\\\n\\u0001 tail\"", out);
+
+  out.clear();
+  Logfmt::appendString(out, "abcdefgh=ijklmnop");
+  ASSERT_EQ("\"abcdefgh=ijklmnop\"", out);
+  out.clear();
+  Logfmt::appendString(out, "abcdefghijklmnop\xc3\xa9");
+  ASSERT_EQ("abcdefghijklmnop\xc3\xa9", out);
+}
+
+TEST(LogKv, Macro) {
+  unlink(LOG_FILE_PATH);
+  LogFileSink::instance().reopen();
+  LOG_KV_I("hello", kv("id", 1));
+  LOG_KV_E("bye");
+  LogFileSink::instance().flush();
+
+  std::ifstream in(LOG_FILE_PATH);
+  std::string line;
+  ASSERT_TRUE(std::getline(in, line));
+  ASSERT_EQ(0u, line.find("time="));
+  ASSERT_NE(std::string::npos, line.find(
+      " level=info tag=nul file=log_kv.cc line="));
+  ASSERT_NE(std::string::npos, line.find(" func=TestBody msg=hello id=1"));
+  ASSERT_TRUE(std::getline(in, line));
+  ASSERT_NE(std::string::npos, line.find(" level=error "));
+  ASSERT_FALSE(std::getline(in, line));
+}
@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+#include "util/log.hpp"
+#include <csignal>
+
+using namespace nul;
+
+static int evaluated = 0;
+
+static int touch() {
+  return ++evaluated;
+}
+
+TEST(LogLevels, Global) {
+  ASSERT_EQ(LOG_LEVEL_VERBOSE, LogLevels::level());
+  ASSERT_TRUE(LogLevels::enabled(LOG_LEVEL_VERBOSE, "nul", "log_level.cc"));
+
+  LogLevels::setLevel(LOG_LEVEL_WARN);
+  ASSERT_FALSE(LogLevels::enabled(LOG_LEVEL_INFO, "nul", "log_level.cc"));
+  ASSERT_TRUE(LogLevels::enabled(LOG_LEVEL_WARN, "nul", "log_level.cc"));
+
+  // disabled records do not evaluate their arguments
+  evaluated = 0;
+  LOG_D("%d", touch());
+  LOG_I("%d", touch());
+  ASSERT_EQ(0, evaluated);
+  LOG_W("%d", touch());
+  ASSERT_EQ(1, evaluated);
+
+  LogLevels::setLevel(LogLevels::OFF);
+  LOG_E("%d", touch());
+  ASSERT_EQ(1, evaluated);
+  LogLevels::setLevel(LOG_LEVEL_VERBOSE);
+}
+
+TEST(LogLevels, Overrides) {
+  LogLevels::setLevel(LOG_LEVEL_WARN);
+  LogLevels::setLevel("nul", LOG_LEVEL_INFO);
+  LogLevels::setLevel("log_level.cc", LOG_LEVEL_DEBUG);
+  LogLevels::setLevel("quiet.cc", LogLevels::OFF);
+
+  // the file wins over the tag, the tag over the global level
+  ASSERT_TRUE(LogLevels::enabled(LOG_LEVEL_DEBUG, "nul", "log_level.cc"));
+  ASSERT_FALSE(LogLevels::enabled(LOG_LEVEL_VERBOSE, "nul", "log_level.cc"));
+  ASSERT_TRUE(LogLevels::enabled(LOG_LEVEL_INFO, "nul", "other.cc"));
+  ASSERT_FALSE(LogLevels::enabled(LOG_LEVEL_DEBUG, "nul", "other.cc"));
+  ASSERT_FALSE(LogLevels::enabled(LOG_LEVEL_INFO, "other", "other.cc"));
+  ASSERT_TRUE(LogLevels::enabled(LOG_LEVEL_WARN, "other", "other.cc"));
+  ASSERT_FALSE(LogLevels::enabled(LOG_LEVEL_ERROR, "nul", "quiet.cc"));
+
+  evaluated = 0;
+  LOG_V("%d", touch());
+  LOG_D("%d", touch());
+  ASSERT_EQ(1, evaluated);
+
+  LogLevels::clearLevel("log_level.cc");
+  ASSERT_FALSE(LogLevels::enabled(LOG_LEVEL_DEBUG, "nul", "log_level.cc"));
+  ASSERT_TRUE(LogLevels::enabled(LOG_LEVEL_INFO, "nul", "log_level.cc"));
+
+  LogLevels::clearLevels();
+  ASSERT_FALSE(LogLevels::enabled(LOG_LEVEL_INFO, "nul", "log_level.cc"));
+  LogLevels::setLevel(LOG_LEVEL_VERBOSE);
+}
+
+TEST(LogLevels, Signals) {
+  LogLevels::installSignalHandlers();
+  LogLevels::setLevel(LOG_LEVEL_INFO);
+
+  raise(SIGUSR2);
+  ASSERT_EQ(LOG_LEVEL_WARN, LogLevels::level());
+  ASSERT_FALSE(LogLevels::enabled(LOG_LEVEL_INFO, "nul", "log_level.cc"));
+  for (int i = 0; i < 5; ++i) {
+    raise(SIGUSR2);
+  }
+  ASSERT_EQ(LogLevels::OFF, LogLevels::level());
+
+  for (int i = 0; i < 10; ++i) {
+    raise(SIGUSR1);
+  }
+  ASSERT_EQ(LOG_LEVEL_VERBOSE, LogLevels::level());
+  ASSERT_TRUE(LogLevels::enabled(LOG_LEVEL_VERBOSE, "nul", "log_level.cc"));
+}
@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+#define LOG_TO_FILE
+#define LOG_FILE_PATH "/tmp/nul_log_rate_limit_test.log"
+#include "util/log.hpp"
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace nul;
+
+static std::vector<std::string> readLines(const char *path) {
+  LogFileSink::instance().flush();
+  std::vector<std::string> lines;
+  std::ifstream in(path);
+  std::string line;
+  while (std::getline(in, line)) {
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+// the sink keeps the file open
+static void truncateLog() {
+  unlink(LOG_FILE_PATH);
+  LogFileSink::instance().reopen();
+}
+
+TEST(LogRateLimit, EveryN) {
+  LogEveryN limiter;
+  uint64_t suppressed = 42;
+  ASSERT_TRUE(limiter.allow(3, suppressed));
+  ASSERT_EQ(0u, suppressed);
+  ASSERT_FALSE(limiter.allow(3, suppressed));
+  ASSERT_FALSE(limiter.allow(3, suppressed));
+  ASSERT_TRUE(limiter.allow(3, suppressed));
+  ASSERT_EQ(2u, suppressed);
+
+  truncateLog();
+  for (int i = 0; i < 10; ++i) {
+    LOG_W_EVERY_N(4, "every n, i=%d", i);
+  }
+  auto lines = readLines(LOG_FILE_PATH);
+  ASSERT_EQ(3u, lines.size());
+  ASSERT_NE(std::string::npos, lines[0].find("- every n, i=0"));
+  ASSERT_NE(std::string::npos, lines[1].find("- every n, i=4 (suppressed 3 messages)"));
+  ASSERT_NE(std::string::npos, lines[2].find("- every n, i=8 (suppressed 3 messages)"));
+}
+
+TEST(LogRateLimit, EveryMs) {
+  truncateLog();
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 100; ++j) {
+      LOG_I_EVERY_MS(50, "every ms");
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+  }
+  auto lines = readLines(LOG_FILE_PATH);
+  ASSERT_EQ(3u, lines.size());
+  ASSERT_EQ(std::string::npos, lines[0].find("suppressed"));
+  ASSERT_NE(std::string::npos, lines[1].find("- every ms (suppressed 99 messages)"));
+  ASSERT_NE(std::string::npos, lines[2].find("- every ms (suppressed 99 messages)"));
+}
+
+TEST(LogRateLimit, TokenBucket) {
+  LogRateLimiter limiter;
+  uint64_t suppressed = 0;
+  std::atomic<int> allowed{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&]() {
+      uint64_t s;
+      for (int i = 0; i < 10000; ++i) {
+        if (limiter.allow(100, s)) {
+          ++allowed;
+        }
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  // the burst, plus whatever was refilled meanwhile
+  ASSERT_GE(allowed.load(), 100);
+  ASSERT_LT(allowed.load(), 150);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  ASSERT_TRUE(limiter.allow(100, suppressed));
+  ASSERT_EQ(40000u - allowed.load(), suppressed);
+  ASSERT_FALSE(limiter.allow(0, suppressed));
+
+  truncateLog();
+  for (int i = 0; i < 1000; ++i) {
+    LOG_E_RATE_LIMITED(10, "rate limited");
+  }
+  ASSERT_EQ(10u, readLines(LOG_FILE_PATH).size());
+}
@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+#include "util/log.hpp"
+#include <string>
+#include <thread>
+#include <vector>
+
+static std::string expectedPrefix(time_t sec) {
+  struct tm tm;
+  localtime_r(&sec, &tm);
+  char buf[TIME_BUFFER_SIZE];
+  auto len = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S.", &tm);
+  return std::string(buf, len);
+}
+
+// time() may lag CLOCK_REALTIME by a tick, log_strtime() reads the latter
+static time_t nowSec() {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return now.tv_sec;
+}
+
+// whether the time in 's' is one of the seconds [before, after]
+static bool matchesClock(const std::string &s, time_t before, time_t after) {
+  auto prefix = s.substr(0, s.size() - 3);
+  for (auto sec = before; sec <= after; ++sec) {
+    if (prefix == expectedPrefix(sec)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+TEST(LogStrtime, Format) {
+  char buf[TIME_BUFFER_SIZE];
+  auto before = nowSec();
+  std::string s = log_strtime(buf);
+  auto after = nowSec();
+
+  // "%Y-%m-%d %H:%M:%S.mmm"
+  ASSERT_EQ(23u, s.size());
+  ASSERT_TRUE(matchesClock(s, before, after)) << s;
+  for (auto i = s.size() - 3; i < s.size(); ++i) {
+    ASSERT_TRUE(isdigit(static_cast<unsigned char>(s[i]))) << s;
+  }
+}
+
+TEST(LogStrtime, RefreshedEverySecond) {
+  // each thread has its own cache, both must see the seconds change
+  std::vector<std::thread> threads;
+  std::vector<int> changes(2, 0);
+  std::vector<int> mismatches(2, 0);
+  for (int t = 0; t < 2; ++t) {
+    threads.emplace_back([t, &changes, &mismatches]() {
+      char buf[TIME_BUFFER_SIZE];
+      std::string last;
+      auto end = nowSec() + 2;
+      while (nowSec() <= end) {
+        auto before = nowSec();
+        std::string s = log_strtime(buf);
+        auto after = nowSec();
+        if (!matchesClock(s, before, after)) {
+          ++mismatches[t];
+        }
+        auto prefix = s.substr(0, s.size() - 3);
+        if (!last.empty() && prefix != last) {
+          ++changes[t];
+        }
+        last = prefix;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  for (int t = 0; t < 2; ++t) {
+    ASSERT_EQ(0, mismatches[t]);
+    ASSERT_GE(changes[t], 2);
+  }
+}
@@ -0,0 +1,157 @@
+#include <gtest/gtest.h>
+#define ENABLE_PROFILING
+#define PROFILE_AGGREGATE
+#define PROFILE_METRICS
+#include "util/metrics.hpp"
+#include "util/circular_buffer.hpp"
+#include "util/profiler.hpp"
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace nul;
+
+static bool contains(const std::string &s, const std::string &what) {
+  return s.find(what) != std::string::npos;
+}
+
+TEST(Metrics, Test) {
+  metrics::Registry r;
+  auto requests = r.counter("requests_total", "Requests",
+      {{"method", "get"}});
+  ASSERT_NE(nullptr, requests);
+  ASSERT_EQ(requests, r.counter("requests_total", "Requests",
+        {{"method", "get"}}));
+  ASSERT_EQ(nullptr, r.gauge("requests_total", "wrong type"));
+  ASSERT_EQ(nullptr, r.counter("0bad", "invalid name"));
+  ASSERT_EQ(nullptr, r.counter("ok", "invalid label", {{"a:b", "c"}}));
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([requests]() {
+      for (int i = 0; i < 1000; ++i) {
+        requests->inc();
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  ASSERT_EQ(4000u, requests->value());
+
+  auto temperature = r.gauge("temperature", "Degrees");
+  temperature->set(20.5);
+  temperature->add(-1);
+  ASSERT_EQ(19.5, temperature->value());
+
+  auto latency = r.histogram("latency_seconds", "Latency", { 0.1, 0.01, 1 });
+  for (auto v : { 0.005, 0.05, 0.05, 0.5, 5.0 }) {
+    latency->observe(v);
+  }
+  auto h = latency->snapshot();
+  ASSERT_EQ(5u, h.count);
+  ASSERT_EQ((std::vector<uint64_t>{ 1, 2, 1, 1 }), h.counts);
+
+  auto snap = r.snapshot();
+  ASSERT_EQ(3u, snap.families.size());
+  ASSERT_EQ("latency_seconds", snap.families[0].name);
+  ASSERT_EQ(6u, snap.find("latency_seconds")->samples.size());
+
+  ASSERT_EQ(
+      "# HELP latency_seconds Latency\n"
+      "# TYPE latency_seconds histogram\n"
+      "latency_seconds_bucket{le=\"0.01\"} 1\n"
+      "latency_seconds_bucket{le=\"0.1\"} 3\n"
+      "latency_seconds_bucket{le=\"1\"} 4\n"
+      "latency_seconds_bucket{le=\"+Inf\"} 5\n"
+      "latency_seconds_sum 5.605\n"
+      "latency_seconds_count 5\n"
+      "# HELP requests_total Requests\n"
+      "# TYPE requests_total counter\n"
+      "requests_total{method=\"get\"} 4000\n"
+      "# HELP temperature Degrees\n"
+      "# TYPE temperature gauge\n"
+      "temperature 19.5\n", r.text());
+
+  auto escaped = r.gauge("escaped", "a \\ b\nc", {{"v", "\"x\"\n"}});
+  escaped->set(1);
+  auto text = r.text();
+  ASSERT_TRUE(contains(text, "# HELP escaped a \\\\ b\\nc\n"));
+  ASSERT_TRUE(contains(text, "escaped{v=\"\\\"x\\\"\\n\"} 1\n"));
+}
+
+TEST(Metrics, Collectors) {
+  metrics::Registry r;
+
+  BufferPool pool(1024, 2);
+  auto poolId = metrics::addBufferPool(r, "net", pool);
+  auto b1 = pool.requestBuffer(100);
+  auto b2 = pool.requestBuffer(4096);
+  pool.returnBuffer(std::move(b2));
+  auto s = pool.stats();
+  ASSERT_EQ(2u, s.requests);
+  ASSERT_EQ(1u, s.misses);
+  ASSERT_EQ(1u, s.dropped);
+  ASSERT_EQ(1u, s.freeBuffers);
+  ASSERT_EQ(1024u, s.freeBytes);
+
+  CircularBuffer<int, 4, QueueStats> queue;
+  metrics::addQueue(r, "work", queue.stats());
+  queue.put(1);
+  queue.put(2);
+  queue.take();
+
+  auto text = r.text();
+  ASSERT_TRUE(contains(text, "nul_buffer_pool_requests_total{pool=\"net\"} 2\n"));
+  ASSERT_TRUE(contains(text, "nul_buffer_pool_free_bytes{pool=\"net\"} 1024\n"));
+  ASSERT_TRUE(contains(text, "nul_queue_enqueued_total{queue=\"work\"} 2\n"));
+  ASSERT_TRUE(contains(text, "nul_queue_occupancy{queue=\"work\"} 1\n"));
+  ASSERT_TRUE(contains(text, "# TYPE nul_queue_put_blocked_seconds summary\n"));
+  ASSERT_TRUE(contains(text,
+        "nul_queue_take_waited_seconds{queue=\"work\",quantile=\"0.99\"} NaN\n"));
+
+  pool.returnBuffer(std::move(b1));
+  s = pool.stats();
+  ASSERT_EQ(2u, s.freeBuffers);
+  ASSERT_EQ(2048u, s.freeBytes);
+  ASSERT_EQ(2048u, pool.getTotalBufferSize());
+
+  r.removeCollector(poolId);
+  ASSERT_FALSE(contains(r.text(), "nul_buffer_pool"));
+
+  metrics::addProfileSites(r);
+  {
+    PROFILE_TIME_COST_USEC("step");
+  }
+  text = r.text();
+  ASSERT_TRUE(contains(text, "# TYPE nul_profile_seconds summary\n"));
+  ASSERT_TRUE(contains(text, "function=\"TestBody\",label=\"step\"} 1\n"));
+}
+
+TEST(Metrics, Exporter) {
+  metrics::Registry r;
+  r.counter("exports_total", "Exports")->inc(3);
+  const char *path = "/tmp/nul_metrics_test.prom";
+  unlink(path);
+  ASSERT_FALSE(r.writeFile("/nonexistent/dir/x.prom"));
+  ASSERT_TRUE(r.writeFile(path));
+
+  auto read = [path]() {
+    std::ifstream in(path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+  };
+  ASSERT_TRUE(contains(read(), "exports_total 3\n"));
+
+  r.startExporter(path, std::chrono::milliseconds(10));
+  r.counter("exports_total", "Exports")->inc();
+  for (int i = 0; i < 200 && !contains(read(), "exports_total 4\n"); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  r.stopExporter();
+  ASSERT_TRUE(contains(read(), "exports_total 4\n"));
+  unlink(path);
+}
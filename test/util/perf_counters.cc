@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+#define ENABLE_PROFILING
+#define PROFILE_AGGREGATE
+#define PROFILE_PERF_COUNTERS
+#include "util/profiler.hpp"
+#include <string>
+#include <vector>
+
+using namespace nul;
+
+// software events, counted where there is no PMU (e.g. in a VM)
+static const int TASK_CLOCK = 5;
+static const int PAGE_FAULTS = 6;
+
+static void touchPages(int pages) {
+  std::vector<char> v(pages * 4096);
+  for (std::size_t i = 0; i < v.size(); i += 4096) {
+    reinterpret_cast<volatile char &>(v[i]) = 1;
+  }
+}
+
+static void work() {
+  PROFILE_TIME_COST_USEC("work");
+  touchPages(64);
+}
+
+TEST(PerfCounters, Test) {
+  auto events = PerfCounters::defaultEvents();
+  ASSERT_EQ(5u, events.size());
+  events.push_back({ "task_clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK });
+  events.push_back({ "page_faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS });
+  auto tooMany = events;
+  tooMany.resize(PerfCounters::MAX_EVENTS + 1, events[0]);
+  ASSERT_FALSE(PerfCounters::setEvents(tooMany));
+  ASSERT_TRUE(PerfCounters::setEvents(events));
+  ASSERT_STREQ("page_faults", PerfCounters::name(PAGE_FAULTS));
+
+  PerfCounters::Sample begin, end;
+  PerfCounters::read(begin);
+  touchPages(64);
+  PerfCounters::read(end);
+  // the events are fixed once a thread counts them
+  ASSERT_FALSE(PerfCounters::setEvents(events));
+
+  if (!PerfCounters::available()) {
+    // perf_event_open is denied, profiling falls back to time only
+    ASSERT_EQ(0u, begin.valid);
+    ASSERT_EQ(0u, end.valid);
+    GTEST_SKIP();
+  }
+  ASSERT_EQ(begin.valid, end.valid);
+  if (end.valid & (1u << TASK_CLOCK)) {
+    ASSERT_GT(end.values[TASK_CLOCK], begin.values[TASK_CLOCK]);
+    ASSERT_GE(end.values[PAGE_FAULTS], begin.values[PAGE_FAULTS]);
+  }
+  if (end.valid & 2) {
+    // instructions
+    ASSERT_GT(end.values[1] - begin.values[1], 64u);
+  }
+}
+
+TEST(PerfCounters, Profiler) {
+  PerfCounters::Sample sample;
+  PerfCounters::read(sample);
+  for (int i = 0; i < 10; ++i) {
+    work();
+  }
+  char *text = nullptr;
+  std::size_t len = 0;
+  auto out = open_memstream(&text, &len);
+  ProfileRegistry::instance().report(out, true);
+  fclose(out);
+  std::string s(text, len);
+  free(text);
+
+  ASSERT_NE(std::string::npos, s.find("work, count: 10,"));
+  for (int i = 0; i < PerfCounters::MAX_EVENTS; ++i) {
+    if (sample.valid & (1u << i)) {
+      ASSERT_NE(std::string::npos,
+          s.find(std::string(", ") + PerfCounters::name(i) + ": "));
+    }
+  }
+  if (sample.valid == 0) {
+    ASSERT_EQ(std::string::npos, s.find("task_clock"));
+  }
+}
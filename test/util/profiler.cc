@@ -0,0 +1,187 @@
+#include <gtest/gtest.h>
+#define ENABLE_PROFILING
+#define PROFILE_AGGREGATE
+#include "util/profiler.hpp"
+#include "capture_stderr.hpp"
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace nul;
+
+static std::string report(bool reset = false) {
+  char *text = nullptr;
+  std::size_t len = 0;
+  auto out = open_memstream(&text, &len);
+  ProfileRegistry::instance().report(out, reset);
+  fclose(out);
+  std::string s(text, len);
+  free(text);
+  return s;
+}
+
+static void work(int micros) {
+  PROFILE_TIME_COST_USEC("work %d", micros);
+  std::this_thread::sleep_for(std::chrono::microseconds(micros));
+}
+
+TEST(ShardedHistogram, Test) {
+  ShardedHistogram<4> h;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&h, t]() {
+      for (int i = 1; i <= 1000; ++i) {
+        h.record(t * 1000 + i);
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  auto s = h.snapshot();
+  ASSERT_EQ(8000u, h.count());
+  ASSERT_EQ(8000u, s.count);
+  ASSERT_EQ(1u, s.min);
+  ASSERT_EQ(8000u, s.max);
+  ASSERT_NEAR(4000.0, s.percentile(50), 4000 * 0.0625);
+  h.reset();
+  ASSERT_EQ(0u, h.snapshot().count);
+}
+
+TEST(ProfileRegistry, Aggregate) {
+  for (int i = 0; i < 20; ++i) {
+    work(i < 10 ? 100 : 2000);
+  }
+
+  auto sites = ProfileRegistry::instance().sites();
+  ASSERT_EQ(1u, sites.size());
+  ASSERT_STREQ("work %d", sites[0]->label());
+  ASSERT_STREQ("us", sites[0]->unit());
+  auto s = sites[0]->snapshot();
+  ASSERT_EQ(20u, s.count);
+  ASSERT_GE(s.min, 100000u);
+  ASSERT_GE(s.percentile(90), 2000000u);
+
+  auto line = report(true);
+  ASSERT_NE(std::string::npos, line.find(" [I] [profiler.cc#"));
+  ASSERT_NE(std::string::npos, line.find("] work - work %d, count: 20, min: "));
+  ASSERT_NE(std::string::npos, line.find(" us\n"));
+  // reset, nothing to report
+  ASSERT_EQ("", report());
+
+  char *text = nullptr;
+  std::size_t len = 0;
+  auto out = open_memstream(&text, &len);
+  ProfileRegistry::instance().startReporter(std::chrono::milliseconds(20), true, out);
+  work(10);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  ProfileRegistry::instance().stopReporter();
+  fclose(out);
+  ASSERT_NE(std::string::npos, std::string(text, len).find("count: 1,"));
+  free(text);
+}
+
+TEST(TscClock, Test) {
+  auto begin = TscClock::now();
+  auto steadyBegin = std::chrono::steady_clock::now();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  auto elapsed = TscClock::now() - begin;
+  auto steadyElapsed = std::chrono::steady_clock::now() - steadyBegin;
+
+  // within 1% of CLOCK_MONOTONIC, plus the time between the two reads
+  auto diff = std::chrono::duration_cast<std::chrono::microseconds>(
+      elapsed - steadyElapsed).count();
+  ASSERT_LT(std::abs(diff), 200 + 200);
+  ASSERT_GE(TscClock::nowOrdered(), begin + elapsed);
+  if (TscClock::usable()) {
+    ASSERT_GT(TscClock::ticksPerNanosecond(), 0.1);
+  } else {
+    ASSERT_EQ(0.0, TscClock::ticksPerNanosecond());
+  }
+
+  // the scope object, with the clock as a policy
+  {
+    Profiler<std::chrono::microseconds, TscClock> p(
+        "profiler.cc", "TestBody", __LINE__, "tsc %d", 1);
+  }
+  AggregatingProfiler<TscClock> scope(ProfileRegistry::instance().site<
+      std::chrono::nanoseconds>("profiler.cc", "TestBody", __LINE__, "tsc"));
+}
+
+TEST(Profiler, LazyAndThreshold) {
+  using namespace std::chrono_literals;
+  using Usec = Profiler<std::chrono::microseconds>;
+
+  auto out = captureStderr([]() {
+    // the temporary is gone before the message is formatted
+    Usec p("profiler.cc", "TestBody", 1, "id=%d, name=%s, ratio=%.1f", 7,
+        std::string("temp").c_str(), 0.5);
+  });
+  ASSERT_NE(std::string::npos, out.find(
+      "[profiler.cc#1] TestBody - id=7, name=temp, ratio=0.5, time_cost: "));
+
+  out = captureStderr([]() {
+    Usec fast("profiler.cc", "TestBody", 2, 50ms, "fast %d", 1);
+  });
+  ASSERT_EQ("", out);
+
+  out = captureStderr([]() {
+    Usec slow("profiler.cc", "TestBody", 3, 1ms, "slow %d", 2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  });
+  ASSERT_NE(std::string::npos, out.find("TestBody - slow 2, time_cost: "));
+
+  // too large for the inline storage, formatted up front
+  out = captureStderr([]() {
+    Usec p("profiler.cc", "TestBody", 4, "%s", std::string(200, 'x').c_str());
+  });
+  ASSERT_NE(std::string::npos, out.find(std::string(200, 'x') + ", time_cost"));
+}
+
+namespace {
+  struct SlowScopeOwner {
+    std::chrono::milliseconds limit{1};
+
+    void run(int sleepMillis) {
+      PROFILE_SLOW_SCOPE(limit, "member %d", sleepMillis);
+      std::this_thread::sleep_for(std::chrono::milliseconds(sleepMillis));
+    }
+  };
+}
+
+TEST(Profiler, SlowScopeThresholds) {
+  // a runtime threshold
+  auto out = captureStderr([]() {
+    auto limit = std::chrono::milliseconds(50);
+    PROFILE_SLOW_SCOPE(limit, "local %d", 1);
+  });
+  ASSERT_EQ("", out);
+  out = captureStderr([]() {
+    auto limit = std::chrono::milliseconds(1);
+    PROFILE_SLOW_SCOPE(limit, "local %d", 2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  });
+  ASSERT_NE(std::string::npos, out.find("local 2, time_cost: "));
+
+  // an integer is microseconds
+  out = captureStderr([]() {
+    PROFILE_SLOW_SCOPE(50000, "integer %d", 1);
+  });
+  ASSERT_EQ("", out);
+  out = captureStderr([]() {
+    PROFILE_SLOW_SCOPE(1000, "integer %d", 2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  });
+  ASSERT_NE(std::string::npos, out.find("integer 2, time_cost: "));
+
+  // a chrono literal and a member
+  out = captureStderr([]() {
+    PROFILE_SLOW_SCOPE(50ms, "literal %d", 1);
+  });
+  ASSERT_EQ("", out);
+  out = captureStderr([]() {
+    SlowScopeOwner owner;
+    owner.run(2);
+  });
+  ASSERT_NE(std::string::npos, out.find("member 2, time_cost: "));
+}
@@ -0,0 +1,73 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include "util/scan.hpp"
+
+using namespace nul;
+
+TEST(Scan, ByteSet) {
+  constexpr ByteSet set{":/?"};
+  static_assert(set.contains(':'), "");
+  static_assert(!set.contains('a'), "");
+  ASSERT_EQ(3, set.size());
+  ASSERT_EQ(3, ByteSet{"::/?/"}.size());
+  ASSERT_TRUE(ByteSet{"\xff"}.contains(0xff));
+  ASSERT_FALSE(ByteSet{}.contains(0));
+}
+
+TEST(Scan, FindFirstOf) {
+  constexpr ByteSet set{":/?"};
+  ASSERT_EQ(Scan::npos, Scan::findFirstOf("", set));
+  ASSERT_EQ(Scan::npos, Scan::findFirstOf("abc", set));
+  ASSERT_EQ(4u, Scan::findFirstOf("http://host", set));
+  ASSERT_EQ(5u, Scan::findFirstOf("http://host", set, 5));
+  ASSERT_EQ(Scan::npos, Scan::findFirstOf("http://host", set, 7));
+  ASSERT_EQ(Scan::npos, Scan::findFirstOf("http", set, 100));
+
+  auto longStr = std::string(1000, 'a') + "?" + std::string(100, 'b');
+  ASSERT_EQ(1000u, Scan::findFirstOf(longStr, set));
+  ASSERT_EQ(Scan::npos, Scan::findFirstOf(longStr, set, 1001));
+  // the boundary of the searched range is respected
+  ASSERT_EQ(Scan::npos,
+    Scan::findFirstOf(std::string_view(longStr).substr(0, 1000), set));
+
+  ASSERT_EQ(1000u, Scan::find(longStr, '?'));
+  ASSERT_EQ(Scan::npos, Scan::find(longStr, '?', 1001));
+}
+
+TEST(Scan, ImplsMatchScalar) {
+  const ByteSet sets[] = {
+    ByteSet{"?"},
+    ByteSet{":/?"},
+    ByteSet{"&=;#%+"},
+    ByteSet{"0123456789abcdef"},
+    // more than pcmpestri takes
+    ByteSet{"0123456789abcdefghijklmnopqrstuvwxyz"},
+    // not ASCII, no nibble lookup
+    ByteSet{"\x80\xfe?"},
+  };
+  const Scan::Impl impls[] = {
+    Scan::Impl::SSE42,
+    Scan::Impl::AVX2,
+  };
+
+  std::mt19937 rng(42);
+  for (int round = 0; round < 200; ++round) {
+    auto s = std::string(rng() % 200, '\0');
+    for (auto &c : s) {
+      // sparse matches, and every byte value including '\0' and >= 0x80
+      c = static_cast<char>(rng() % 8 == 0 ? rng() : 'x');
+    }
+    for (const auto &set : sets) {
+      for (std::size_t pos = 0; pos <= s.size(); pos += 7) {
+        auto expected = Scan::findFirstOf(Scan::Impl::SCALAR, s, set, pos);
+        for (auto impl : impls) {
+          if (Scan::supports(impl)) {
+            ASSERT_EQ(expected, Scan::findFirstOf(impl, s, set, pos))
+              << "impl " << static_cast<int>(impl) << ", pos " << pos;
+          }
+        }
+      }
+    }
+  }
+}
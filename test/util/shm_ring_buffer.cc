@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+#include "util/shm_ring_buffer.hpp"
+#include <string>
+#include <sys/wait.h>
+
+using namespace nul;
+
+static std::string makeRecord(int i) {
+  return std::string(i % 97, 'a' + i % 26) + std::to_string(i);
+}
+
+TEST(ShmRingBuffer, Test) {
+  auto ring = ShmRingBuffer::createAnonymous(100);
+  ASSERT_TRUE(!!ring);
+  ASSERT_EQ(128, ring->capacity());
+  ASSERT_EQ(60, ring->maxRecordSize());
+  ASSERT_TRUE(ring->empty());
+  ASSERT_FALSE(ring->put("x", 61));
+  ASSERT_EQ(nullptr, ring->takeOrDefault());
+
+  // wraps around the ring several times
+  for (int i = 0; i < 100; ++i) {
+    auto s = makeRecord(i % 50);
+    ASSERT_TRUE(ring->tryPut(s.data(), s.size()));
+    auto buf = ring->takeOrDefault();
+    ASSERT_TRUE(!!buf);
+    ASSERT_EQ(s, std::string(buf->getData(), buf->getLength()));
+  }
+
+  ASSERT_TRUE(ring->tryPut("hello", 5));
+  ASSERT_TRUE(ring->tryPut("", 0));
+  auto s = std::string(20, 'x');
+  while (ring->tryPut(s.data(), s.size())) { }
+  ASSERT_FALSE(ring->put(s.data(), s.size(), 1));
+
+  ring->interrupt();
+  ASSERT_FALSE(ring->tryPut("world", 5));
+  ASSERT_TRUE(ring->takeWith([](const char *data, std::size_t len) {
+    ASSERT_EQ(std::string("hello"), std::string(data, len));
+  }));
+  ASSERT_EQ(0, ring->take()->getLength());
+  while (ring->takeOrDefault()) { }
+  ASSERT_TRUE(ring->interruptedAndEmpty());
+  ASSERT_EQ(nullptr, ring->take());
+}
+
+TEST(ShmRingBuffer, CrossProcess) {
+  auto name = "/nul_shm_ring_test_" + std::to_string(getpid());
+  auto ring = ShmRingBuffer::create(name, 4096);
+  ASSERT_TRUE(!!ring);
+
+  constexpr auto COUNT = 100000;
+  auto pid = fork();
+  ASSERT_NE(-1, pid);
+  if (pid == 0) {
+    auto producer = ShmRingBuffer::open(name);
+    if (!producer) {
+      _exit(1);
+    }
+    for (int i = 0; i < COUNT; ++i) {
+      auto s = makeRecord(i);
+      if (!producer->put(s.data(), s.size())) {
+        _exit(2);
+      }
+    }
+    producer->interrupt();
+    _exit(0);
+  }
+
+  int i = 0;
+  while (auto buf = ring->take()) {
+    ASSERT_EQ(makeRecord(i), std::string(buf->getData(), buf->getLength()));
+    ++i;
+  }
+  ASSERT_EQ(COUNT, i);
+  ASSERT_TRUE(ring->interruptedAndEmpty());
+
+  int status = 0;
+  waitpid(pid, &status, 0);
+  ASSERT_EQ(0, WEXITSTATUS(status));
+  ASSERT_TRUE(ShmRingBuffer::unlink(name));
+  ASSERT_EQ(nullptr, ShmRingBuffer::open(name));
+}
@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+#include "util/thread_pool.hpp"
+#include <atomic>
+#include <numeric>
+#include <stdexcept>
+
+using namespace nul;
+
+TEST(WorkStealingDeque, Test) {
+  WorkStealingDeque<int *, 4> dq;
+  int v[5] = {0, 1, 2, 3, 4};
+  ASSERT_TRUE(dq.empty());
+  ASSERT_EQ(nullptr, dq.pop());
+  ASSERT_EQ(nullptr, dq.steal());
+
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_TRUE(dq.push(&v[i]));
+  }
+  ASSERT_FALSE(dq.push(&v[4]));
+
+  ASSERT_EQ(&v[3], dq.pop());
+  ASSERT_EQ(&v[0], dq.steal());
+  ASSERT_EQ(&v[2], dq.pop());
+  ASSERT_EQ(&v[1], dq.steal());
+  ASSERT_TRUE(dq.empty());
+}
+
+TEST(ThreadPool, Submit) {
+  ThreadPool pool{4};
+  ASSERT_EQ(4, pool.threadCount());
+
+  std::vector<TaskFuture<int>> futures;
+  for (int i = 0; i < 100; ++i) {
+    futures.push_back(pool.submit([i]() { return i * i; }));
+  }
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_TRUE(futures[i].valid());
+    ASSERT_EQ(i * i, futures[i].get());
+  }
+
+  auto f = pool.submit([]() { throw std::runtime_error("failed"); });
+  ASSERT_THROW(f.get(), std::runtime_error);
+
+  auto done = false;
+  pool.submit([&done]() { done = true; }).get();
+  ASSERT_TRUE(done);
+}
+
+TEST(ThreadPool, NestedSubmit) {
+  ThreadPool pool{2};
+  auto f = pool.submit([&pool]() {
+    std::vector<TaskFuture<int>> inner;
+    for (int i = 0; i < 64; ++i) {
+      inner.push_back(pool.submit([i]() { return i; }));
+    }
+    auto sum = 0;
+    for (auto &fi : inner) {
+      sum += fi.get();
+    }
+    return sum;
+  });
+  ASSERT_EQ(64 * 63 / 2, f.get());
+}
+
+TEST(ThreadPool, ParallelFor) {
+  ThreadPool pool{4};
+  std::vector<int> v(10000, 0);
+  pool.parallel_for(0, v.size(), [&v](std::size_t i) { v[i] = i; });
+  for (std::size_t i = 0; i < v.size(); ++i) {
+    ASSERT_EQ(i, v[i]);
+  }
+
+  std::atomic<int> sum{0};
+  pool.parallel_for(0, 8, [&](std::size_t i) {
+    pool.parallel_for(0, 100, [&](std::size_t j) { sum.fetch_add(1); });
+  }, 1);
+  ASSERT_EQ(800, sum.load());
+
+  ASSERT_THROW(
+    pool.parallel_for(0, 100, [](std::size_t i) {
+      if (i == 42) throw std::runtime_error("failed");
+    }),
+    std::runtime_error);
+}
+
+TEST(ThreadPool, Shutdown) {
+  std::atomic<int> count{0};
+  ThreadPool pool{2};
+  for (int i = 0; i < 200; ++i) {
+    pool.execute([&count]() {
+      std::this_thread::sleep_for(std::chrono::microseconds(10));
+      count.fetch_add(1);
+    });
+  }
+  pool.shutdown();
+  ASSERT_TRUE(pool.interrupted());
+  ASSERT_EQ(200, count.load());
+  ASSERT_FALSE(pool.execute([]() {}));
+  ASSERT_FALSE(pool.submit([]() { return 1; }).valid());
+}
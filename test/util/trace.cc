@@ -0,0 +1,85 @@
+#include <gtest/gtest.h>
+#define ENABLE_TRACING
+#include "util/trace.hpp"
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace nul;
+
+static std::string writeTrace() {
+  char *text = nullptr;
+  std::size_t len = 0;
+  auto out = open_memstream(&text, &len);
+  Tracer::instance().write(out);
+  fclose(out);
+  std::string s(text, len);
+  free(text);
+  return s;
+}
+
+static std::size_t countOf(const std::string &s, const std::string &what) {
+  std::size_t n = 0;
+  for (auto pos = s.find(what); pos != std::string::npos;
+       pos = s.find(what, pos + 1)) {
+    ++n;
+  }
+  return n;
+}
+
+static void inner(int i) {
+  TRACE_SCOPE("inner", kv("i", i), kv("name", "x\"y"), kv("ratio", 0.5));
+}
+
+TEST(Tracer, Test) {
+  auto &tracer = Tracer::instance();
+  {
+    TRACE_SCOPE("disabled");
+  }
+  ASSERT_EQ("{\"traceEvents\":[],\"displayTimeUnit\":\"ns\"}\n", writeTrace());
+
+  tracer.start();
+  {
+    TRACE_SCOPE("outer");
+    inner(1);
+    inner(2);
+  }
+  std::thread t([]() {
+    Tracer::setThreadName("worker");
+    TRACE_SCOPE("in thread", kv("n", 3u));
+  });
+  t.join();
+  tracer.stop();
+
+  auto json = writeTrace();
+  ASSERT_EQ(0u, json.find("{\"traceEvents\":["));
+  ASSERT_EQ(1u, countOf(json, "\"name\":\"outer\",\"cat\":\"nul\",\"ph\":\"X\""));
+  ASSERT_EQ(2u, countOf(json, "\"name\":\"inner\""));
+  ASSERT_EQ(1u, countOf(json,
+      "\"args\":{\"depth\":1,\"i\":1,\"name\":\"x\\\"y\",\"ratio\":0.5}}"));
+  ASSERT_EQ(1u, countOf(json, "\"args\":{\"depth\":0}}"));
+  ASSERT_EQ(1u, countOf(json,
+      "\"name\":\"thread_name\",\"ph\":\"M\""));
+  ASSERT_EQ(1u, countOf(json, "\"args\":{\"name\":\"worker\"}"));
+  ASSERT_EQ(1u, countOf(json, "\"args\":{\"depth\":0,\"n\":3}}"));
+
+  tracer.clear();
+  ASSERT_EQ(std::string::npos, writeTrace().find("\"inner\""));
+}
+
+TEST(Tracer, Bounded) {
+  auto &tracer = Tracer::instance();
+  tracer.clear();
+  tracer.start();
+  for (int i = 0; i < TRACE_BUFFER_EVENTS + 10; ++i) {
+    inner(i);
+  }
+  tracer.stop();
+  ASSERT_EQ(10u, tracer.overwritten());
+  auto json = writeTrace();
+  ASSERT_EQ(static_cast<std::size_t>(TRACE_BUFFER_EVENTS),
+      countOf(json, "\"name\":\"inner\""));
+  // the oldest were overwritten
+  ASSERT_EQ(std::string::npos, json.find("\"i\":9,"));
+  ASSERT_NE(std::string::npos, json.find("\"i\":10,"));
+}
@@ -1,4 +1,7 @@
 #include <gtest/gtest.h>
+#include <string>
+#include <utility>
+#include <vector>
 #include "util/uri.hpp"
 
 using namespace nul;
@@ -87,3 +90,160 @@ TEST(URI, Test) {
   ASSERT_STREQ("fe::1234:34", uri.getHost().c_str());
   ASSERT_EQ(0, uri.getPort());
 }
+
+TEST(URI, View) {
+  auto view = UriView{};
+  ASSERT_FALSE(view.parse(""));
+
+  std::string s = "https://user@[::1]:8080/a/b?k=v#frag";
+  ASSERT_TRUE(view.parse(s));
+  ASSERT_EQ("https", view.getScheme());
+  ASSERT_EQ("user@[::1]:8080", view.getAuthority());
+  ASSERT_EQ("user", view.getUserInfo());
+  ASSERT_EQ("::1", view.getHost());
+  ASSERT_EQ(8080, view.getPort());
+  ASSERT_EQ("/a/b", view.getPath());
+  ASSERT_EQ("k=v", view.getQueryStr());
+  ASSERT_EQ("frag", view.getFragment());
+  // components point into the parsed string
+  ASSERT_EQ(s.data() + 8, view.getUserInfo().data());
+
+  // parsing again resets the previous components
+  ASSERT_TRUE(view.parse("www.google.com:443"));
+  ASSERT_EQ("", view.getScheme());
+  ASSERT_EQ("www.google.com", view.getHost());
+  ASSERT_EQ(443, view.getPort());
+  ASSERT_EQ("", view.getFragment());
+
+  ASSERT_TRUE(view.parse("http://host:80x/"));
+  ASSERT_EQ(0, view.getPort());
+}
+
+TEST(URI, ViewMatchesURI) {
+  const char *uris[] = {
+    "http://google.com",
+    "https://www.google.com:443/hello/world?key=value#hash",
+    "https://user@www.google.com:443/hello/world?key=value&k2=v2#hash",
+    "http://[fe80::1]:53/",
+    "mailto:someone@example.com",
+    "/relative/path?q",
+    "?only=query",
+    "#only-fragment",
+    "1abc:80",
+    "//",
+    "http:",
+  };
+  for (auto s : uris) {
+    auto uri = URI{};
+    auto view = UriView{};
+    ASSERT_TRUE(uri.parse(s));
+    ASSERT_TRUE(view.parse(s));
+    ASSERT_EQ(uri.getScheme(), view.getScheme()) << s;
+    ASSERT_EQ(uri.getAuthority(), view.getAuthority()) << s;
+    ASSERT_EQ(uri.getUserInfo(), view.getUserInfo()) << s;
+    ASSERT_EQ(uri.getHost(), view.getHost()) << s;
+    ASSERT_EQ(uri.getPort(), view.getPort()) << s;
+    ASSERT_EQ(uri.getPath(), view.getPath()) << s;
+    ASSERT_EQ(uri.getQueryStr(), view.getQueryStr()) << s;
+    ASSERT_EQ(uri.getFragment(), view.getFragment()) << s;
+  }
+}
+
+TEST(URI, CopyAndMove) {
+  auto uri = URI{};
+  ASSERT_TRUE(uri.parse(std::string("https://www.google.com:443/path?q#f")));
+
+  auto copy = uri;
+  uri = URI{};
+  ASSERT_EQ("www.google.com", copy.getHost());
+  ASSERT_EQ("/path", copy.view().getPath());
+  ASSERT_EQ(copy.view().getStrUri().data() + 8, copy.view().getHost().data());
+
+  auto moved = std::move(copy);
+  ASSERT_EQ("www.google.com", moved.getHost());
+  ASSERT_EQ(443, moved.getPort());
+  ASSERT_EQ("f", moved.getFragment());
+  ASSERT_EQ("", copy.getHost());
+
+  copy = moved;
+  moved = URI{};
+  ASSERT_EQ("q", copy.getQueryStr());
+}
+
+TEST(URI, QueryString) {
+  std::vector<std::pair<std::string, std::string>> params;
+  for (const auto &param : QueryString{"a=1&&b=&c&=d&e=x=y&"}) {
+    params.emplace_back(param.key, param.value);
+  }
+  std::vector<std::pair<std::string, std::string>> expected = {
+    { "a", "1" }, { "b", "" }, { "c", "" }, { "", "d" }, { "e", "x=y" },
+  };
+  ASSERT_EQ(expected, params);
+
+  ASSERT_TRUE(QueryString{""}.begin() == QueryString{""}.end());
+  ASSERT_TRUE(QueryString{"&&"}.begin() == QueryString{"&&"}.end());
+
+  auto uri = URI{};
+  ASSERT_TRUE(uri.parse("http://host/path?k=v#frag"));
+  auto query = QueryString{uri.view().getQueryStr()};
+  auto it = query.begin();
+  ASSERT_EQ("k", it->key);
+  ASSERT_EQ("v", it->value);
+  ASSERT_TRUE(++it == query.end());
+}
+
+TEST(URI, QueryStringDecode) {
+  char buf[64];
+  std::string_view out;
+  ASSERT_TRUE(QueryString::decode("plain", buf, sizeof(buf), out));
+  ASSERT_EQ("plain", out);
+  ASSERT_TRUE(QueryString::decode("a+b%20c%2Fd%2f", buf, sizeof(buf), out));
+  ASSERT_EQ("a b c/d/", out);
+  ASSERT_TRUE(QueryString::decode("a+b", buf, sizeof(buf), out, false));
+  ASSERT_EQ("a+b", out);
+  // malformed escapes are kept
+  ASSERT_TRUE(QueryString::decode("%zz%4%", buf, sizeof(buf), out));
+  ASSERT_EQ("%zz%4%", out);
+  ASSERT_TRUE(QueryString::decode("%00%ff", buf, sizeof(buf), out));
+  ASSERT_EQ(std::string("\0\xff", 2), out);
+  ASSERT_TRUE(QueryString::decode("", buf, sizeof(buf), out));
+  ASSERT_EQ("", out);
+
+  ASSERT_FALSE(QueryString::decode("abc", buf, 2, out));
+
+  // long runs take the bulk copy path
+  auto in = std::string(100, 'x') + "%41" + std::string(100, 'y');
+  char big[256];
+  ASSERT_TRUE(QueryString::decode(in, big, sizeof(big), out));
+  ASSERT_EQ(std::string(100, 'x') + "A" + std::string(100, 'y'), out);
+}
+
+TEST(URI, QueryMap) {
+  std::string query = "name=J%C3%B6rg+M&page=2&flag&page=3&q=a%26b";
+  std::vector<char> buf(query.size());
+  QueryMap<> params;
+  ASSERT_TRUE(params.parse(query, buf.data(), buf.size()));
+  ASSERT_EQ(5u, params.size());
+  ASSERT_EQ("J\xc3\xb6rg M", params.get("name"));
+  ASSERT_EQ("2", params.get("page"));
+  ASSERT_EQ("a&b", params.get("q"));
+  ASSERT_TRUE(params.contains("flag"));
+  ASSERT_EQ("", params.get("flag", "x"));
+  ASSERT_FALSE(params.contains("missing"));
+  ASSERT_EQ("x", params.get("missing", "x"));
+  ASSERT_EQ(nullptr, params.find("missing"));
+
+  std::size_t n = 0;
+  for (const auto &param : params) {
+    ASSERT_FALSE(param.key.empty());
+    ++n;
+  }
+  ASSERT_EQ(5u, n);
+
+  QueryMap<2> small;
+  ASSERT_FALSE(small.parse(query, buf.data(), buf.size()));
+  ASSERT_FALSE(params.parse(query, buf.data(), 10));
+
+  ASSERT_TRUE(params.parse("", nullptr, 0));
+  ASSERT_EQ(0u, params.size());
+}
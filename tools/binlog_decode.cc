@@ -0,0 +1,33 @@
+#include "util/log_binary.hpp"
+#include <cstdio>
+
+using namespace nul;
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <binlog> [output]\n", argv[0]);
+    return 1;
+  }
+
+  auto in = fopen(argv[1], "rb");
+  if (!in) {
+    perror(argv[1]);
+    return 1;
+  }
+  auto out = argc > 2 ? fopen(argv[2], "w") : stdout;
+  if (!out) {
+    perror(argv[2]);
+    fclose(in);
+    return 1;
+  }
+
+  auto ok = BinaryLogDecoder::decode(in, out);
+  if (!ok) {
+    fprintf(stderr, "%s: not a binary log or truncated\n", argv[1]);
+  }
+  fclose(in);
+  if (out != stdout) {
+    fclose(out);
+  }
+  return ok ? 0 : 1;
+}